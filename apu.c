@@ -1,5 +1,734 @@
+#include <string.h>
 #include "apu.h"
+#include "blip.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "nes.h"
+
+struct nymphAPU apu;
+
+#define PULSE_1 0
+#define PULSE_2 1
+#define TRIANGLE 2
+#define NOISE 3
+#define DMC 4
+#define CHANNELS 5
+
+static const uint8_t length_table[32] = {
+    10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+    12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+};
+
+static const uint16_t noise_periods[16] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 };
+static const uint16_t dmc_rates[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+
+// CPU cycles from the start of the sequence to each step, four and five step modes
+static const uint16_t frame_steps[2][5] = {
+    { 7457, 14913, 22371, 29829 },
+    { 7457, 14913, 22371, 29829, 37281 },
+};
+static const uint16_t frame_lengths[2] = { 29830, 37282 };
+
+/*
+    Change log
+    Everything the synthesizer needs to hear about, in the order it happened. Register writes are
+    logged under the low bits of their address, the rest under these.
+*/
+#define LOG_SIZE 4096
+#define LOG_QUARTER 0x20        // envelopes and the triangle's linear counter
+#define LOG_HALF 0x21           // the same plus sweeps
+#define LOG_ACTIVE 0x22         // length counters went to or from 0, value is the new apu.active
+#define LOG_DMC_BYTE 0x23       // an output cycle starts with value in the shift register
+#define LOG_DMC_SILENT 0x24     // an output cycle starts with nothing to play
+#define LOG_MUTE 0x25           // value is the new set of MUTE_ bits
+
+struct change {
+    uint64_t time;
+    uint8_t what;
+    uint8_t value;
+};
+
+static struct change changes[LOG_SIZE];
+static int change_count;
+static int audio_enabled = 1;
+static uint8_t muted;
+
+static void synthesize(uint64_t until);
+
+// With sound off nothing ever gets logged, so the synthesizer never has anything to do
+static void logChange(uint64_t time, uint8_t what, uint8_t value) {
+    if(!audio_enabled) {
+        return;
+    }
+    if(change_count == LOG_SIZE) {
+        synthesize(time);
+    }
+    changes[change_count++] = (struct change) { time, what, value };
+}
+
+/*
+    What the CPU sees
+*/
+static void updateActive(uint64_t time) {
+    uint8_t active = (apu.length[0] > 0) | (apu.length[1] > 0) << 1 | (apu.length[2] > 0) << 2 | (apu.length[3] > 0) << 3;
+    if(active != apu.active) {
+        apu.active = active;
+        logChange(time, LOG_ACTIVE, active);
+    }
+}
+
+static void clockLengths(uint64_t time) {
+    for(int i = 0; i < 4; i++) {
+        if(apu.length[i] && !apu.halt[i]) {
+            apu.length[i]--;
+        }
+    }
+    updateActive(time);
+}
+
+static void scheduleFrameStep(void) {
+    scheduleEvent(EVENT_APU_FRAME, apu.frame_start + frame_steps[apu.frame_mode][apu.frame_step]);
+}
+
+static void frameEvent(uint64_t when) {
+    int step = apu.frame_step;
+    int last = apu.frame_mode ? 4 : 3;
+    if(step == 1 || step == last) {
+        logChange(when, LOG_HALF, 0);
+        clockLengths(when);
+    } else if(step != 3) {      // the five step sequence does nothing on its fourth step
+        logChange(when, LOG_QUARTER, 0);
+    }
+    if(!apu.frame_mode && step == last && !apu.frame_inhibit) {
+        apu.frame_irq = 1;
+        setIRQ(&cpu, IRQ_FRAME);
+    }
+    if(++apu.frame_step > last) {
+        apu.frame_step = 0;
+        apu.frame_start += frame_lengths[apu.frame_mode];
+    }
+    scheduleFrameStep();
+}
+
+// The DMC steals the bus for a sample byte, which the CPU feels as a few cycles' stall
+static void fetchSample(void) {
+    struct dmc_reader * dmc = &apu.dmc;
+    dmc->buffer = readRAM(dmc->address);
+    dmc->buffer_full = 1;
+    dmc->address = dmc->address == 0xffff ? 0x8000 : dmc->address + 1;
+    cpu.cycles += 4;
+    if(--dmc->remaining == 0) {
+        if(dmc->loop) {
+            dmc->address = dmc->start_address;
+            dmc->remaining = dmc->start_length;
+        } else if(dmc->irq_enable) {
+            apu.dmc_irq = 1;
+            setIRQ(&cpu, IRQ_DMC);
+        }
+    }
+}
+
+// Output cycles only need an event while there's something to play or stop playing
+static void scheduleDMC(void) {
+    if(apu.dmc.buffer_full || apu.dmc.playing) {
+        scheduleEvent(EVENT_DMA, apu.dmc.next);
+    } else {
+        cancelEvent(EVENT_DMA);
+    }
+}
+
+static void dmcEvent(uint64_t when) {
+    struct dmc_reader * dmc = &apu.dmc;
+    if(dmc->buffer_full) {
+        logChange(when, LOG_DMC_BYTE, dmc->buffer);
+        dmc->buffer_full = 0;
+        dmc->playing = 1;
+        if(dmc->remaining) {
+            fetchSample();
+        }
+    } else {
+        logChange(when, LOG_DMC_SILENT, 0);
+        dmc->playing = 0;
+    }
+    dmc->next = when + dmc->rate * 8;
+    scheduleDMC();
+}
+
+// $4015 with bit 4 set, the next output cycle is still where the timer would have put it
+static void startDMC(uint64_t now) {
+    struct dmc_reader * dmc = &apu.dmc;
+    if(dmc->remaining == 0) {
+        dmc->address = dmc->start_address;
+        dmc->remaining = dmc->start_length;
+    }
+    if(dmc->next <= now) {
+        uint64_t period = dmc->rate * 8;
+        dmc->next += ((now - dmc->next) / period + 1) * period;
+    }
+    if(!dmc->buffer_full) {
+        fetchSample();
+    }
+    scheduleDMC();
+}
+
+// $4000-$4013 read back as open bus, $4015 is the status
+uint8_t readAPU(uint16_t address) {
+    if(address != 0x4015) {
+        return address >> 8;
+    }
+    uint8_t status = apu.active | (apu.dmc.remaining > 0) << 4 | apu.frame_irq << 6 | apu.dmc_irq << 7;
+    apu.frame_irq = 0;
+    clearIRQ(&cpu, IRQ_FRAME);
+    return status;
+}
+
+void writeAPU(uint16_t address, uint8_t value) {
+    uint64_t now = cpu.cycles;
+    int reg = address & 0x1f;
+    switch(reg) {
+        case 0x00:
+        case 0x04:
+        case 0x0c:
+            apu.halt[reg >> 2] = (value >> 5) & 1;
+            break;
+        case 0x08:
+            apu.halt[TRIANGLE] = value >> 7;
+            break;
+        case 0x03:
+        case 0x07:
+        case 0x0b:
+        case 0x0f:
+            if(apu.enabled & (1 << (reg >> 2))) {
+                apu.length[reg >> 2] = length_table[value >> 3];
+            }
+            break;
+        case 0x10:
+            apu.dmc.irq_enable = value >> 7;
+            apu.dmc.loop = (value >> 6) & 1;
+            apu.dmc.rate = dmc_rates[value & 0x0f];
+            if(!apu.dmc.irq_enable) {
+                apu.dmc_irq = 0;
+                clearIRQ(&cpu, IRQ_DMC);
+            }
+            break;
+        case 0x12:
+            apu.dmc.start_address = 0xc000 + value * 64;
+            break;
+        case 0x13:
+            apu.dmc.start_length = value * 16 + 1;
+            break;
+        case 0x15:
+            apu.enabled = value & 0x1f;
+            for(int i = 0; i < 4; i++) {
+                if(!(value & (1 << i))) {
+                    apu.length[i] = 0;
+                }
+            }
+            apu.dmc_irq = 0;
+            clearIRQ(&cpu, IRQ_DMC);
+            if(value & 0x10) {
+                startDMC(now);
+            } else {
+                apu.dmc.remaining = 0;
+            }
+            break;
+        case 0x17:
+            apu.frame_mode = value >> 7;
+            apu.frame_inhibit = (value >> 6) & 1;
+            if(apu.frame_inhibit) {
+                apu.frame_irq = 0;
+                clearIRQ(&cpu, IRQ_FRAME);
+            }
+            apu.frame_start = now + 3 + (now & 1);     // the sequence restarts 3 or 4 cycles on, depending where in an APU cycle this was
+            apu.frame_step = 0;
+            scheduleFrameStep();
+            if(apu.frame_mode) {
+                logChange(now, LOG_HALF, 0);            // five step mode clocks everything straight away
+                clockLengths(now);
+            }
+            break;
+    }
+    if(reg <= 0x11) {
+        apu.regs[reg] = value;
+        logChange(now, reg, value);
+    }
+    updateActive(now);
+}
+
+/*
+    Synthesis
+    The channels as the speakers hear them, run from the log. Each one keeps the CPU cycle its timer
+    next runs out on and only does anything then, and only tells the blip buffer when its output level
+    actually changes. Levels get mixed with the usual linear approximation of the NES's DAC, which
+    keeps the channels independent so each one can be run on its own.
+*/
+#define OUTPUT_SCALE 30000.0f
+
+static const float channel_weights[CHANNELS] = {
+    0.00752f * OUTPUT_SCALE, 0.00752f * OUTPUT_SCALE, 0.00851f * OUTPUT_SCALE, 0.00494f * OUTPUT_SCALE, 0.00335f * OUTPUT_SCALE,
+};
+
+static const uint8_t duty_table[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 },
+};
+
+static const uint8_t triangle_table[32] = {
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+};
+
+struct envelope {
+    uint8_t start;
+    uint8_t divider;
+    uint8_t decay;
+    uint8_t period;         // also the volume when constant
+    uint8_t constant;
+    uint8_t loop;
+};
+
+struct pulse {
+    uint8_t duty;
+    uint8_t step;
+    uint16_t timer;
+    struct envelope envelope;
+    uint8_t sweep_enable;
+    uint8_t sweep_period;
+    uint8_t sweep_negate;
+    uint8_t sweep_shift;
+    uint8_t sweep_reload;
+    uint8_t sweep_divider;
+    uint64_t next;
+};
+
+struct triangle {
+    uint16_t timer;
+    uint8_t step;
+    uint8_t linear;
+    uint8_t linear_period;
+    uint8_t control;
+    uint8_t reload;
+    uint64_t next;
+};
+
+struct noise {
+    struct envelope envelope;
+    uint8_t mode;
+    uint16_t period;
+    uint16_t shift;
+    uint64_t next;
+};
+
+struct dmc_output {
+    uint8_t level;
+    uint8_t shift;
+    uint8_t bits;           // left to play from shift
+    uint16_t rate;
+    uint64_t next;
+};
+
+static struct {
+    struct pulse pulse[2];
+    struct triangle triangle;
+    struct noise noise;
+    struct dmc_output dmc;
+    uint8_t active;
+    uint8_t muted;
+    int level[CHANNELS];    // what each channel last told the blip buffer
+    uint64_t time;          // synthesized up to here
+    uint64_t frame;         // CPU cycle the blip buffer's frame started
+    uint32_t max_clocks;    // the longest frame that fits in the blip buffer
+} synth;
+
+static struct blip blip;
+
+static void emit(int channel, uint64_t time, int level) {
+    if(synth.muted & (1 << channel)) {
+        level = 0;
+    }
+    int delta = level - synth.level[channel];
+    if(delta) {
+        synth.level[channel] = level;
+        blipAddDelta(&blip, time - synth.frame, delta * channel_weights[channel]);
+    }
+}
+
+static int envelopeVolume(const struct envelope * e) {
+    return e->constant ? e->period : e->decay;
+}
+
+static void clockEnvelope(struct envelope * e) {
+    if(e->start) {
+        e->start = 0;
+        e->decay = 15;
+        e->divider = e->period;
+    } else if(e->divider) {
+        e->divider--;
+    } else {
+        e->divider = e->period;
+        if(e->decay) {
+            e->decay--;
+        } else if(e->loop) {
+            e->decay = 15;
+        }
+    }
+}
+
+// Pulse 1 negates with one's complement, pulse 2 with two's
+static int sweepTarget(const struct pulse * p, int channel) {
+    int change = p->timer >> p->sweep_shift;
+    if(p->sweep_negate) {
+        return p->timer - change - (channel == PULSE_1);
+    }
+    return p->timer + change;
+}
+
+// Volume while the duty cycle is high, 0 when something has the channel silenced whatever step it's on
+static int pulseVolume(const struct pulse * p, int channel) {
+    if(!(synth.active & ~synth.muted & (1 << channel)) || p->timer < 8 || sweepTarget(p, channel) > 0x7ff) {
+        return 0;
+    }
+    return envelopeVolume(&p->envelope);
+}
+
+static void clockSweep(struct pulse * p, int channel) {
+    if(p->sweep_divider == 0 && p->sweep_enable && p->sweep_shift && p->timer >= 8) {
+        int target = sweepTarget(p, channel);
+        if(target <= 0x7ff) {
+            p->timer = target;
+        }
+    }
+    if(p->sweep_divider == 0 || p->sweep_reload) {
+        p->sweep_divider = p->sweep_period;
+        p->sweep_reload = 0;
+    } else {
+        p->sweep_divider--;
+    }
+}
+
+static void runPulse(int channel, uint64_t until) {
+    struct pulse * p = &synth.pulse[channel];
+    if(p->next >= until) {
+        return;
+    }
+    uint32_t period = (p->timer + 1) * 2;
+    int volume = pulseVolume(p, channel);
+    if(volume == 0) {
+        uint64_t clocks = (until - p->next + period - 1) / period;     // silent all the way, just keep the phase
+        p->step = (p->step + clocks) & 7;
+        p->next += clocks * period;
+        return;
+    }
+    do {
+        p->step = (p->step + 1) & 7;
+        emit(channel, p->next, duty_table[p->duty][p->step] ? volume : 0);
+        p->next += period;
+    } while(p->next < until);
+}
+
+// The sequencer stops where it is when either counter runs out, and at ultrasonic periods it just holds too
+static void runTriangle(uint64_t until) {
+    struct triangle * t = &synth.triangle;
+    if(t->next >= until) {
+        return;
+    }
+    uint32_t period = t->timer + 1;
+    if(!(synth.active & ~synth.muted & (1 << TRIANGLE)) || t->linear == 0 || t->timer < 2) {
+        t->next += (until - t->next + period - 1) / period * period;
+        return;
+    }
+    do {
+        t->step = (t->step + 1) & 31;
+        emit(TRIANGLE, t->next, triangle_table[t->step]);
+        t->next += period;
+    } while(t->next < until);
+}
+
+// The shift register only gets clocked while it can be heard, nobody can tell where it's got to otherwise
+static void runNoise(uint64_t until) {
+    struct noise * n = &synth.noise;
+    if(n->next >= until) {
+        return;
+    }
+    int volume = (synth.active & ~synth.muted & (1 << NOISE)) ? envelopeVolume(&n->envelope) : 0;
+    if(volume == 0) {
+        n->next += (until - n->next + n->period - 1) / n->period * n->period;
+        return;
+    }
+    int tap = n->mode ? 6 : 1;
+    do {
+        uint16_t feedback = (n->shift ^ (n->shift >> tap)) & 1;
+        n->shift = (n->shift >> 1) | (feedback << 14);
+        emit(NOISE, n->next, (n->shift & 1) ? 0 : volume);
+        n->next += n->period;
+    } while(n->next < until);
+}
+
+static void runDMC(uint64_t until) {
+    struct dmc_output * d = &synth.dmc;
+    while(d->bits && d->next < until) {
+        if(d->shift & 1) {
+            d->level += d->level <= 125 ? 2 : 0;
+        } else {
+            d->level -= d->level >= 2 ? 2 : 0;
+        }
+        emit(DMC, d->next, d->level);
+        d->shift >>= 1;
+        d->bits--;
+        d->next += d->rate;
+    }
+}
+
+// Outputs that changed because of a register write or a frame counter clock rather than a timer
+static void refreshLevels(uint64_t time) {
+    for(int i = PULSE_1; i <= PULSE_2; i++) {
+        const struct pulse * p = &synth.pulse[i];
+        emit(i, time, duty_table[p->duty][p->step] ? pulseVolume(p, i) : 0);
+    }
+    emit(TRIANGLE, time, triangle_table[synth.triangle.step]);
+    const struct noise * n = &synth.noise;
+    emit(NOISE, time, (synth.active & (1 << NOISE)) && !(n->shift & 1) ? envelopeVolume(&n->envelope) : 0);
+    emit(DMC, time, synth.dmc.level);
+}
+
+static void quarterFrame(void) {
+    clockEnvelope(&synth.pulse[0].envelope);
+    clockEnvelope(&synth.pulse[1].envelope);
+    clockEnvelope(&synth.noise.envelope);
+    struct triangle * t = &synth.triangle;
+    if(t->reload) {
+        t->linear = t->linear_period;
+    } else if(t->linear) {
+        t->linear--;
+    }
+    if(!t->control) {
+        t->reload = 0;
+    }
+}
+
+static void writeEnvelope(struct envelope * e, uint8_t value) {
+    e->loop = (value >> 5) & 1;
+    e->constant = (value >> 4) & 1;
+    e->period = value & 0x0f;
+}
+
+static void applyChange(const struct change * c, uint64_t time) {
+    uint8_t value = c->value;
+    struct pulse * p = &synth.pulse[c->what >> 2 & 1];
+    switch(c->what) {
+        case 0x00:
+        case 0x04:
+            p->duty = value >> 6;
+            writeEnvelope(&p->envelope, value);
+            break;
+        case 0x01:
+        case 0x05:
+            p->sweep_enable = value >> 7;
+            p->sweep_period = (value >> 4) & 7;
+            p->sweep_negate = (value >> 3) & 1;
+            p->sweep_shift = value & 7;
+            p->sweep_reload = 1;
+            break;
+        case 0x02:
+        case 0x06:
+            p->timer = (p->timer & 0x700) | value;
+            break;
+        case 0x03:
+        case 0x07:
+            p->timer = (p->timer & 0xff) | (value & 7) << 8;
+            p->step = 0;
+            p->envelope.start = 1;
+            break;
+        case 0x08:
+            synth.triangle.control = value >> 7;
+            synth.triangle.linear_period = value & 0x7f;
+            break;
+        case 0x0a:
+            synth.triangle.timer = (synth.triangle.timer & 0x700) | value;
+            break;
+        case 0x0b:
+            synth.triangle.timer = (synth.triangle.timer & 0xff) | (value & 7) << 8;
+            synth.triangle.reload = 1;
+            break;
+        case 0x0c:
+            writeEnvelope(&synth.noise.envelope, value);
+            break;
+        case 0x0e:
+            synth.noise.mode = value >> 7;
+            synth.noise.period = noise_periods[value & 0x0f];
+            break;
+        case 0x0f:
+            synth.noise.envelope.start = 1;
+            break;
+        case 0x10:
+            synth.dmc.rate = dmc_rates[value & 0x0f];
+            break;
+        case 0x11:
+            synth.dmc.level = value & 0x7f;
+            break;
+        case LOG_HALF:
+            clockSweep(&synth.pulse[0], PULSE_1);
+            clockSweep(&synth.pulse[1], PULSE_2);
+            // fall through
+        case LOG_QUARTER:
+            quarterFrame();
+            break;
+        case LOG_ACTIVE:
+            synth.active = value;
+            break;
+        case LOG_DMC_BYTE:
+            synth.dmc.shift = value;
+            synth.dmc.bits = 8;
+            synth.dmc.next = time;
+            break;
+        case LOG_DMC_SILENT:
+            synth.dmc.bits = 0;
+            break;
+        case LOG_MUTE:
+            synth.muted = value;
+            break;
+    }
+}
+
+static void endSynthFrame(uint64_t time) {
+    blipEndFrame(&blip, time - synth.frame);
+    synth.frame = time;
+    int over = blipSamplesAvail(&blip) - BLIP_SIZE / 2;
+    if(over > 0) {
+        blipDiscard(&blip, over);     // nobody's reading, keep the newest
+    }
+}
+
+// Runs every channel's timer up to until, in pieces that fit in the blip buffer
+static void runChannels(uint64_t until) {
+    while(synth.time < until) {
+        uint64_t end = synth.frame + synth.max_clocks;
+        end = end < until ? end : until;
+        runPulse(PULSE_1, end);
+        runPulse(PULSE_2, end);
+        runTriangle(end);
+        runNoise(end);
+        runDMC(end);
+        synth.time = end;
+        if(end - synth.frame >= synth.max_clocks) {
+            endSynthFrame(end);
+        }
+    }
+}
+
+// Everything logged happened by until, events can log a cycle or two behind writes so time never goes backwards here
+static void synthesize(uint64_t until) {
+    for(int i = 0; i < change_count; i++) {
+        uint64_t time = changes[i].time > synth.time ? changes[i].time : synth.time;
+        runChannels(time);
+        applyChange(&changes[i], time);
+        refreshLevels(time);
+    }
+    change_count = 0;
+    runChannels(until);
+}
+
+void catchUpAPU(uint64_t cycle) {
+    if(!audio_enabled || cycle <= synth.time) {
+        return;
+    }
+    synthesize(cycle);
+    endSynthFrame(cycle);
+}
+
+int samplesAvailable(void) {
+    return blipSamplesAvail(&blip);
+}
+
+int readSamples(int16_t * out, int count) {
+    return blipReadSamples(&blip, out, count);
+}
+
+void setSampleRate(double rate) {
+    blipSetRates(&blip, APU_CLOCK_RATE, rate);
+    synth.max_clocks = blipClocksFor(&blip, BLIP_SIZE / 4);
+}
 
 void initAPU(void) {
+    setSampleRate(APU_SAMPLE_RATE);
+}
+
+/*
+    Starts the channels over at now from the registers as last written, envelopes and sequencers from
+    the top. The blip buffer and the levels it was last told about are kept, so the output carries on
+    from where it was without a click.
+*/
+static void restartSynth(uint64_t now) {
+    int level[CHANNELS];
+    memcpy(level, synth.level, sizeof(level));
+    memset(&synth, 0, sizeof(synth));
+    memcpy(synth.level, level, sizeof(level));
+    change_count = 0;
+    synth.noise.shift = 1;
+    synth.time = synth.frame = now;
+    synth.pulse[0].next = synth.pulse[1].next = synth.triangle.next = synth.noise.next = now;
+    synth.max_clocks = blipClocksFor(&blip, BLIP_SIZE / 4);
+    for(int reg = 0; reg <= 0x11; reg++) {
+        applyChange(&(struct change) { now, reg, apu.regs[reg] }, now);
+    }
+    synth.active = apu.active;
+    synth.muted = muted;
+    refreshLevels(now);
+}
+
+// The same from silence
+static void resetSynth(uint64_t now) {
+    blipClear(&blip);
+    memset(synth.level, 0, sizeof(synth.level));
+    restartSynth(now);
+}
+
+// Power on, all quiet with the frame counter in four step mode and its IRQ on
+void resetAPU(void) {
+    if(blip.factor == 0) {
+        initAPU();
+    }
+    memset(&apu, 0, sizeof(apu));
+    apu.dmc.rate = dmc_rates[0];
+    apu.dmc.next = cpu.cycles;
+    apu.frame_start = cpu.cycles;
+    setEventHandler(EVENT_APU_FRAME, frameEvent);
+    setEventHandler(EVENT_DMA, dmcEvent);
+    cancelEvent(EVENT_DMA);
+    scheduleFrameStep();
+    resetSynth(cpu.cycles);
+}
+
+/*
+    Turning sound off leaves just the half above the synthesizer, which is everything the CPU can see,
+    so nothing runs differently either way. Turning it back on picks up from the registers as they are
+    now.
+*/
+void setAudioEnabled(int enabled) {
+    enabled = enabled != 0;
+    if(enabled == audio_enabled) {
+        return;
+    }
+    audio_enabled = enabled;
+    if(enabled) {
+        resetSynth(cpu.cycles);
+    } else {
+        change_count = 0;
+        blipClear(&blip);
+    }
+}
+
+// apu has been put back to how it was at some other time (a save state), so the synthesizer picks up from there
+void syncAPU(void) {
+    if(audio_enabled) {
+        restartSynth(cpu.cycles);
+    }
+}
 
-}
\ No newline at end of file
+// Muted channels still keep time but skip making a waveform, the DMC's output level still follows its bits
+void setChannelMutes(uint8_t mask) {
+    muted = mask & 0x1f;
+    logChange(cpu.cycles, LOG_MUTE, muted);
+}
@@ -1,6 +1,70 @@
 #ifndef APU_H
 #define APU_H
 
+#include <inttypes.h>
+
+#define APU_CLOCK_RATE 1789773.0    // NTSC CPU clock, the APU runs off the same one
+#define APU_SAMPLE_RATE 48000       // what the output gets resampled to unless setSampleRate() says otherwise
+
+// setChannelMutes() bits
+#define MUTE_PULSE_1 0x01
+#define MUTE_PULSE_2 0x02
+#define MUTE_TRIANGLE 0x04
+#define MUTE_NOISE 0x08
+#define MUTE_DMC 0x10
+
+/*
+    The APU comes in two halves. What the CPU can see ($4015, the frame counter IRQ, the DMC reading
+    samples and stealing cycles for it) is kept up to date as it goes, on its own events. The channels'
+    waveforms only matter to the speakers, so register writes and frame counter clocks just get
+    logged with the cycle they happened on, and catchUpAPU() replays the log and synthesizes everything
+    up to then in one go. That happens once a frame, and the waveforms go through band-limited steps
+    (see blip.h) so nothing is stepped per cycle and nothing aliases. With setAudioEnabled(0) nothing
+    gets logged at all and the second half costs nothing.
+*/
+struct dmc_reader {
+    uint8_t irq_enable;         // $4010 bit 7
+    uint8_t loop;               // $4010 bit 6
+    uint16_t rate;              // CPU cycles per output bit
+    uint16_t start_address;     // $4012
+    uint16_t start_length;      // $4013
+    uint16_t address;           // next sample byte
+    uint16_t remaining;         // sample bytes still to fetch
+    uint8_t buffer;
+    uint8_t buffer_full;
+    uint8_t playing;            // the output unit has a byte, not silence
+    uint64_t next;              // CPU cycle the next 8 bit output cycle starts, where the buffer gets emptied
+};
+
+struct nymphAPU {
+    uint8_t enabled;            // $4015 bits 0-4
+    uint8_t length[4];          // length counters for pulse 1, pulse 2, triangle and noise
+    uint8_t halt[4];            // halt flags, which double as the envelope loop / linear counter control
+    uint8_t active;             // bit per channel whose length counter isn't 0, as last logged
+    uint8_t regs[0x12];         // $4000-$4011 as last written, to start the synthesizer back up from
+
+    uint8_t frame_mode;         // $4017 bit 7, five step sequence
+    uint8_t frame_inhibit;      // $4017 bit 6
+    uint8_t frame_irq;
+    int frame_step;
+    uint64_t frame_start;       // CPU cycle the current run through the sequence started
+
+    uint8_t dmc_irq;
+    struct dmc_reader dmc;
+};
+
+extern struct nymphAPU apu;
+
 void initAPU(void);
+void resetAPU(void);
+void syncAPU(void);
+void setSampleRate(double rate);
+void setAudioEnabled(int enabled);
+void setChannelMutes(uint8_t mask);
+uint8_t readAPU(uint16_t address);
+void writeAPU(uint16_t address, uint8_t value);
+void catchUpAPU(uint64_t cycle);
+int samplesAvailable(void);
+int readSamples(int16_t * out, int count);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,87 @@
+#include <string.h>
+#include "audio.h"
+#include "apu.h"
+
+// Before either side starts, this sets the APU's output rate too
+void ringInit(struct audio_ring * r, double rate, double target) {
+    atomic_init(&r->write, 0);
+    atomic_init(&r->read, 0);
+    atomic_init(&r->underruns, 0);
+    atomic_init(&r->overruns, 0);
+    r->last = 0;
+    r->rate = rate;
+    r->target = target;
+    r->fill = target;
+    memset(r->samples, 0, sizeof(r->samples));
+    setSampleRate(rate);
+}
+
+// Only exact from the side that's asking, the other one can only have made it more or less since
+int ringFill(struct audio_ring * r) {
+    return (uint32_t) (atomic_load_explicit(&r->write, memory_order_acquire) - atomic_load_explicit(&r->read, memory_order_acquire));
+}
+
+// Copies in what fits and drops the rest, the consumer's index isn't ours to move
+int ringWrite(struct audio_ring * r, const int16_t * in, int count) {
+    uint32_t write = atomic_load_explicit(&r->write, memory_order_relaxed);
+    uint32_t read = atomic_load_explicit(&r->read, memory_order_acquire);   // it's finished with everything before this
+    int room = AUDIO_RING_SIZE - (uint32_t) (write - read);
+    int n = count < room ? count : room;
+    int start = write & (AUDIO_RING_SIZE - 1);
+    int first = n < AUDIO_RING_SIZE - start ? n : AUDIO_RING_SIZE - start;
+    memcpy(&r->samples[start], in, first * sizeof(int16_t));
+    memcpy(r->samples, in + first, (n - first) * sizeof(int16_t));
+    atomic_store_explicit(&r->write, write + n, memory_order_release);      // publishes the samples with the index
+    if(n < count) {
+        atomic_fetch_add_explicit(&r->overruns, count - n, memory_order_relaxed);
+    }
+    return n;
+}
+
+int ringRead(struct audio_ring * r, int16_t * out, int count) {
+    uint32_t read = atomic_load_explicit(&r->read, memory_order_relaxed);
+    uint32_t write = atomic_load_explicit(&r->write, memory_order_acquire);
+    int available = (uint32_t) (write - read);
+    int n = count < available ? count : available;
+    int start = read & (AUDIO_RING_SIZE - 1);
+    int first = n < AUDIO_RING_SIZE - start ? n : AUDIO_RING_SIZE - start;
+    memcpy(out, &r->samples[start], first * sizeof(int16_t));
+    memcpy(out + first, r->samples, (n - first) * sizeof(int16_t));
+    atomic_store_explicit(&r->read, read + n, memory_order_release);        // hands the space back
+    if(n) {
+        r->last = out[n - 1];
+    }
+    return n;
+}
+
+// For a callback that has to hand over count samples right now whether they're there or not
+void ringPlay(struct audio_ring * r, int16_t * out, int count) {
+    int n = ringRead(r, out, count);
+    for(int i = n; i < count; i++) {
+        out[i] = r->last;
+    }
+    if(n < count) {
+        atomic_fetch_add_explicit(&r->underruns, count - n, memory_order_relaxed);
+    }
+}
+
+/*
+    Moves everything the APU has made into the ring, once a frame after runFrame(). The fill level
+    wobbles by a frame's worth of samples as each one goes in and the consumer takes them out in its
+    own sized bites, so the rate follows a running average rather than the level right now.
+*/
+int pushAudio(struct audio_ring * r) {
+    int16_t chunk[1024];
+    int pushed = 0;
+    int n;
+    while((n = readSamples(chunk, 1024)) > 0) {
+        pushed += ringWrite(r, chunk, n);
+    }
+    if(r->target > 0) {
+        r->fill += (ringFill(r) - r->fill) * AUDIO_SMOOTHING;
+        double skew = (r->target - r->fill) / r->target * AUDIO_MAX_SKEW;    // running low, make more
+        skew = skew > AUDIO_MAX_SKEW ? AUDIO_MAX_SKEW : skew < -AUDIO_MAX_SKEW ? -AUDIO_MAX_SKEW : skew;
+        setSampleRate(r->rate * (1 + skew));
+    }
+    return pushed;
+}
@@ -0,0 +1,46 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <inttypes.h>
+#include <stdatomic.h>
+
+/*
+    Audio output
+
+    Samples go from the emulation thread to whatever plays them (the SDL callback, a file writer) through
+    a ring with exactly one writer and one reader. Each side only ever moves its own index and reads the
+    other's, so neither waits on a lock and the two can sit on different cores.
+
+    The emulator and the sound card run off different clocks, so left alone the ring slowly fills up or
+    drains however well the frames are paced. pushAudio() nudges the APU's output rate by up to
+    AUDIO_MAX_SKEW, a few cents of pitch nobody can hear, to hold the fill level around the target.
+*/
+#define AUDIO_RING_SIZE 16384       // samples, has to be a power of 2
+#define AUDIO_MAX_SKEW 0.005        // most the output rate gets moved off nominal
+#define AUDIO_SMOOTHING (1 / 32.0)  // how much of each frame's fill level goes into the average
+
+struct audio_ring {
+    _Alignas(64) atomic_uint_fast32_t write;    // total samples written, only the producer moves it
+    _Alignas(64) atomic_uint_fast32_t read;     // total samples read, only the consumer moves it
+    int16_t last;                               // consumer's, repeated through an underrun instead of clicking to 0
+    atomic_uint_fast64_t underruns;             // samples the consumer wanted that weren't there yet
+    _Alignas(64) atomic_uint_fast64_t overruns; // samples the producer dropped for want of room
+    double rate;                                // producer's, nominal output rate
+    double target;                              // fill level to hold in samples, 0 leaves the rate alone
+    double fill;                                // smoothed fill level
+    int16_t samples[AUDIO_RING_SIZE];
+};
+
+// Either thread
+void ringInit(struct audio_ring * r, double rate, double target);
+int ringFill(struct audio_ring * r);
+
+// Producer
+int ringWrite(struct audio_ring * r, const int16_t * in, int count);
+int pushAudio(struct audio_ring * r);
+
+// Consumer
+int ringRead(struct audio_ring * r, int16_t * out, int count);
+void ringPlay(struct audio_ring * r, int16_t * out, int count);
+
+#endif
@@ -0,0 +1,408 @@
+/*
+    Microbenchmarks
+
+    bench [suite...]    runs the named suites, or all of them with no arguments
+
+    Each suite times the hot paths on their own with made up input so the numbers don't depend on a
+    game. Build with the same flags as the emulator, e.g. -O2 -mavx2 to get the AVX2 kernels, and
+    -DNYMPH_DISPATCH=... to compare the CPU dispatch backends.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include "render.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "apu.h"
+#include "nes.h"
+#include "rom.h"
+#include "mapper.h"
+#include "state.h"
+#include "rewind.h"
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile uint32_t sink;      // keeps results alive so nothing gets optimised away
+
+/*
+    Pixels
+    Tile decoding and palette lookups, scalar against whatever vector path this build picked.
+*/
+#define PIXEL_ROWS 4096
+#define PIXEL_REPEATS 2000
+
+static uint8_t low[PIXEL_ROWS];
+static uint8_t high[PIXEL_ROWS];
+static uint8_t decoded[2][PIXEL_ROWS * 8];
+static uint32_t argb[2][PIXEL_ROWS * 8];
+
+// One 8 row tile a call, the way the PPU's tile cache decodes them
+static double timeDecode(void (* decode)(const uint8_t *, const uint8_t *, uint8_t *, int), uint8_t * out) {
+    double start = now();
+    for(int i = 0; i < PIXEL_REPEATS; i++) {
+        for(int row = 0; row < PIXEL_ROWS; row += 8) {
+            decode(low + row, high + row, out + row * 8, 8);
+        }
+        sink += out[i & (PIXEL_ROWS * 8 - 1)];
+    }
+    return now() - start;
+}
+
+static double timeLookup(void (* lookup)(const uint8_t *, const uint32_t *, uint32_t *, int), const uint32_t * table, uint32_t * out) {
+    double start = now();
+    for(int i = 0; i < PIXEL_REPEATS; i++) {
+        lookup(decoded[0], table, out, PIXEL_ROWS * 8);
+        sink += out[i & (PIXEL_ROWS * 8 - 1)];
+    }
+    return now() - start;
+}
+
+static void report(const char * what, double seconds, double pixels) {
+    printf("  %-18s %8.1f Mpixels/s\n", what, pixels / seconds / 1e6);
+}
+
+// Scalar against itself is only noise, so there's no ratio without a vector path to compare
+static void speedup(int vectorized, double scalar, double vector, int mismatch) {
+    if(vectorized) {
+        printf("  %-18s %8.2fx%s\n", "speedup", scalar / vector, mismatch ? "  MISMATCH" : "");
+    } else {
+        printf("  %-18s %8s%s\n", "speedup", "no vector path", mismatch ? "  MISMATCH" : "");
+    }
+}
+
+static void benchPixels(void) {
+    srand(1);
+    for(int i = 0; i < PIXEL_ROWS; i++) {
+        low[i] = rand();
+        high[i] = rand();
+    }
+    uint32_t table[32];
+    for(int i = 0; i < 32; i++) {
+        table[i] = 0xff000000 | (rand() & 0xffffff);
+    }
+    double pixels = (double) PIXEL_ROWS * 8 * PIXEL_REPEATS;
+    printf("pixels (%s)\n", render_backend);
+
+    double scalar = timeDecode(decodeRowsScalar, decoded[0]);
+    double vector = timeDecode(decodeRows, decoded[1]);
+    report("decode scalar", scalar, pixels);
+    report("decode", vector, pixels);
+    speedup(render_vector_decode, scalar, vector, memcmp(decoded[0], decoded[1], sizeof(decoded[0])) != 0);
+
+    scalar = timeLookup(lookupColoursScalar, table, argb[0]);
+    vector = timeLookup(lookupColours, table, argb[1]);
+    report("colours scalar", scalar, pixels);
+    report("colours", vector, pixels);
+    speedup(render_vector_colours, scalar, vector, memcmp(argb[0], argb[1], sizeof(argb[0])) != 0);
+}
+
+/*
+    CPU
+    Little 6502 loops that run forever out of the 2 KB of RAM, each leaning on a different part of the core.
+    Every run starts from the same memory and registers so the instruction stream is identical each
+    time, the best of a few runs gets reported. interpret() is one instruction per call like a
+    debugger would step it, runCPU() is the threaded loop the scheduler uses.
+*/
+#define CPU_INSTRUCTIONS 20000000
+#define CPU_RUNS 3
+#define NTSC_CPU_HZ 1789773.0
+
+struct workload {
+    const char * name;
+    uint8_t code[0x40];     // loaded at $0200
+};
+
+static const struct workload workloads[] = {
+    { "alu", {                                      // immediate and zero page arithmetic
+        0xa2, 0x00,             // $0200  LDX #$00
+        0x8a,                   // $0202  TXA
+        0x69, 0x37,             //        ADC #$37
+        0x49, 0x5a,             //        EOR #$5A
+        0x29, 0xf0,             //        AND #$F0
+        0x05, 0x10,             //        ORA $10
+        0x85, 0x11,             //        STA $11
+        0x0a,                   //        ASL A
+        0x26, 0x11,             //        ROL $11
+        0xe8,                   //        INX
+        0x4c, 0x02, 0x02,       //        JMP $0202
+    } },
+    { "memcpy", {                                   // indexed and indirect indexed loads and stores
+        0xa0, 0x00,             // $0200  LDY #$00
+        0xb9, 0x00, 0x03,       // $0202  LDA $0300,Y
+        0x99, 0x00, 0x04,       //        STA $0400,Y
+        0xb1, 0x20,             //        LDA ($20),Y
+        0x9d, 0x00, 0x06,       //        STA $0600,X
+        0xe8,                   //        INX
+        0xc8,                   //        INY
+        0xd0, 0xf1,             //        BNE $0202
+        0x4c, 0x00, 0x02,       //        JMP $0200
+    } },
+    { "branch", {                                   // a mix of taken and not taken branches
+        0xe8,                   // $0200  INX
+        0x8a,                   //        TXA
+        0x4a,                   //        LSR A
+        0x90, 0x01,             //        BCC $0206
+        0xc8,                   //        INY
+        0x4a,                   // $0206  LSR A
+        0xb0, 0x01,             //        BCS $020A
+        0x88,                   //        DEY
+        0xc0, 0x40,             // $020A  CPY #$40
+        0xd0, 0x00,             //        BNE $020E
+        0x24, 0x10,             // $020E  BIT $10
+        0x10, 0x00,             //        BPL $0212
+        0x50, 0x00,             // $0212  BVC $0214
+        0x4c, 0x00, 0x02,       // $0214  JMP $0200
+    } },
+    { "stack", {                                    // nested subroutine calls and pushes
+        [0x00] = 0x20, 0x10, 0x02,  // $0200  JSR $0210
+                 0x48,              //        PHA
+                 0x08,              //        PHP
+                 0x28,              //        PLP
+                 0x68,              //        PLA
+                 0x4c, 0x00, 0x02,  //        JMP $0200
+        [0x10] = 0x20, 0x20, 0x02,  // $0210  JSR $0220
+                 0x60,              //        RTS
+        [0x20] = 0x8a,              // $0220  TXA
+                 0x48,              //        PHA
+                 0xe8,              //        INX
+                 0x68,              //        PLA
+                 0x60,              //        RTS
+    } },
+};
+
+static void loadWorkload(const struct workload * w) {
+    uint8_t * ram = mmu.cpu_mem;
+    memset(ram, 0, CPU_MEM_SIZE);
+    memcpy(ram + 0x0200, w->code, sizeof(w->code));
+    for(int i = 0; i < 0x100; i++) {
+        ram[0x0300 + i] = i * 7;
+    }
+    ram[0x10] = 0x5a;
+    ram[0x20] = 0x00;      // ($20) points at $0500
+    ram[0x21] = 0x05;
+    cpu.a = 0;
+    cpu.x = 0;
+    cpu.y = 0;
+    cpu.sp = 0xfd;
+    setStatus(&cpu, 0x24);
+    cpu.pc = 0x0200;
+    cpu.cycles = 0;
+    flushBlocks();          // the code went in behind the CPU's back
+}
+
+static void benchCPU(void) {
+    static const char * const dispatch[] = { "switch", "table", "goto" };
+    printf("cpu (%s dispatch, block cache %s, %d instructions, best of %d)\n", dispatch[NYMPH_DISPATCH],
+           NYMPH_BLOCK_CACHE ? "on" : "off", CPU_INSTRUCTIONS, CPU_RUNS);
+    init_mmu();
+
+    for(size_t i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+        const struct workload * w = &workloads[i];
+        double stepped = 1e9;
+        double threaded = 1e9;
+        uint64_t cycles = 0;
+        for(int run = 0; run < CPU_RUNS; run++) {
+            loadWorkload(w);
+            double start = now();
+            for(int n = 0; n < CPU_INSTRUCTIONS; n++) {
+                interpret(&cpu);
+            }
+            double seconds = now() - start;
+            stepped = seconds < stepped ? seconds : stepped;
+            cycles = cpu.cycles;
+
+            // Same stream again by cycle count, which is exactly the same instructions
+            loadWorkload(w);
+            start = now();
+            runCPU(&cpu, cycles);
+            seconds = now() - start;
+            threaded = seconds < threaded ? seconds : threaded;
+        }
+        sink += cpu.a;
+        printf("  %-8s interpret %7.1f MIPS %6.2f ns/op   runCPU %7.1f MIPS %6.2f ns/op %7.1fx realtime\n", w->name,
+               CPU_INSTRUCTIONS / stepped / 1e6, stepped / CPU_INSTRUCTIONS * 1e9,
+               CPU_INSTRUCTIONS / threaded / 1e6, threaded / CPU_INSTRUCTIONS * 1e9,
+               cycles / threaded / NTSC_CPU_HZ);
+    }
+    clean_mem();
+}
+
+/*
+    APU
+    Synthesis on its own: all four tone channels playing, with some register writes spread over each
+    frame the way a music driver would, caught up and read out once a frame like the front end does.
+    Then the same with sound off, which leaves just the register writes.
+*/
+#define APU_FRAMES 3000
+#define APU_FRAME_CYCLES 29781
+
+static void benchAPU(void) {
+    static int16_t samples[4096];
+    static const uint8_t setup[][2] = {
+        { 0x15, 0x0f }, { 0x00, 0xbf }, { 0x02, 0xfd }, { 0x03, 0x08 }, { 0x04, 0x7a }, { 0x06, 0x7e },
+        { 0x07, 0x09 }, { 0x08, 0xff }, { 0x0a, 0x40 }, { 0x0b, 0x08 }, { 0x0c, 0x3f }, { 0x0e, 0x04 }, { 0x0f, 0x08 },
+    };
+    printf("apu (%d frames at %d Hz)\n", APU_FRAMES, APU_SAMPLE_RATE);
+    cpu.cycles = 0;
+    resetAPU();
+    for(size_t i = 0; i < sizeof(setup) / sizeof(setup[0]); i++) {
+        writeAPU(0x4000 + setup[i][0], setup[i][1]);
+    }
+
+    for(int quiet = 0; quiet < 2; quiet++) {
+        setAudioEnabled(!quiet);
+        int read = 0;
+        double start = now();
+        for(int frame = 0; frame < APU_FRAMES; frame++) {
+            uint64_t base = (uint64_t) (frame + quiet * APU_FRAMES) * APU_FRAME_CYCLES;
+            for(int i = 0; i < 8; i++) {
+                cpu.cycles = base + i * (APU_FRAME_CYCLES / 8);
+                writeAPU(0x4002, 0x80 + ((frame + i) & 0x7f));      // vibrato
+                writeAPU(0x400a, 0x40 + (frame & 0x3f));
+            }
+            cpu.cycles = base + APU_FRAME_CYCLES;
+            catchUpAPU(cpu.cycles);
+            read += readSamples(samples, 4096);
+            sink += samples[0];
+        }
+        double seconds = now() - start;
+        printf("  %-18s %8.2f us/frame %7.1fx realtime  %d samples\n", quiet ? "sound off" : "synthesis", seconds / APU_FRAMES * 1e6,
+               (double) APU_FRAMES * APU_FRAME_CYCLES / APU_CLOCK_RATE / seconds, read);
+    }
+    setAudioEnabled(1);
+    cpu.cycles = 0;
+}
+
+/*
+    Save states
+    A 32 KB NROM cart with CHR-ROM spinning in a loop that keeps RAM changing, a few frames in.
+    Saves and loads one state over and over.
+*/
+#define STATE_REPEATS 100000
+
+static uint8_t cart_image[16 + 0x8000 + 0x2000];
+
+static int loopCart(const char * suite) {
+    static const uint8_t loop[] = {
+        0xe8,                   // $8000  INX
+        0x9d, 0x00, 0x03,       //        STA $0300,X
+        0x4c, 0x00, 0x80,       //        JMP $8000
+    };
+    memcpy(cart_image, "NES\x1a\x02\x01", 6);
+    memcpy(cart_image + 16, loop, sizeof(loop));
+    cart_image[16 + 0x7ffc] = 0x00;         // reset vector $8000
+    cart_image[16 + 0x7ffd] = 0x80;
+    init_mmu();
+    if(parseROM(cart_image, sizeof(cart_image), &cart) != ROM_OK || initMapper() != ROM_OK) {
+        printf("%s: no cart\n", suite);
+        return 0;
+    }
+    initNES();
+    for(int i = 0; i < 10; i++) {
+        runFrame();
+    }
+    return 1;
+}
+
+static void benchState(void) {
+    static uint8_t state[32768];
+    if(!loopCart("state")) {
+        return;
+    }
+
+    size_t size = 0;
+    double start = now();
+    for(int i = 0; i < STATE_REPEATS; i++) {
+        size = saveState(state, sizeof(state));
+    }
+    double save = now() - start;
+    start = now();
+    for(int i = 0; i < STATE_REPEATS; i++) {
+        sink += loadState(state, size);
+    }
+    double load = now() - start;
+    printf("state (NROM, %zu bytes)\n", size);
+    printf("  %-18s %8.3f us\n", "save", save / STATE_REPEATS * 1e6);
+    printf("  %-18s %8.3f us\n", "load", load / STATE_REPEATS * 1e6);
+    clean_mem();
+}
+
+/*
+    Rewind
+    The same cart pushed every frame for a minute into 4 MB, then gone back through a second at a time.
+    Push is timed on its own, the frames in between aren't part of it.
+*/
+#define REWIND_FRAMES 3600
+#define REWIND_STEP 60
+
+static void benchRewind(void) {
+    struct rewind_buffer r;
+    if(!loopCart("rewind")) {
+        return;
+    }
+    if(rewindInit(&r, 4 << 20) != 0) {
+        printf("rewind: no memory\n");
+        clean_mem();
+        return;
+    }
+
+    double pushing = 0;
+    for(int i = 0; i < REWIND_FRAMES; i++) {
+        double start = now();
+        rewindPush(&r);
+        pushing += now() - start;
+        runFrame();
+    }
+    int held = rewindFrames(&r);
+    size_t used = rewindUsed(&r);
+    int seeks = 0;
+    double start = now();
+    while(rewindFrames(&r) >= REWIND_STEP) {
+        sink += rewindSeek(&r, REWIND_STEP);
+        seeks++;
+    }
+    double seeking = now() - start;
+    printf("rewind (NROM, %d frames in %zu KB)\n", held, used >> 10);
+    printf("  %-18s %8.1f bytes\n", "per frame", (double) used / (held + 1));
+    printf("  %-18s %8.3f us\n", "push", pushing / REWIND_FRAMES * 1e6);
+    printf("  %-18s %8.3f us\n", "back a second", seeking / seeks * 1e6);
+    rewindFree(&r);
+    clean_mem();
+}
+
+static const struct {
+    const char * name;
+    void (* run)(void);
+} suites[] = {
+    { "pixels", benchPixels },
+    { "cpu", benchCPU },
+    { "apu", benchAPU },
+    { "state", benchState },
+    { "rewind", benchRewind },
+};
+
+int main(int argc, char * argv[]) {
+    int ran = 0;
+    for(size_t i = 0; i < sizeof(suites) / sizeof(suites[0]); i++) {
+        int wanted = argc < 2;
+        for(int j = 1; j < argc; j++) {
+            wanted |= strcmp(argv[j], suites[i].name) == 0;
+        }
+        if(wanted) {
+            suites[i].run();
+            ran++;
+        }
+    }
+    if(!ran) {
+        fprintf(stderr, "no such suite\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+#include <string.h>
+#include "blip.h"
+
+#define PHASE_BITS 5            // log2 of BLIP_PHASES
+#define HIGH_PASS_HZ 90.0       // the first of the NES's own output filters, keeps the DC off the output
+#define PI 3.14159265358979323846
+
+/*
+    One impulse per phase, a Blackman windowed sinc cut off at 0.45 of the output rate and shifted by
+    phase / BLIP_PHASES of a sample, each normalised to add up to 1 so a step settles exactly on its new
+    level. Worked out once offline rather than at start up so the core doesn't need libm.
+*/
+static const float kernel[BLIP_PHASES][BLIP_WIDTH] = {
+    { 0.000538, -0.003353, 0.010956, -0.025733, 0.047623, -0.072368, 0.092318, 0.900036, 0.092318, -0.072368, 0.047623, -0.025733, 0.010956, -0.003353, 0.000538, 0.000000 },
+    { 0.000531, -0.003297, 0.010578, -0.024258, 0.043368, -0.061813, 0.064598, 0.898811, 0.121280, -0.082825, 0.051672, -0.027060, 0.011257, -0.003378, 0.000538, 0.000000 },
+    { 0.000518, -0.003214, 0.010130, -0.022654, 0.038951, -0.051247, 0.038209, 0.895141, 0.151381, -0.093094, 0.055468, -0.028218, 0.011473, -0.003371, 0.000529, -0.000001 },
+    { 0.000499, -0.003107, 0.009621, -0.020942, 0.034414, -0.040753, 0.013236, 0.889045, 0.182512, -0.103082, 0.058969, -0.029189, 0.011597, -0.003329, 0.000510, -0.000002 },
+    { 0.000476, -0.002979, 0.009060, -0.019142, 0.029802, -0.030413, -0.010251, 0.880555, 0.214555, -0.112692, 0.062130, -0.029955, 0.011622, -0.003250, 0.000483, -0.000002 },
+    { 0.000449, -0.002832, 0.008454, -0.017273, 0.025155, -0.020299, -0.032188, 0.869715, 0.247383, -0.121828, 0.064909, -0.030497, 0.011542, -0.003131, 0.000444, -0.000003 },
+    { 0.000418, -0.002670, 0.007811, -0.015355, 0.020515, -0.010482, -0.052524, 0.856579, 0.280866, -0.130393, 0.067262, -0.030800, 0.011351, -0.002971, 0.000394, -0.000002 },
+    { 0.000386, -0.002495, 0.007140, -0.013407, 0.015918, -0.001026, -0.071218, 0.841217, 0.314862, -0.138287, 0.069152, -0.030848, 0.011044, -0.002769, 0.000332, 0.000000 },
+    { 0.000352, -0.002311, 0.006448, -0.011448, 0.011401, 0.008010, -0.088238, 0.823705, 0.349229, -0.145415, 0.070539, -0.030630, 0.010617, -0.002522, 0.000259, 0.000003 },
+    { 0.000318, -0.002119, 0.005744, -0.009496, 0.006999, 0.016573, -0.103565, 0.804134, 0.383816, -0.151678, 0.071389, -0.030132, 0.010068, -0.002232, 0.000172, 0.000008 },
+    { 0.000283, -0.001923, 0.005034, -0.007565, 0.002742, 0.024615, -0.117188, 0.782604, 0.418471, -0.156984, 0.071670, -0.029345, 0.009393, -0.001896, 0.000073, 0.000014 },
+    { 0.000250, -0.001724, 0.004325, -0.005673, -0.001340, 0.032096, -0.129106, 0.759224, 0.453037, -0.161240, 0.071353, -0.028263, 0.008593, -0.001516, -0.000039, 0.000023 },
+    { 0.000217, -0.001526, 0.003624, -0.003834, -0.005221, 0.038980, -0.139332, 0.734113, 0.487356, -0.164357, 0.070413, -0.026879, 0.007667, -0.001092, -0.000163, 0.000034 },
+    { 0.000186, -0.001330, 0.002937, -0.002061, -0.008879, 0.045240, -0.147883, 0.707395, 0.521269, -0.166251, 0.068828, -0.025191, 0.006616, -0.000626, -0.000299, 0.000048 },
+    { 0.000157, -0.001139, 0.002269, -0.000365, -0.012292, 0.050852, -0.154789, 0.679207, 0.554616, -0.166842, 0.066584, -0.023200, 0.005444, -0.000118, -0.000447, 0.000065 },
+    { 0.000130, -0.000953, 0.001625, 0.001242, -0.015443, 0.055800, -0.160087, 0.649686, 0.587239, -0.166056, 0.063667, -0.020907, 0.004153, 0.000428, -0.000607, 0.000084 },
+    { 0.000106, -0.000776, 0.001010, 0.002751, -0.018319, 0.060073, -0.163825, 0.618980, 0.618980, -0.163825, 0.060073, -0.018319, 0.002751, 0.001010, -0.000776, 0.000106 },
+    { 0.000084, -0.000607, 0.000428, 0.004153, -0.020907, 0.063667, -0.166056, 0.587239, 0.649686, -0.160087, 0.055800, -0.015443, 0.001242, 0.001625, -0.000953, 0.000130 },
+    { 0.000065, -0.000447, -0.000118, 0.005444, -0.023200, 0.066584, -0.166842, 0.554616, 0.679207, -0.154789, 0.050852, -0.012292, -0.000365, 0.002269, -0.001139, 0.000157 },
+    { 0.000048, -0.000299, -0.000626, 0.006616, -0.025191, 0.068828, -0.166251, 0.521269, 0.707395, -0.147883, 0.045240, -0.008879, -0.002061, 0.002937, -0.001330, 0.000186 },
+    { 0.000034, -0.000163, -0.001092, 0.007667, -0.026879, 0.070413, -0.164357, 0.487356, 0.734113, -0.139332, 0.038980, -0.005221, -0.003834, 0.003624, -0.001526, 0.000217 },
+    { 0.000023, -0.000039, -0.001516, 0.008593, -0.028263, 0.071353, -0.161240, 0.453037, 0.759224, -0.129106, 0.032096, -0.001340, -0.005673, 0.004325, -0.001724, 0.000250 },
+    { 0.000014, 0.000073, -0.001896, 0.009393, -0.029345, 0.071670, -0.156984, 0.418471, 0.782604, -0.117188, 0.024615, 0.002742, -0.007565, 0.005034, -0.001923, 0.000283 },
+    { 0.000008, 0.000172, -0.002232, 0.010068, -0.030132, 0.071389, -0.151678, 0.383816, 0.804134, -0.103565, 0.016573, 0.006999, -0.009496, 0.005744, -0.002119, 0.000318 },
+    { 0.000003, 0.000259, -0.002522, 0.010617, -0.030630, 0.070539, -0.145415, 0.349229, 0.823705, -0.088238, 0.008010, 0.011401, -0.011448, 0.006448, -0.002311, 0.000352 },
+    { 0.000000, 0.000332, -0.002769, 0.011044, -0.030848, 0.069152, -0.138287, 0.314862, 0.841217, -0.071218, -0.001026, 0.015918, -0.013407, 0.007140, -0.002495, 0.000386 },
+    { -0.000002, 0.000394, -0.002971, 0.011351, -0.030800, 0.067262, -0.130393, 0.280866, 0.856579, -0.052524, -0.010482, 0.020515, -0.015355, 0.007811, -0.002670, 0.000418 },
+    { -0.000003, 0.000444, -0.003131, 0.011542, -0.030497, 0.064909, -0.121828, 0.247383, 0.869715, -0.032188, -0.020299, 0.025155, -0.017273, 0.008454, -0.002832, 0.000449 },
+    { -0.000002, 0.000483, -0.003250, 0.011622, -0.029955, 0.062130, -0.112692, 0.214555, 0.880555, -0.010251, -0.030413, 0.029802, -0.019142, 0.009060, -0.002979, 0.000476 },
+    { -0.000002, 0.000510, -0.003329, 0.011597, -0.029189, 0.058969, -0.103082, 0.182512, 0.889045, 0.013236, -0.040753, 0.034414, -0.020942, 0.009621, -0.003107, 0.000499 },
+    { -0.000001, 0.000529, -0.003371, 0.011473, -0.028218, 0.055468, -0.093094, 0.151381, 0.895141, 0.038209, -0.051247, 0.038951, -0.022654, 0.010130, -0.003214, 0.000518 },
+    { 0.000000, 0.000538, -0.003378, 0.011257, -0.027060, 0.051672, -0.082825, 0.121280, 0.898811, 0.064598, -0.061813, 0.043368, -0.024258, 0.010578, -0.003297, 0.000531 },
+};
+
+void blipSetRates(struct blip * b, double clock_rate, double sample_rate) {
+    b->clock_rate = clock_rate;
+    b->sample_rate = sample_rate;
+    b->factor = (uint64_t) (sample_rate / clock_rate * ((uint64_t) 1 << BLIP_FRACTION) + 0.5);
+    b->high_pass = 2 * PI * HIGH_PASS_HZ / sample_rate;     // 1 - e^-x is near enough x this far under the sample rate
+}
+
+void blipClear(struct blip * b) {
+    b->offset = 0;
+    b->integral = 0;
+    b->dc = 0;
+    memset(b->buffer, 0, sizeof(b->buffer));
+}
+
+void blipAddDelta(struct blip * b, uint32_t time, float delta) {
+    uint64_t position = b->offset + time * b->factor;
+    float * out = &b->buffer[position >> BLIP_FRACTION];
+    const float * taps = kernel[(position >> (BLIP_FRACTION - PHASE_BITS)) & (BLIP_PHASES - 1)];
+    for(int i = 0; i < BLIP_WIDTH; i++) {
+        out[i] += taps[i] * delta;
+    }
+}
+
+// Everything before clocks is final now, nothing added later can reach back that far
+void blipEndFrame(struct blip * b, uint32_t clocks) {
+    b->offset += clocks * b->factor;
+}
+
+int blipSamplesAvail(const struct blip * b) {
+    return b->offset >> BLIP_FRACTION;
+}
+
+// The longest frame that still only makes this many more samples
+uint32_t blipClocksFor(const struct blip * b, int samples) {
+    uint64_t room = ((uint64_t) samples << BLIP_FRACTION) - (b->offset & (((uint64_t) 1 << BLIP_FRACTION) - 1));
+    return room / b->factor;
+}
+
+static void removeSamples(struct blip * b, int count) {
+    int left = blipSamplesAvail(b) - count + BLIP_WIDTH;
+    memmove(b->buffer, b->buffer + count, left * sizeof(float));
+    memset(b->buffer + left, 0, count * sizeof(float));
+    b->offset -= (uint64_t) count << BLIP_FRACTION;
+}
+
+int blipReadSamples(struct blip * b, int16_t * out, int count) {
+    int avail = blipSamplesAvail(b);
+    count = count < avail ? count : avail;
+    float integral = b->integral;
+    float dc = b->dc;
+    for(int i = 0; i < count; i++) {
+        integral += b->buffer[i];
+        float sample = integral - dc;
+        dc += sample * b->high_pass;
+        sample = sample > 32767 ? 32767 : sample < -32768 ? -32768 : sample;
+        out[i] = sample < 0 ? sample - 0.5f : sample + 0.5f;
+    }
+    b->integral = integral;
+    b->dc = dc;
+    removeSamples(b, count);
+    return count;
+}
+
+// Throws samples away unread, still going through them so the level carries on from the right place
+void blipDiscard(struct blip * b, int count) {
+    int avail = blipSamplesAvail(b);
+    count = count < avail ? count : avail;
+    for(int i = 0; i < count; i++) {
+        b->integral += b->buffer[i];
+        b->dc += (b->integral - b->dc) * b->high_pass;
+    }
+    removeSamples(b, count);
+}
@@ -0,0 +1,43 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <inttypes.h>
+
+/*
+    Band-limited steps
+
+    The APU's channels only ever jump from one level to another, so instead of running them at the CPU
+    clock and filtering that down, every jump goes in here as a delta at the CPU cycle it happened on.
+    Each one gets spread over a few output samples as a windowed sinc step, which is already band
+    limited, so nothing aliases however high the channel's frequency, and output samples only cost
+    anything where something changed. Reading integrates the deltas back up into samples.
+
+    Time is in input clocks from the start of the current frame. blipEndFrame() says how long the frame
+    was, after which every sample up to there can be read.
+*/
+#define BLIP_SIZE 16384         // samples the buffer holds, read them before it fills
+#define BLIP_WIDTH 16           // samples each step is spread over
+#define BLIP_PHASES 32          // positions between two samples a step can start at
+#define BLIP_FRACTION 32        // fixed point bits in sample positions
+
+struct blip {
+    uint64_t factor;            // samples per input clock
+    uint64_t offset;            // where the current frame starts in buffer, in samples
+    double clock_rate;
+    double sample_rate;
+    float integral;             // sum of every delta read so far, the output level before the high-pass
+    float dc;                   // what the high-pass takes back out
+    float high_pass;
+    float buffer[BLIP_SIZE + BLIP_WIDTH];
+};
+
+void blipSetRates(struct blip * b, double clock_rate, double sample_rate);
+void blipClear(struct blip * b);
+void blipAddDelta(struct blip * b, uint32_t time, float delta);
+void blipEndFrame(struct blip * b, uint32_t clocks);
+int blipSamplesAvail(const struct blip * b);
+uint32_t blipClocksFor(const struct blip * b, int samples);
+int blipReadSamples(struct blip * b, int16_t * out, int count);
+void blipDiscard(struct blip * b, int count);
+
+#endif
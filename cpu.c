@@ -23,1253 +23,109 @@
     -> javidx9's YouTube NES Emulator from scratch series
 
 
-    + Finished all legal opcodes! Woo! (Not tested yet tho...)
-    + Finished a good majority of the stable illegal opcodes! (Also not tested...)
-
-    TODO:
-    - Finish up the writeRAM memory map so CPU testing can begin
-    - Need to start testing against nestest, which will require debug logs
-    ? Optimize/Refactor to speed things up if necessary
-    ? Experiment with different methods of dispatch: currently uses a switch, maybe try function/jump table or something wild like computed gotos + X-macros
+    + Finished all legal opcodes! Woo!
+    + Finished a good majority of the stable illegal opcodes!
+    + Dispatch is now generated from the opcode table in opcodes.h (switch, function table or computed goto)
+    + Every opcode is checked by test.c and by fuzz.c against a reference 6502, and nymph-headless -t
+      logs every instruction so tracetool can diff a run against nestest's golden log
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include "cpu.h"
 #include "mmu.h"
+#include "opcodes.h"
+#include "trace.h"
+#include "nes.h"
 
-struct nesCPU cpu;
+NYMPH_TLS struct nesCPU cpu;
+int idle_skipping = 1;
+NYMPH_TLS uint64_t idle_cycles;
+
+static void interruptEvent(uint64_t when);
 
 void resetCPU(struct nesCPU * cpu) {
     cpu->a = 0;
     cpu->x = 0;
     cpu->y = 0;
-    uint8_t high = readRAM(0xffd);
-    uint8_t low = readRAM(0xffc);
+    uint8_t high = readRAM(0xfffd);
+    uint8_t low = readRAM(0xfffc);
     cpu->pc = (high << 8) | low;     // start pc at reset vector
     cpu->sp = 0xfd;                  // start sp here b/c of nestest
-    cpu->status = 0x24;              // set unused and irq disable to true
+    setStatus(cpu, 0x24);            // set unused and irq disable to true
+    cpu->cycles = 7;                 // the reset sequence takes 7 cycles before the first opcode
+    cpu->run_until = 0;
+    cpu->nmi_line = 0;
+    cpu->nmi_pending = 0;
+    cpu->irq_lines = 0;
+    cpu->polled_mask = IRQ_MASK;
+    cpu->mask_changed = 0;
+    cpu->jammed = 0;
+    setEventHandler(EVENT_INTERRUPT, interruptEvent);
+    flushBlocks();                   // whatever was decoded before belongs to the last game
+}
+
+// Pushes pc and P and jumps through the vector, the same for BRK, NMI and IRQ
+static void interrupt(struct nesCPU * cpu, uint16_t pc, uint8_t status, uint16_t vector) {
+    pushStack(cpu, pc >> 8);
+    pushStack(cpu, pc & 0xff);
+    pushStack(cpu, status);
+    cpu->flags |= IRQ_MASK;
+    uint8_t low = readRAM(vector);
+    uint8_t high = readRAM(vector + 1);
+    cpu->pc = (high << 8) | low;
 }
 
-int interpret(struct nesCPU * cpu) {
-    int cycles = 0;
-    // get next instruction
-    // decode instruction
-    // execute instruction
-    // update pc and cycle count
-    // return cycles
-    uint8_t opcode = readRAM(cpu->pc);
-    switch(opcode) {
-        case 0x00:                                  // BRK
-            BRK(cpu);
-            cycles = 7;
-            printf("Opcode: BRK | cycles: %d | PC: %X | flags: %X\n", cycles, cpu->pc, cpu->status);
-            break;
-        case 0x01:                                  // ORA ind, X
-            ORA(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x02:
-            JAM();
-            break;
-        case 0x03:                                  // SLO ind, X
-            SLO(cpu, indirect_X_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0x04:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x05:                                   // ORA zpg
-            ORA(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x06:                                  // ASL zpg
-            ASL(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0x07:                                  // SLO zpg
-            SLO(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0x08:                                  // PHP impl
-            PHP(cpu);
-            cycles = 3;
-            cpu->pc += 1;
-            break;
-        case 0x09:                                  // ORA #
-            ORA(cpu, cpu->pc+1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0x0A:                                  // ASL A
-            ASL_A(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x0B:
-            // ANC #
-            break;
-        case 0x0C:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x0D:                                  // ORA abs
-            ORA(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x0E:                                  // ASL abs
-            ASL(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0x0F:                                  // SLO abs
-            SLO(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0x10:                                  // BPL Branch on Result Plus relative
-            cycles = BPL(cpu);
-            break;
-        case 0x11:                                  // ORA ind, Y
-            ORA(cpu, indirect_Y_index(cpu));
-            cycles = (pageBoundaryCross()) ? 6 : 5;
-            cpu->pc += 2;
-            break;
-        case 0x12:
-            JAM();
-            break;
-        case 0x13:                                  // SLO ind, Y
-            SLO(cpu, indirect_Y_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0x14:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x15:                                  // ORA zpg, X
-            ORA(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x16:                                  // ASL zpg, X
-            ASL(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x17:                                  // SLO zpg, X
-            SLO(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x18:                                  // CLC clear carry flag
-            CLC(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x19:                                  // ORA abs, Y
-            ORA(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5: 4;
-            cpu->pc += 3;
-            break;
-        case 0x1A:                                  // NOP implied
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x1B:                                  // SLO abs, Y
-            SLO(cpu, absolute_Y(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x1C:                                  // NOP
-            NOP(absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x1D:                                  // ORA abs, X
-            ORA(cpu, absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x1E:                                  // ASL abs, X
-            ASL(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x1F:                                  // SLO abs, X
-            SLO(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x20:
-            break;
-        case 0x21:                                  // AND ind, X
-            AND(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x22:
-            JAM();
-            break;
-        case 0x23:                                  // RLA ind, X
-            RLA(cpu, indirect_X_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0x24:                                  // BIT zpg
-            BIT(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x25:                                  // AND zpg
-            AND(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x26:                                  // ROL zpg
-            ROL(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0x27:                                  // RLA zpg
-            RLA(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0x28:                                  // PLP Pull Processor status from stack
-            PLP(cpu);
-            cycles = 4;
-            cpu->pc += 1;
-            break;
-        case 0x29:                                  // AND imm
-            AND(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0x2A:                                  // ROL Accumulator
-            ROL_A(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x2B:
-            break;
-        case 0x2C:                                  // BIT abs
-            BIT(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x2D:                                  // AND abs
-            AND(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x2E:                                  // ROL abs
-            ROL(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0x2F:                                  // RLA abs
-            RLA(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0x30:                                  // BMI Branch if minus
-            cycles = BMI(cpu);
-            break;
-        case 0x31:                                  // AND ind, Y
-            AND(cpu, indirect_Y_index(cpu));
-            cycles = (pageBoundaryCross()) ? 6 : 5;
-            cpu->pc += 2;
-            break;
-        case 0x32:
-            JAM();
-            break;
-        case 0x33:                                  // RLA ind, Y
-            RLA(cpu, indirect_Y_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0x34:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x35:                                  // AND zpg, X
-            AND(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x36:                                  // ROL zpg, X
-            ROL(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x37:                                  // RLA zpg, X
-            RLA(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x38:                                  // SEC Set Carry Flag
-            SEC(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x39:                                  // AND abs, Y
-            AND(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x3A:                                  // NOP impl
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x3B:                                  // RLA abs, Y
-            RLA(cpu, absolute_Y(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x3C:                                  // NOP
-            NOP(absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x3D:                                  // AND abs, X
-            AND(cpu, absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x3E:                                  // ROL abs, X
-            ROL(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x3F:                                  // RLA abs, X
-            RLA(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x40:                                  // RTI Return from subroutine
-            RTI(cpu);
-            cycles = 6;
-            break;
-        case 0x41:                                  // EOR ind, X
-            EOR(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x42:
-            JAM();
-            break;
-        case 0x43:                                  // SRE ind, X
-            SRE(cpu, indirect_X_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0x44:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x45:                                  // EOR zpg
-            EOR(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x46:                                  // LSR zpg
-            LSR(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0x47:                                  // SRE zpg
-            SRE(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0x48:                                  // PHA Push accumulator onto stack
-            PHA(cpu);
-            cycles = 3;
-            cpu->pc += 1;
-            break;
-        case 0x49:                                  // EOR imm
-            EOR(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0x4A:                                  // LSR Accumulator
-            LSR_A(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x4B:
-            break;
-        case 0x4C:                                  // JMP abs
-            JMP_ABS(cpu, absolute(cpu));
-            cycles = 3;
-            break;
-        case 0x4D:                                  // EOR abs
-            EOR(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x4E:                                  // LSR abs
-            LSR(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0x4F:                                  // SRE abs
-            SRE(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0x50:                                  // BVC Branch if overflow clear
-            cycles = BVC(cpu);
-            break;
-        case 0x51:                                  // EOR ind, Y
-            EOR(cpu, indirect_Y_index(cpu));
-            cycles = (pageBoundaryCross()) ? 6 : 5;
-            cpu->pc += 2;
-            break;
-        case 0x52:
-            JAM();
-            break;
-        case 0x53:                                  // SRE ind, Y
-            SRE(cpu, indirect_Y_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0x54:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x55:                                  // EOR zpg, X
-            EOR(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x56:                                  // LSR zpg, X
-            LSR(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x57:                                  // SRE zpg, X
-            SRE(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x58:                                  // CLI clear interrupt disable
-            CLI(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x59:                                  // EOR abs, Y
-            EOR(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x5A:                                  // NOP impl
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x5B:                                  // SRE abs, Y
-            SRE(cpu, absolute_Y(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x5C:                                  // NOP
-            NOP(absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x5D:                                  // EOR abs, X
-            EOR(cpu, absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x5E:                                  // LSR abs, X
-            LSR(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x5F:                                  // SRE abs, X
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x60:                                  // RTS Return from Subroutine
-            RTS(cpu);
-            cycles = 6;
-            break;
-        case 0x61:                                  // ADC ind, X
-            ADC(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x62:
-            JAM();
-            break;
-        case 0x63:                                  // RRA ind, X
-            RRA(cpu, indirect_X_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0x64:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x65:                                  // ADC zpg
-            ADC(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x66:                                  // ROR zpg
-            ROR(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0x67:                                  // RRA zpg
-            RRA(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0x68:                                  // PLA Pull accumulator from stack
-            PLA(cpu);
-            cycles = 4;
-            cpu->pc += 1;
-            break;
-        case 0x69:                                  // ADC imm
-            ADC(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0x6A:                                  // ROR Accumulator
-            ROR_A(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x6B:
-            break;
-        case 0x6C:                                  // JMP ind
-            JMP_IND(cpu);
-            cycles = 5;
-            break;
-        case 0x6D:                                  // ADC abs
-            ADC(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x6E:                                  // ROR abs
-            ROR(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0x6F:                                  // RRA abs
-            RRA(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0x70:                                  // BVS Branch if overflow set
-            cycles = BVS(cpu);
-            break;
-        case 0x71:                                  // ADC ind, Y
-            ADC(cpu, indirect_Y_index(cpu));
-            cycles = (pageBoundaryCross()) ? 6 : 5;
-            cpu->pc += 2;
-            break;
-        case 0x72:
-            JAM();
-            break;
-        case 0x73:                                  // RRA ind, Y
-            RRA(cpu, indirect_Y_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0x74:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x75:                                  // ADC zpg, X
-            ADC(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x76:                                  // ROR zpg, X
-            ROR(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x77:                                  // RRA zpg, X
-            RRA(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x78:                                  // SEI Set Interrupt Disable
-            SEI(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x79:                                  // ADC abs, Y
-            ADC(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x7A:                                  // NOP impl
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x7B:                                  // RRA abs, Y
-            RRA(cpu, absolute_Y(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x7C:                                  // NOP
-            NOP(absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x7D:                                  // ADC abs, X
-            ADC(cpu, absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0x7E:                                  // ROR abs, X
-            ROR(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x7F:                                  // RRA abs, X
-            RRA(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0x80:                                  // NOP impl
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0x81:                                  // STA ind, X
-            STA(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x82:                                  // NOP imm
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0x83:                                  // SAX ind, X
-            SAX(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x84:                                  // STY zpg
-            STY(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x85:                                  // STA zpg
-            STA(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x86:                                  // STX spg
-            STX(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x87:                                  // SAX zpg
-            SAX(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0x88:                                  // DEY Decrement Y by one
-            DEY(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x89:                                  // NOP imm
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0x8A:                                  // TXA Transfer X to Accumulator
-            TXA(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x8B:
-            break;
-        case 0x8C:                                  // STY abs
-            STY(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x8D:                                  // STA abs
-            STA(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x8E:                                  // STX abs
-            STX(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x8F:                                  // SAX abs
-            SAX(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0x90:                                  // BCC Branch if Carry clear
-            cycles = BCC(cpu);
-            break;
-        case 0x91:                                  // STA ind, Y
-            STA(cpu, indirect_Y_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0x92:
-            JAM();
-            break;
-        case 0x93:
-            break;
-        case 0x94:                                  // STY zpg, X
-            STY(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x95:                                  // STA zpg, X
-            STA(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x96:                                  // STX zpg, Y
-            STX(cpu, zero_page_Y(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x97:                                  // SAX zpg, Y
-            SAX(cpu, zero_page_Y(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0x98:                                  // TYA Transfer Y to Accumulator
-            TYA(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x99:                                  // STA abs, Y
-            STA(cpu, absolute_Y(cpu));
-            cycles = 5;
-            cpu->pc += 3;
-            break;
-        case 0x9A:                                  // TXS Transfer X to Stack Pointer
-            TXS(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0x9B:
-            break;
-        case 0x9C:
-            break;
-        case 0x9D:                                  // STA abs, X
-            STA(cpu, absolute_X(cpu));
-            cycles = 5;
-            cpu->pc += 3;
-            break;
-        case 0x9E:
-            break;
-        case 0x9F:
-            break;
-        case 0xA0:                                  // LDY imm
-            LDY(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xA1:                                  // LDA X, ind
-            LDA(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0xA2:                                  // LDX imm
-            LDX(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xA3:                                  // LAX ind, X
-            LAX(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0xA4:                                  // LDY zpg
-            LDY(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0xA5:                                  // LDA zpg
-            LDA(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0xA6:                                  // LDX zpg
-            LDX(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0xA7:                                  // LAX zpg
-            LAX(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0xA8:                                  // TAY Transfer Accumulator to Y
-            TAY(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xA9:                                  // LDA $xx Immediate
-            LDA(cpu, cpu->pc+1);
-            cycles = 2;
-            cpu->pc += 2;
-            printf("Opcode: LDA | cycles: %d | PC: %X | flags: %X\n", cycles, cpu->pc, cpu->status);
-            break;
-        case 0xAA:                                  // TAX Transfer Accumlator to Index X
-            TAX(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            printf("Opcode: TAX | cycles: %d | PC: %X | flags: %X\n", cycles, cpu->pc, cpu->status);
-            break;
-        case 0xAB:
-            break;
-        case 0xAC:                                  // LDY abs
-            LDY(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0xAD:                                  // LDA abs
-            LDA(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0xAE:                                  // LDX abs
-            LDX (cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0xAF:                                  // LAX abs
-            LAX(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0xB0:                                  // BCS Branch if Carry Set
-            cycles = BCS(cpu);
-            break;
-        case 0xB1:                                  // LDA ind, Y
-            LDA(cpu, indirect_Y_index(cpu));
-            cycles = (pageBoundaryCross()) ? 6 : 5;
-            cpu->pc += 2;
-            break;
-        case 0xB2:
-            JAM();
-            break;
-        case 0xB3:                                  // LAX ind, Y
-            LAX(cpu, indirect_Y_index(cpu));
-            cycles = (pageBoundaryCross()) ? 6 : 5;
-            cpu->pc += 2;
-            break;
-        case 0xB4:                                  // LDY zpg, X
-            LDY(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xB5:                                  // LDA zpg, X
-            LDA(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xB6:                                  // LDX zpg, Y
-            LDX(cpu, zero_page_Y(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xB7:                                  // LAX zpg, Y
-            LAX(cpu, zero_page_Y(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xB8:                                  // CLV Clear Overflow flag
-            CLV(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xB9:                                  // LDA abs, Y
-            LDA(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xBA:                                  // TSX Transfer Stack Pointer to X
-            TSX(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xBB:                                  // LAS abs, Y
-            LAS(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xBC:                                  // LDY abs, X
-            LDY(cpu, absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xBD:                                  // LDA abs, X
-            LDA(cpu, absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xBE:                                  // LDX abs, Y
-            LDX(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xBF:                                  // LAX abs, Y
-            LAX(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xC0:                                  // CPY imm
-            CPY(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xC1:                                  // CMP ind, X
-            CMP(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0xC2:                                  // NOP imm
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xC3:                                  // DCP ind, X
-            DCP(cpu, indirect_X_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0xC4:                                  // CPY zpg
-            CPY(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0xC5:                                  // CMP zpg
-            CMP(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0xC6:                                  // DEC zpg
-            DEC(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0xC7:                                  // DCP zpg
-            DCP(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0xC8:                                  // INY Increment Y
-            INY(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xC9:                                  // CMP imm
-            CMP(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xCA:                                  // DEX Decrement X by One
-            DEX(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xCB:                                  // SBX imm
-            SBX(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xCC:                                  // CPY abs
-            CPY(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0xCD:                                  // CMP abs
-            CMP(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0xCE:                                  // DEC abs
-            DEC(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0xCF:                                  // DCP abs
-            DCP(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0xD0:                                  // BNE Branch if not equal
-            cycles = BNE(cpu);
-            break;
-        case 0xD1:                                  // CMP ind, Y
-            CMP(cpu, indirect_Y_index(cpu));
-            cycles = (pageBoundaryCross()) ? 6 : 5;
-            cpu->pc += 2;
-            break;
-        case 0xD2:
-            JAM();
-            break;
-        case 0xD3:                                  // DCP ind, Y
-            DCP(cpu, indirect_Y_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0xD4:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xD5:                                  // CMP zpg, X
-            CMP(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xD6:                                  // DEC zpg, X
-            DEC(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0xD7:                                  // DCP zpg, X
-            DCP(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0xD8:                                  // CLD clear decimal mode
-            CLD(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xD9:                                  // CMP abs, Y
-            CMP(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xDA:                                  // NOP impl
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xDB:                                  // DCP abs, Y
-            DCP(cpu, absolute_Y(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0xDC:                                  // NOP
-            NOP(absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xDD:                                  // CMP abs, X
-            CMP(cpu, absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xDE:                                  // DEC abs, X
-            DEC(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0xDF:                                  // DCP abs, X
-            DCP(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0xE0:                                  // CPX imm
-            CPX(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xE1:                                  // SBC ind, X
-            SBC(cpu, indirect_X_index(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0xE2:                                  // NOP imm
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xE3:                                  // ISC ind, X
-            ISC(cpu, indirect_X_index(cpu));
-            cycles = 8;
-            cpu->pc += 2;
-            break;
-        case 0xE4:                                  // CPX zpg
-            CPX(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0xE5:                                  // SBC zpg
-            SBC(cpu, zero_page(cpu));
-            cycles = 3;
-            cpu->pc += 2;
-            break;
-        case 0xE6:                                  // INC zpg
-            INC(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0xE7:                                  // ISC zpg
-            ISC(cpu, zero_page(cpu));
-            cycles = 5;
-            cpu->pc += 2;
-            break;
-        case 0xE8:                                  // INX Increment X
-            INX(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            printf("Opcode: INX | cycles: %d | PC: %X | flags: %X\n", cycles, cpu->pc, cpu->status);
-            break;
-        case 0xE9:                                  // SBC imm
-            SBC(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 2;
-            break;
-        case 0xEA:                                  // NOP No Operation
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xEB:                                  // USBC imm
-            USBC(cpu, cpu->pc + 1);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xEC:                                  // CPX abs
-            CPX(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0xED:                                  // SBC abs
-            SBC(cpu, absolute(cpu));
-            cycles = 4;
-            cpu->pc += 3;
-            break;
-        case 0xEE:                                  // INC abs
-            INC(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0xEF:                                  // ISC abs
-            ISC(cpu, absolute(cpu));
-            cycles = 6;
-            cpu->pc += 3;
-            break;
-        case 0xF0:                                  // BEQ Branch if equal
-            cycles = BEQ(cpu);
-            break;
-        case 0xF1:                                  // SBC ind, Y
-            SBC(cpu, indirect_Y_index(cpu));
-            cycles = (pageBoundaryCross()) ? 6 : 5;
-            cpu->pc += 2;
-            break;
-        case 0xF2:
-            JAM();
-            break;
-        case 0xF3:                                  // ISC ind, Y
-            ISC(cpu, indirect_Y_index(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xF4:                                  // NOP
-            NOP(cpu->pc);
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xF5:                                  // SBC zpg, X
-            SBC(cpu, zero_page_X(cpu));
-            cycles = 4;
-            cpu->pc += 2;
-            break;
-        case 0xF6:                                  // INC zpg, X
-            INC(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0xF7:                                  // ISC zpg, X
-            ISC(cpu, zero_page_X(cpu));
-            cycles = 6;
-            cpu->pc += 2;
-            break;
-        case 0xF8:                                  // SED Set Decimal Flag
-            SED(cpu);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xF9:                                  // SBC abs, Y
-            SBC(cpu, absolute_Y(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xFA:                                  // NOP impl
-            NOP(cpu->pc);
-            cycles = 2;
-            cpu->pc += 1;
-            break;
-        case 0xFB:                                  // ISC abs, Y
-            ISC(cpu, absolute_Y(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0xFC:
-            NOP(absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xFD:                                  // SBC abs, X
-            SBC(cpu, absolute_X(cpu));
-            cycles = (pageBoundaryCross()) ? 5 : 4;
-            cpu->pc += 3;
-            break;
-        case 0xFE:                                  // INC abs, X
-            INC(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        case 0xFF:                                  // ISC abs, X
-            ISC(cpu, absolute_X(cpu));
-            cycles = 7;
-            cpu->pc += 3;
-            break;
-        default:
-            printf("Unknown opcode!\n");
-            cpu->pc += 1;
-            break;
+static int irqMasked(const struct nesCPU * cpu) {
+    if(cpu->cycles == cpu->mask_changed) {
+        return cpu->polled_mask;    // the last instruction was CLI, SEI or PLP and the poll happened before it
+    }
+    return cpu->flags & IRQ_MASK;
+}
+
+// At an instruction boundary, NMI wins if both are waiting and the IRQ gets its turn once I is clear again
+static void interruptEvent(uint64_t when) {
+    if(cpu.jammed) {
+        return;
+    } else if(cpu.nmi_pending) {
+        cpu.nmi_pending = 0;
+        interrupt(&cpu, cpu.pc, (getStatus(&cpu) & ~BRK_MASK) | UNUSED_MASK, 0xfffa);
+        cpu.cycles += 7;
+    } else if(cpu.irq_lines && !irqMasked(&cpu)) {
+        interrupt(&cpu, cpu.pc, (getStatus(&cpu) & ~BRK_MASK) | UNUSED_MASK, 0xfffe);
+        cpu.cycles += 7;
+    }
+}
+
+void setNMI(struct nesCPU * cpu, int level) {
+    if(level && !cpu->nmi_line) {
+        cpu->nmi_pending = 1;
+        scheduleEvent(EVENT_INTERRUPT, cpu->cycles);
+    }
+    cpu->nmi_line = level != 0;
+}
+
+void setIRQ(struct nesCPU * cpu, uint8_t source) {
+    cpu->irq_lines |= source;
+    if(!irqMasked(cpu)) {
+        scheduleEvent(EVENT_INTERRUPT, cpu->cycles);
+    }
+}
+
+// A source dropping its line after the IRQ was scheduled is fine, the handler looks again before taking it
+void clearIRQ(struct nesCPU * cpu, uint8_t source) {
+    cpu->irq_lines &= ~source;
+}
+
+// After CLI, SEI and PLP, I has changed but the next poll still sees the old one
+static void maskChanged(struct nesCPU * cpu, uint8_t old) {
+    cpu->polled_mask = old;
+    cpu->mask_changed = cpu->cycles;
+    if(!(cpu->flags & IRQ_MASK) && cpu->irq_lines) {
+        scheduleEvent(EVENT_INTERRUPT, cpu->cycles + 1);     // after the next instruction
     }
-    return cycles;
 }
 
 void pushStack(struct nesCPU * cpu, uint8_t value) {
@@ -1284,460 +140,452 @@ uint8_t popStack(struct nesCPU * cpu) {
     return readRAM((0x100 + cpu->sp) & 0x1ff);   // to prevent overflow?
 }
 
-void updateFlag(struct nesCPU * cpu, uint8_t condition, uint8_t mask) {
-    if(condition) {
-        cpu->status |= mask;
-    } else {
-        cpu->status &= ~mask;
-    }
-}
-
-void updateNegZero(struct nesCPU * cpu, uint8_t value) {
-    updateFlag(cpu, value >> 7, NEGATIVE_MASK);
-    updateFlag(cpu, value == 0, ZERO_MASK);
+// N and Z both come from the same result almost everywhere, so that's two plain stores
+static inline void updateNegZero(struct nesCPU * cpu, uint8_t value) {
+    cpu->n = value;
+    cpu->z = value;
 }
 
-void ADD(struct nesCPU * cpu, uint8_t value) {
-    uint16_t sum = cpu->a + value + (cpu->status & CARRY_MASK);
+static ALWAYS_INLINE void ADD(struct nesCPU * cpu, uint8_t value) {
+    uint16_t sum = cpu->a + value + cpu->c;
     uint8_t old_a = cpu->a;
     cpu->a = (uint8_t) sum;
-    updateFlag(cpu, (~(old_a ^ value) & (old_a ^ cpu->a) & 0x80), OVERFLOW_MASK);
-    updateFlag(cpu, sum > 0xff, CARRY_MASK);
+    cpu->v = (~(old_a ^ value) & (old_a ^ cpu->a)) >> 7;
+    cpu->c = sum >> 8;
     updateNegZero(cpu, cpu->a);
 }
 
-void ADC(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void ADC(struct nesCPU * cpu, uint16_t addr) {
     ADD(cpu, readRAM(addr));
 }
 
-void AND(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void AND(struct nesCPU * cpu, uint16_t addr) {
     cpu->a &= readRAM(addr);
     updateNegZero(cpu, cpu->a);
 }
 
-void ASL_A(struct nesCPU * cpu) {
-    updateFlag(cpu, cpu->a >> 7, CARRY_MASK);
+static ALWAYS_INLINE void ASL_A(struct nesCPU * cpu) {
+    cpu->c = cpu->a >> 7;
     cpu->a = cpu->a << 1;
     updateNegZero(cpu, cpu->a);
 }
 
-void ASL(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void ASL(struct nesCPU * cpu, uint16_t addr) {
     uint8_t shift = readRAM(addr);
-    updateFlag(cpu, shift >> 7, CARRY_MASK);
+    cpu->c = shift >> 7;
     shift = shift << 1;
     updateNegZero(cpu, shift);
     writeRAM(addr, shift);
 }
 
-int BCC(struct nesCPU * cpu) {
-    int cycles = 2;
-    uint16_t rel_addr = 2 + readRAM(cpu->pc + 1) + cpu->pc;
-    if(!(cpu->status & CARRY_MASK)) {
-        ++cycles;
-        if((rel_addr & 0xff00) != (cpu->pc & 0xff00)) {
-            ++cycles;
-        }
-        cpu->pc = rel_addr;
-    }
-    return cycles;
-}
-
-int BCS(struct nesCPU * cpu) {
-    int cycles = 2;
-    uint16_t rel_addr = 2 + readRAM(cpu->pc + 1) + cpu->pc;
-    if(cpu->status & CARRY_MASK) {
-        ++cycles;
-        if((rel_addr & 0xff00) != (cpu->pc & 0xff00)) {
-            ++cycles;
-        }
-        cpu->pc = rel_addr;
+/*
+    Branches
+    The branch opcodes are xxy10000: xx picks the flag and y is the value it needs for the branch to go.
+    EXECUTE() hands over the opcode as a constant, so once this is inlined the table lookup folds down
+    to a test of the one flag. Returns the extra cycles: +1 if taken, +1 more if the target is on
+    another page.
+*/
+#if NYMPH_BRANCH_PROFILE
+static struct branch_stats branch_stats[0x10000];
+
+#define PROFILE_BRANCH(pc, taken, crossed) do {             \
+    struct branch_stats * stats = &branch_stats[(uint16_t) (pc)];   \
+    stats->taken += (taken);                                \
+    stats->not_taken += !(taken);                           \
+    stats->crossed += (taken) & (crossed);                  \
+} while(0)
+#else
+#define PROFILE_BRANCH(pc, taken, crossed) do { } while(0)
+#endif
+
+static inline int BRANCH(struct nesCPU * cpu, uint16_t target, uint8_t opcode) {
+    int flag;
+    switch(opcode >> 6) {
+        case 0:  flag = cpu->n >> 7; break;
+        case 1:  flag = cpu->v; break;
+        case 2:  flag = cpu->c; break;
+        default: flag = cpu->z == 0; break;
     }
-    return cycles;
-}
-
-int BEQ(struct nesCPU * cpu) {
-    int cycles = 2;
-    uint16_t rel_addr = 2 + readRAM(cpu->pc + 1) + cpu->pc;
-    if(cpu->status & ZERO_MASK) {
-        ++cycles;
-        if((rel_addr & 0xff00) != (cpu->pc & 0xff00)) {
-            ++cycles;
-        }
-        cpu->pc = rel_addr;
+    int taken = flag == ((opcode >> 5) & 1);
+    int crossed = (target & 0xff00) != (cpu->pc & 0xff00);
+    PROFILE_BRANCH(cpu->pc - 2, taken, crossed);
+    if(!taken) {
+        return 0;
     }
-    return cycles;
+    cpu->pc = target;
+    return 1 + crossed;
 }
 
-void BIT(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void BIT(struct nesCPU * cpu, uint16_t addr) {
     uint8_t bit_test = readRAM(addr);
-    updateFlag(cpu, bit_test & OVERFLOW_MASK, OVERFLOW_MASK);
-    updateFlag(cpu, bit_test & NEGATIVE_MASK, NEGATIVE_MASK);
-    updateFlag(cpu, (bit_test & cpu->a) == 0, ZERO_MASK);
-}
-
-int BMI(struct nesCPU * cpu) {
-    int cycles = 2;
-    uint16_t rel_addr = 2 + readRAM(cpu->pc + 1) + cpu->pc;
-    if(cpu->status & NEGATIVE_MASK) {
-        ++cycles;
-        if((rel_addr & 0xff00) != (cpu->pc & 0xff00)) {
-            ++cycles;
-        }
-        cpu->pc = rel_addr;
-    }
-    return cycles;
-}
-
-int BNE(struct nesCPU * cpu) {
-    int cycles = 2;
-    uint16_t rel_addr = 2 + readRAM(cpu->pc + 1) + cpu->pc;
-    if(!(cpu->status & ZERO_MASK)) {
-        ++cycles;
-        if((rel_addr & 0xff00) != (cpu->pc & 0xff00)) {
-            ++cycles;
-        }
-        cpu->pc = rel_addr;
-    }
-    return cycles;
-}
-
-int BPL(struct nesCPU * cpu) {
-    int cycles = 2;
-    uint16_t rel_addr = 2 + readRAM(cpu->pc + 1) + cpu->pc;
-    if(!(cpu->status & NEGATIVE_MASK)) {
-        ++cycles;
-        if((rel_addr & 0xff00) != (cpu->pc & 0xff00)) {
-            ++cycles;
-        }
-        cpu->pc = rel_addr;
-    }
-    return cycles;
-}
-
-void BRK(struct nesCPU * cpu) {
-    pushStack(cpu, (uint8_t) (((cpu->pc + 2) & 0xff00) >> 8));    // need to handle 16 bit push
-    pushStack(cpu, (uint8_t) ((cpu->pc + 2) & 0xff));
-    pushStack(cpu, cpu->status | 0x30);       // push brk and unused flags set for some reason
-    uint8_t low = readRAM(0xFFFE);      // need to handle irq vectors
-    uint8_t high = readRAM(0xFFFF);
-    cpu->pc = (high << 8) | low;        
-    cpu->status |= BRK_MASK;               // however only brk flag is set globally
+    cpu->v = (bit_test >> 6) & 1;
+    cpu->n = bit_test;
+    cpu->z = bit_test & cpu->a;
 }
 
-int BVC(struct nesCPU * cpu) {
-    int cycles = 2;
-    uint16_t rel_addr = 2 + readRAM(cpu->pc + 1) + cpu->pc;
-    if(!(cpu->status & OVERFLOW_MASK)) {
-        ++cycles;
-        if((rel_addr & 0xff00) != (cpu->pc & 0xff00)) {
-            ++cycles;
-        }
-        cpu->pc = rel_addr;
-    }
-    return cycles;
+static ALWAYS_INLINE void BRK(struct nesCPU * cpu) {
+    // pc already points past the opcode, brk skips the padding byte after it
+    interrupt(cpu, cpu->pc + 1, getStatus(cpu) | BRK_MASK | UNUSED_MASK, 0xfffe);
 }
 
-int BVS(struct nesCPU * cpu) {
-    int cycles = 2;
-    uint16_t rel_addr = 2 + readRAM(cpu->pc + 1) + cpu->pc;
-    if(cpu->status & OVERFLOW_MASK) {
-        ++cycles;
-        if((rel_addr & 0xff00) != (cpu->pc & 0xff00)) {
-            ++cycles;
-        }
-        cpu->pc = rel_addr;
-    }
-    return cycles;
+static ALWAYS_INLINE void CLC(struct nesCPU * cpu) {
+    cpu->c = 0;
 }
 
-void CLC(struct nesCPU * cpu) {
-    cpu->status &= ~CARRY_MASK;
+static ALWAYS_INLINE void CLD(struct nesCPU * cpu) {
+    cpu->flags &= ~DECIMAL_MASK;
 }
 
-void CLD(struct nesCPU * cpu) {
-    cpu->status &= ~DECIMAL_MASK;
+static ALWAYS_INLINE void CLI(struct nesCPU * cpu) {
+    uint8_t old = cpu->flags & IRQ_MASK;
+    cpu->flags &= ~IRQ_MASK;
+    maskChanged(cpu, old);
 }
 
-void CLI(struct nesCPU * cpu) {
-    cpu->status &= ~IRQ_MASK;
+static ALWAYS_INLINE void CLV(struct nesCPU * cpu) {
+    cpu->v = 0;
 }
 
-void CLV(struct nesCPU * cpu) {
-    cpu->status &= ~OVERFLOW_MASK;
-}
-
-void CMP(struct nesCPU * cpu, uint16_t addr) {
-    uint8_t compare = cpu->a - readRAM(addr);
-    updateFlag(cpu, compare >= 0, CARRY_MASK);
+static ALWAYS_INLINE void CMP(struct nesCPU * cpu, uint16_t addr) {
+    uint8_t value = readRAM(addr);
+    uint8_t compare = cpu->a - value;
+    cpu->c = cpu->a >= value;
     updateNegZero(cpu, compare);
 }
 
-void CPX(struct nesCPU * cpu, uint16_t addr) {
-    uint8_t compare = cpu->x - readRAM(addr);
-    updateFlag(cpu, compare >= 0, CARRY_MASK);
+static ALWAYS_INLINE void CPX(struct nesCPU * cpu, uint16_t addr) {
+    uint8_t value = readRAM(addr);
+    uint8_t compare = cpu->x - value;
+    cpu->c = cpu->x >= value;
     updateNegZero(cpu, compare);
 }
 
-void CPY(struct nesCPU * cpu, uint16_t addr) {
-    uint8_t compare = cpu->y - readRAM(addr);
-    updateFlag(cpu, compare >= 0, CARRY_MASK);
+static ALWAYS_INLINE void CPY(struct nesCPU * cpu, uint16_t addr) {
+    uint8_t value = readRAM(addr);
+    uint8_t compare = cpu->y - value;
+    cpu->c = cpu->y >= value;
     updateNegZero(cpu, compare);
 }
 
-void DEC(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void DEC(struct nesCPU * cpu, uint16_t addr) {
     uint8_t decrement = readRAM(addr);
     decrement -= 1;
     writeRAM(addr, decrement);
     updateNegZero(cpu, decrement);
 }
 
-void DEX(struct nesCPU * cpu) {
+static ALWAYS_INLINE void DEX(struct nesCPU * cpu) {
     cpu->x -= 1;
     updateNegZero(cpu, cpu->x);
 }
 
-void DEY(struct nesCPU * cpu) {
+static ALWAYS_INLINE void DEY(struct nesCPU * cpu) {
     cpu->y -= 1;
     updateNegZero(cpu, cpu->y);
 }
 
-void EOR(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void EOR(struct nesCPU * cpu, uint16_t addr) {
     cpu->a ^= readRAM(addr);
     updateNegZero(cpu, cpu->a);
 }
 
-void INC(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void INC(struct nesCPU * cpu, uint16_t addr) {
     uint8_t newVal = readRAM(addr) + 1;
     writeRAM(addr, newVal);
     updateNegZero(cpu, newVal);
 }
 
-void INX(struct nesCPU * cpu) {
+static ALWAYS_INLINE void INX(struct nesCPU * cpu) {
     cpu->x += 1;
     updateNegZero(cpu, cpu->x);
 }
 
-void INY(struct nesCPU * cpu) {
+static ALWAYS_INLINE void INY(struct nesCPU * cpu) {
     cpu->y += 1;
     updateNegZero(cpu, cpu->y);
 }
 
-void JMP_IND(struct nesCPU * cpu) {
-    uint16_t ind_addr = (readRAM(cpu->pc + 2) << 8) | readRAM(cpu->pc + 1);
-    uint8_t lsb = readRAM(ind_addr);
-    uint8_t msb = readRAM(ind_addr + 1);
-    if(ind_addr & 0x00ff == 0x00ff) {       // For indirect jmp bug on page boundary
-        msb = readRAM(ind_addr & 0xff00);
-    }
-    cpu->pc = (msb << 8) | lsb;
-}
-
-void JMP_ABS(struct nesCPU * cpu, uint16_t addr) {
+// abs and ind both land here, the indirect page wrap bug is handled by indirect() in mmu.c
+static ALWAYS_INLINE void JMP(struct nesCPU * cpu, uint16_t addr) {
     cpu->pc = addr;
 }
 
-void JSR(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void JSR(struct nesCPU * cpu, uint16_t addr) {
     pushStack(cpu, (uint8_t) (((cpu->pc - 1) & 0xff00) >> 8));      // need to handle little endian 16 bit stack push
     pushStack(cpu, (uint8_t) ((cpu->pc - 1) & 0xff));
 
     cpu->pc = addr;
 }
 
-void LDA(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void LDA(struct nesCPU * cpu, uint16_t addr) {
     cpu->a = readRAM(addr);
     updateNegZero(cpu, cpu->a);
 }
 
-void LDX(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void LDX(struct nesCPU * cpu, uint16_t addr) {
     cpu->x = readRAM(addr);
     updateNegZero(cpu, cpu->x);
 }
 
-void LDY(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void LDY(struct nesCPU * cpu, uint16_t addr) {
     cpu->y = readRAM(addr);
     updateNegZero(cpu, cpu->y);
 }
 
-void LSR_A(struct nesCPU * cpu) {
-    updateFlag(cpu, cpu->a & 0x1, CARRY_MASK);
+static ALWAYS_INLINE void LSR_A(struct nesCPU * cpu) {
+    cpu->c = cpu->a & 0x1;
     cpu->a = cpu->a >> 1;
     updateNegZero(cpu, cpu->a);
 }
 
-void LSR(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void LSR(struct nesCPU * cpu, uint16_t addr) {
     uint8_t shift = readRAM(addr);
-    updateFlag(cpu, shift & 0x1, CARRY_MASK);
+    cpu->c = shift & 0x1;
     shift = shift >> 1;
     updateNegZero(cpu, shift);
     writeRAM(addr, shift);
 }
 
-void NOP(uint16_t addr) {}
+static ALWAYS_INLINE void NOP(struct nesCPU * cpu) {}
+
+// Unofficial NOPs with an operand still do the read
+static ALWAYS_INLINE void IGN(struct nesCPU * cpu, uint16_t addr) {
+    readRAM(addr);
+}
 
-void ORA(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void ORA(struct nesCPU * cpu, uint16_t addr) {
     cpu->a |= readRAM(addr);
     updateNegZero(cpu, cpu->a);
 }
 
-void PHA(struct nesCPU * cpu) {
+static ALWAYS_INLINE void PHA(struct nesCPU * cpu) {
     pushStack(cpu, cpu->a);
 }
 
-void PHP(struct nesCPU * cpu) {
-    pushStack(cpu, cpu->status | 0x30);
+static ALWAYS_INLINE void PHP(struct nesCPU * cpu) {
+    pushStack(cpu, getStatus(cpu) | 0x30);
 }
 
-void PLA(struct nesCPU * cpu) {
+static ALWAYS_INLINE void PLA(struct nesCPU * cpu) {
     cpu->a = popStack(cpu);
     updateNegZero(cpu, cpu->a);
 }
 
-void PLP(struct nesCPU * cpu) {
-    cpu->status = popStack(cpu);
+static ALWAYS_INLINE void PLP(struct nesCPU * cpu) {
+    uint8_t old = cpu->flags & IRQ_MASK;
+    setStatus(cpu, (popStack(cpu) & ~BRK_MASK) | UNUSED_MASK);     // there's nowhere to keep B, and U always reads 1
+    maskChanged(cpu, old);
 }
 
-void ROL_A(struct nesCPU * cpu) {
-    uint8_t old_carry = cpu->status & CARRY_MASK;
-    updateFlag(cpu, cpu->a >> 7, CARRY_MASK);
+static ALWAYS_INLINE void ROL_A(struct nesCPU * cpu) {
+    uint8_t old_carry = cpu->c;
+    cpu->c = cpu->a >> 7;
     cpu->a = cpu->a << 1;
     cpu->a |= old_carry;
     updateNegZero(cpu, cpu->a);
 }
 
-void ROL(struct nesCPU * cpu, uint16_t addr) {
-    uint8_t old_carry = cpu->status & CARRY_MASK;
+static ALWAYS_INLINE void ROL(struct nesCPU * cpu, uint16_t addr) {
+    uint8_t old_carry = cpu->c;
     uint8_t rotate = readRAM(addr);
-    updateFlag(cpu, rotate >> 7, CARRY_MASK);
+    cpu->c = rotate >> 7;
     rotate = rotate << 1;
     rotate |= old_carry;
     writeRAM(addr, rotate);
     updateNegZero(cpu, rotate);
 }
 
-void ROR_A(struct nesCPU * cpu) {
-    updateFlag(cpu, cpu->status & CARRY_MASK, NEGATIVE_MASK);
-    uint8_t old_carry = (cpu->status & CARRY_MASK) << 7;
-    updateFlag(cpu, cpu->a & 0x1, CARRY_MASK);
+static ALWAYS_INLINE void ROR_A(struct nesCPU * cpu) {
+    uint8_t old_carry = cpu->c << 7;
+    cpu->c = cpu->a & 0x1;
     cpu->a = cpu->a >> 1;
     cpu->a |= old_carry;
-    updateFlag(cpu, cpu->a == 0, ZERO_MASK);
+    updateNegZero(cpu, cpu->a);
 }
 
-void ROR(struct nesCPU * cpu, uint16_t addr) {
-    updateFlag(cpu, cpu->status & CARRY_MASK, NEGATIVE_MASK);
-    uint8_t old_carry = (cpu->status & CARRY_MASK) << 7;
+static ALWAYS_INLINE void ROR(struct nesCPU * cpu, uint16_t addr) {
+    uint8_t old_carry = cpu->c << 7;
     uint8_t rotate = readRAM(addr);
-    updateFlag(cpu, rotate & 0x1, CARRY_MASK);
+    cpu->c = rotate & 0x1;
     rotate = rotate >> 1;
     rotate |= old_carry;
-    updateFlag(cpu, rotate == 0, ZERO_MASK);
+    updateNegZero(cpu, rotate);
     writeRAM(addr, rotate);
 }
 
-void RTI(struct nesCPU * cpu) {
-    cpu->status = popStack(cpu);
+static ALWAYS_INLINE void RTI(struct nesCPU * cpu) {
+    setStatus(cpu, (popStack(cpu) & ~BRK_MASK) | UNUSED_MASK);
     uint8_t low = popStack(cpu);
     uint8_t high = popStack(cpu);
     cpu->pc = (high << 8) | low;
+    if(!(cpu->flags & IRQ_MASK) && cpu->irq_lines) {
+        scheduleEvent(EVENT_INTERRUPT, cpu->cycles);    // no delay after RTI
+    }
 }
 
-void RTS(struct nesCPU * cpu) {
+static ALWAYS_INLINE void RTS(struct nesCPU * cpu) {
     uint8_t low = popStack(cpu);
     uint8_t high = popStack(cpu);
-    cpu->pc = (high << 8) | low;
+    cpu->pc = ((high << 8) | low) + 1;     // JSR pushes the address of its last byte
 }
 
-void SBC(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void SBC(struct nesCPU * cpu, uint16_t addr) {
     ADD(cpu, ~readRAM(addr));
 }
 
-void SEC(struct nesCPU * cpu) {
-    cpu->status |= CARRY_MASK;
+static ALWAYS_INLINE void SEC(struct nesCPU * cpu) {
+    cpu->c = 1;
 }
 
-void SED(struct nesCPU * cpu) {
-    cpu->status |= DECIMAL_MASK;
+static ALWAYS_INLINE void SED(struct nesCPU * cpu) {
+    cpu->flags |= DECIMAL_MASK;
 }
 
-void SEI(struct nesCPU * cpu) {
-    cpu->status |= IRQ_MASK;
+static ALWAYS_INLINE void SEI(struct nesCPU * cpu) {
+    uint8_t old = cpu->flags & IRQ_MASK;
+    cpu->flags |= IRQ_MASK;
+    maskChanged(cpu, old);
 }
 
-void STA(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void STA(struct nesCPU * cpu, uint16_t addr) {
     writeRAM(addr, cpu->a);
 }
 
-void STX(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void STX(struct nesCPU * cpu, uint16_t addr) {
     writeRAM(addr, cpu->x);
 }
 
-void STY(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void STY(struct nesCPU * cpu, uint16_t addr) {
     writeRAM(addr, cpu->y);
 }
 
-void TAX(struct nesCPU * cpu) {
+static ALWAYS_INLINE void TAX(struct nesCPU * cpu) {
     cpu->x = cpu->a;
     updateNegZero(cpu, cpu->x);
 }
 
-void TAY(struct nesCPU * cpu) {
+static ALWAYS_INLINE void TAY(struct nesCPU * cpu) {
     cpu->y = cpu->a;
     updateNegZero(cpu, cpu->y);
 }
 
-void TSX(struct nesCPU * cpu) {
+static ALWAYS_INLINE void TSX(struct nesCPU * cpu) {
     cpu->x = cpu->sp;
     updateNegZero(cpu, cpu->x);
 }
 
-void TXA(struct nesCPU * cpu) {
+static ALWAYS_INLINE void TXA(struct nesCPU * cpu) {
     cpu->a = cpu->x;
     updateNegZero(cpu, cpu->a);
 }
 
-void TXS(struct nesCPU * cpu) {
+static ALWAYS_INLINE void TXS(struct nesCPU * cpu) {
     cpu->sp = cpu->x;
 }
 
-void TYA(struct nesCPU * cpu) {
+static ALWAYS_INLINE void TYA(struct nesCPU * cpu) {
     cpu->a = cpu->y;
     updateNegZero(cpu, cpu->a);
 }
 
 /*
-    Illegal (but stable) Opcodes
+    Illegal Opcodes
+
+    The stable ones are combinations of two official instructions. The unstable ones (ANE, LXA and the
+    SH* stores) depend on analog effects that vary from chip to chip, they're done the way most NES
+    CPUs behave, with 0xEE for the magic constant ANE and LXA OR into A.
+*/
 
-    There are other opcodes that need to be implemented, but it seems lots of semi-functional NES emulators don't include any of the
-    illegal opcodes, let alone some of these missing ones
+// Stops fetching for good, only a reset gets it going again. pc stays on the JAM and the rest of the run is
+// spent stuck, so the PPU and everything else carry on while the host gets told through cpu->jammed
+static ALWAYS_INLINE void JAM(struct nesCPU * cpu) {
+    cpu->pc--;
+    cpu->jammed = 1;
+    if(cpu->cycles < cpu->run_until) {
+        cpu->cycles = cpu->run_until;
+    }
+}
 
-    For the forseeable future, the unstable opcodes will remain unimplemented simply due to the fact
-    I'm not trying to make anything super accurate, just something for educational and recreational purposes.
+// AND, then N goes into C
+static ALWAYS_INLINE void ANC(struct nesCPU * cpu, uint16_t addr) {
+    AND(cpu, addr);
+    cpu->c = cpu->a >> 7;
+}
 
-    I might change my mind about implementing the rest of the missing opcodes, but for now I just want to see something work.
-*/
+// AND + LSR A
+static ALWAYS_INLINE void ALR(struct nesCPU * cpu, uint16_t addr) {
+    AND(cpu, addr);
+    LSR_A(cpu);
+}
 
-// 0x4B ALR
-// 0x0B ANC
-// 0x2B ANC
-// 0x6B ARR
+// AND + ROR A, with C and V coming out of bits 6 and 5 of the result
+static ALWAYS_INLINE void ARR(struct nesCPU * cpu, uint16_t addr) {
+    cpu->a = ((cpu->a & readRAM(addr)) >> 1) | (cpu->c << 7);
+    updateNegZero(cpu, cpu->a);
+    cpu->c = (cpu->a >> 6) & 1;
+    cpu->v = ((cpu->a >> 6) ^ (cpu->a >> 5)) & 1;
+}
 
-void JAM() {}
+// (A OR magic) AND X AND oper -> A
+static ALWAYS_INLINE void ANE(struct nesCPU * cpu, uint16_t addr) {
+    cpu->a = (cpu->a | 0xee) & cpu->x & readRAM(addr);
+    updateNegZero(cpu, cpu->a);
+}
+
+// (A OR magic) AND oper -> A -> X
+static ALWAYS_INLINE void LXA(struct nesCPU * cpu, uint16_t addr) {
+    cpu->a = (cpu->a | 0xee) & readRAM(addr);
+    cpu->x = cpu->a;
+    updateNegZero(cpu, cpu->a);
+}
+
+// SHA/SHX/SHY/TAS store value AND (high byte of the unindexed address + 1), and when the index
+// crosses a page that value ends up as the high byte of the address as well
+static void storeHigh(uint16_t addr, uint8_t index, uint8_t value) {
+    uint16_t base = addr - index;
+    value &= (base >> 8) + 1;
+    if((base ^ addr) & 0xff00) {
+        addr = (value << 8) | (addr & 0xff);
+    }
+    writeRAM(addr, value);
+}
+
+// A AND X AND (H + 1) -> M
+static ALWAYS_INLINE void SHA(struct nesCPU * cpu, uint16_t addr) {
+    storeHigh(addr, cpu->y, cpu->a & cpu->x);
+}
+
+// X AND (H + 1) -> M
+static ALWAYS_INLINE void SHX(struct nesCPU * cpu, uint16_t addr) {
+    storeHigh(addr, cpu->y, cpu->x);
+}
+
+// Y AND (H + 1) -> M
+static ALWAYS_INLINE void SHY(struct nesCPU * cpu, uint16_t addr) {
+    storeHigh(addr, cpu->x, cpu->y);
+}
+
+// A AND X -> SP, SP AND (H + 1) -> M
+static ALWAYS_INLINE void TAS(struct nesCPU * cpu, uint16_t addr) {
+    cpu->sp = cpu->a & cpu->x;
+    storeHigh(addr, cpu->y, cpu->sp);
+}
 
 // DEC + CMP
-void DCP(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void DCP(struct nesCPU * cpu, uint16_t addr) {
     DEC(cpu, addr);
     CMP(cpu, addr);
 }
 
 // INC + SBC
-void ISC(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void ISC(struct nesCPU * cpu, uint16_t addr) {
     INC(cpu, addr);
     SBC(cpu, addr);
 }
 
 // LDA/TSX
 // M AND SP -> A, X, SP
-void LAS(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void LAS(struct nesCPU * cpu, uint16_t addr) {
     cpu->sp &= readRAM(addr);
     cpu->a = cpu->sp;
     TSX(cpu);
@@ -1745,43 +593,44 @@ void LAS(struct nesCPU * cpu, uint16_t addr) {
 
 // LDA + TAX
 // M -> A -> X
-void LAX(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void LAX(struct nesCPU * cpu, uint16_t addr) {
     cpu->a = readRAM(addr);
     cpu->x = cpu->a;
     updateNegZero(cpu, cpu->x);
 }
 
 // RLA + AND
-void RLA(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void RLA(struct nesCPU * cpu, uint16_t addr) {
     ROL(cpu, addr);
     AND(cpu, addr);
 }
 
 // ROR + ADC
-void RRA(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void RRA(struct nesCPU * cpu, uint16_t addr) {
     ROR(cpu, addr);
     ADC(cpu, addr);
 }
 
 // A & X -> M
-void SAX(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void SAX(struct nesCPU * cpu, uint16_t addr) {
     writeRAM(addr, cpu->a & cpu->x);
 }
 
 // CMP and DEX, flags set by CMP
 // (A AND X) - oper -> X
-void SBX(struct nesCPU * cpu, uint16_t addr) {
-    uint8_t compare = (cpu->a & cpu->x) - readRAM(addr);
-    updateFlag(cpu, compare >= 0, CARRY_MASK);
+static ALWAYS_INLINE void SBX(struct nesCPU * cpu, uint16_t addr) {
+    uint8_t value = readRAM(addr);
+    uint8_t compare = (cpu->a & cpu->x) - value;
+    cpu->c = (cpu->a & cpu->x) >= value;
     updateNegZero(cpu, compare);
     cpu->x = compare;
 }
 
 // ASL + ORA
 // Do ASL on M, update carry using M, A OR M -> A, update neg and zero using A
-void SLO(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void SLO(struct nesCPU * cpu, uint16_t addr) {
     uint8_t shift = readRAM(addr);
-    updateFlag(cpu, shift >> 7, CARRY_MASK);
+    cpu->c = shift >> 7;
     shift = shift << 1;
     writeRAM(addr, shift);
     cpu->a |= shift;
@@ -1790,9 +639,9 @@ void SLO(struct nesCPU * cpu, uint16_t addr) {
 
 // LSR + EOR
 // DO LSR on M, update carry using M, A XOR M -> A, update neg and zero using A
-void SRE(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void SRE(struct nesCPU * cpu, uint16_t addr) {
     uint8_t shift = readRAM(addr);
-    updateFlag(cpu, shift & 0x1, CARRY_MASK);
+    cpu->c = shift & 0x1;
     shift = shift >> 1;
     writeRAM(addr, shift);
     cpu->a ^= shift;
@@ -1800,6 +649,441 @@ void SRE(struct nesCPU * cpu, uint16_t addr) {
 }
 
 // Same as SBC immediate
-void USBC(struct nesCPU * cpu, uint16_t addr) {
+static ALWAYS_INLINE void USBC(struct nesCPU * cpu, uint16_t addr) {
     SBC(cpu, addr);
-}
\ No newline at end of file
+}
+
+/*
+    Branch profile report
+    Busiest branches first. How often they're taken says which loops are worth caching or skipping
+    (see the idle loop detection), crossed is taken branches that paid the extra page cycle.
+*/
+#if NYMPH_BRANCH_PROFILE
+static int busier(const void * a, const void * b) {
+    const struct branch_stats * x = &branch_stats[*(const uint16_t *) a];
+    const struct branch_stats * y = &branch_stats[*(const uint16_t *) b];
+    uint64_t x_count = (uint64_t) x->taken + x->not_taken;
+    uint64_t y_count = (uint64_t) y->taken + y->not_taken;
+    return (x_count < y_count) - (x_count > y_count);
+}
+#endif
+
+// Writes the top branches by how often they ran, returns -1 if the profile isn't built in
+int branchReport(FILE * out, int top) {
+#if NYMPH_BRANCH_PROFILE
+    static uint16_t pcs[0x10000];
+    int count = 0;
+    uint64_t executed = 0;
+    uint64_t taken = 0;
+    uint64_t crossed = 0;
+    for(int pc = 0; pc < 0x10000; pc++) {
+        const struct branch_stats * stats = &branch_stats[pc];
+        if(stats->taken || stats->not_taken) {
+            pcs[count++] = pc;
+            executed += stats->taken + stats->not_taken;
+            taken += stats->taken;
+            crossed += stats->crossed;
+        }
+    }
+    qsort(pcs, count, sizeof(pcs[0]), busier);
+    fprintf(out, "%d branches, %" PRIu64 " executed, %.1f%% taken, %" PRIu64 " page crossings\n",
+            count, executed, executed ? 100.0 * taken / executed : 0.0, crossed);
+    fprintf(out, "  pc    %-4s %12s %7s %12s %12s %12s\n", "op", "executed", "taken", "taken", "not taken", "crossed");
+    for(int i = 0; i < count && i < top; i++) {
+        const struct branch_stats * stats = &branch_stats[pcs[i]];
+        uint64_t total = (uint64_t) stats->taken + stats->not_taken;
+        fprintf(out, "  %04X  %-4s %12" PRIu64 " %6.1f%% %12" PRIu32 " %12" PRIu32 " %12" PRIu32 "\n", pcs[i],
+                opcodes[readRAM(pcs[i])].name, total, 100.0 * stats->taken / total, stats->taken, stats->not_taken, stats->crossed);
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+void clearBranchProfile(void) {
+#if NYMPH_BRANCH_PROFILE
+    memset(branch_stats, 0, sizeof(branch_stats));
+#endif
+}
+
+/*
+    Dispatch
+
+    Everything below is generated from OPCODE_TABLE in opcodes.h. EXECUTE() is the body of one instruction:
+    resolve the operand address, charge the cycles, step pc past the instruction and call the handler.
+    The ADDR_/CALL_ macros get picked by pasting the addressing mode, so each opcode body ends up as
+    straight line code with its cycle count and length folded in, whichever backend is used.
+    Page crossing comes back from the addressing mode in a local, so no state outlives the instruction.
+    The cycles get added to cpu->cycles before the handler runs, so a register write sees roughly the
+    time it really lands on the bus (most stores happen on an instruction's last cycle).
+*/
+
+#define ADDR_IMPL   0
+#define ADDR_ACC    0
+#define ADDR_IMM    (uint16_t) (cpu->pc + 1)
+#define ADDR_ZPG    zero_page(cpu)
+#define ADDR_ZPG_X  zero_page_X(cpu)
+#define ADDR_ZPG_Y  zero_page_Y(cpu)
+#define ADDR_ABS    absolute(cpu)
+#define ADDR_ABS_X  absolute_X(cpu, &crossed)
+#define ADDR_ABS_Y  absolute_Y(cpu, &crossed)
+#define ADDR_IND    indirect(cpu)
+#define ADDR_IND_X  indirect_X_index(cpu)
+#define ADDR_IND_Y  indirect_Y_index(cpu, &crossed)
+#define ADDR_REL    (uint16_t) (cpu->pc + 2 + (int8_t) readRAM(cpu->pc + 1))
+
+#define CALL_IMPL(fn)   fn(cpu)
+#define CALL_ACC(fn)    fn(cpu)
+#define CALL_IMM(fn)    fn(cpu, addr)
+#define CALL_ZPG(fn)    fn(cpu, addr)
+#define CALL_ZPG_X(fn)  fn(cpu, addr)
+#define CALL_ZPG_Y(fn)  fn(cpu, addr)
+#define CALL_ABS(fn)    fn(cpu, addr)
+#define CALL_ABS_X(fn)  fn(cpu, addr)
+#define CALL_ABS_Y(fn)  fn(cpu, addr)
+#define CALL_IND(fn)    fn(cpu, addr)
+#define CALL_IND_X(fn)  fn(cpu, addr)
+#define CALL_IND_Y(fn)  fn(cpu, addr)
+#define CALL_REL(fn)    { int extra = fn(cpu, addr, opcode); cycles += extra; cpu->cycles += extra; }    // branches hand back their extra cycles
+
+// ADDR picks the set of addressing macros, ADDR_ to decode from memory at pc or BLOCK_ADDR_ for decoded blocks
+#define EXECUTE_WITH(ADDR, op, fn, mode, cyc, pen, len) {   \
+    const uint8_t opcode = (op);                            \
+    TRACE_INSTRUCTION(cpu);                                 \
+    uint8_t crossed = 0;                                    \
+    uint16_t addr = ADDR##_##mode;                          \
+    cycles = (cyc) + ((pen) & crossed);                     \
+    cpu->pc += (len);                                       \
+    cpu->cycles += cycles;                                  \
+    CALL_##mode(fn);                                        \
+    (void) addr;                                            \
+    (void) opcode;                                          \
+}
+
+#define EXECUTE(op, fn, mode, cyc, pen, len) EXECUTE_WITH(ADDR, op, fn, mode, cyc, pen, len)
+
+#define DESCRIBE(op, name, fn, mode, cyc, pen, len) [op] = { #name, mode, cyc, pen, len },
+
+const struct opcode opcodes[256] = { OPCODE_TABLE(DESCRIBE) };
+
+#if NYMPH_DISPATCH == NYMPH_DISPATCH_SWITCH
+
+#define CASE(op, name, fn, mode, cyc, pen, len) case op: EXECUTE(op, fn, mode, cyc, pen, len) break;
+
+int interpret(struct nesCPU * cpu) {
+    int cycles = 0;
+    switch(readRAM(cpu->pc)) {
+        OPCODE_TABLE(CASE)
+    }
+    return cycles;
+}
+
+#if !NYMPH_BLOCK_CACHE
+int runCPU(struct nesCPU * cpu, int budget) {
+    uint64_t start = cpu->cycles;
+    cpu->run_until = start + budget;
+    while(cpu->cycles < cpu->run_until) {
+        interpret(cpu);
+    }
+    return cpu->cycles - start;
+}
+#endif
+
+#elif NYMPH_DISPATCH == NYMPH_DISPATCH_TABLE
+
+#define HANDLER(op, name, fn, mode, cyc, pen, len)          \
+    static int op_##op(struct nesCPU * cpu) {               \
+        int cycles;                                         \
+        EXECUTE(op, fn, mode, cyc, pen, len)                \
+        return cycles;                                      \
+    }
+#define HANDLER_ENTRY(op, name, fn, mode, cyc, pen, len) [op] = op_##op,
+
+OPCODE_TABLE(HANDLER)
+
+static int (* const handlers[256])(struct nesCPU * cpu) = { OPCODE_TABLE(HANDLER_ENTRY) };
+
+int interpret(struct nesCPU * cpu) {
+    return handlers[readRAM(cpu->pc)](cpu);
+}
+
+#if !NYMPH_BLOCK_CACHE
+int runCPU(struct nesCPU * cpu, int budget) {
+    uint64_t start = cpu->cycles;
+    cpu->run_until = start + budget;
+    while(cpu->cycles < cpu->run_until) {
+        handlers[readRAM(cpu->pc)](cpu);
+    }
+    return cpu->cycles - start;
+}
+#endif
+
+#elif NYMPH_DISPATCH == NYMPH_DISPATCH_GOTO
+
+// Each label ends in its own copy of NEXT, so runCPU() is threaded code with one indirect jump per opcode
+#define LABEL(op, name, fn, mode, cyc, pen, len) op_##op: EXECUTE(op, fn, mode, cyc, pen, len) NEXT
+#define LABEL_ENTRY(op, name, fn, mode, cyc, pen, len) [op] = &&op_##op,
+
+int interpret(struct nesCPU * cpu) {
+    static void * const labels[256] = { OPCODE_TABLE(LABEL_ENTRY) };
+    int cycles;
+    goto *labels[readRAM(cpu->pc)];
+#define NEXT return cycles;
+    OPCODE_TABLE(LABEL)
+#undef NEXT
+}
+
+#if !NYMPH_BLOCK_CACHE
+int runCPU(struct nesCPU * cpu, int budget) {
+    static void * const labels[256] = { OPCODE_TABLE(LABEL_ENTRY) };
+    int cycles;
+    uint64_t start = cpu->cycles;
+    cpu->run_until = start + budget;
+    if(budget <= 0) {
+        return 0;
+    }
+    goto *labels[readRAM(cpu->pc)];
+#define NEXT                                \
+    if(cpu->cycles >= cpu->run_until) {     \
+        return cpu->cycles - start;         \
+    }                                       \
+    goto *labels[readRAM(cpu->pc)];
+    OPCODE_TABLE(LABEL)
+#undef NEXT
+}
+#endif
+
+#endif
+
+/*
+    Block cache
+
+    runCPU() normally fetches and decodes every instruction as it goes. With the block cache it decodes
+    a straight run of instructions once, up to the next jump or return or the end of the page,
+    into micro-ops that already have their operands pulled out, and runs that on every later visit.
+    Blocks are found by pc and remember the memory their page was mapped to when they were decoded, so
+    after a bank switch the old bank's blocks just stop matching. Blocks from RAM also need the page's
+    writes to still be trapped (trapCode() in mmu.c), which the first write to it undoes, so self
+    modifying code and code copied into RAM both get decoded again.
+
+    Cycles still get charged and run_until checked per instruction like the other backends, so events
+    and register writes land at the same times. Any trapped write or remapping while a block is running
+    stops it after that instruction, and so does a branch being taken. A block that starts with an idle
+    loop can jump ahead past trips round it, see skipIdle().
+*/
+#if NYMPH_BLOCK_CACHE
+
+#define BLOCK_COUNT 4096        // has to be a power of two
+#define BLOCK_OPS 24
+
+struct micro_op {
+    uint8_t opcode;
+    uint16_t pc;
+    uint16_t operand;       // the address for immediate, zero page or absolute, the base for indexed, the target for branches
+};
+
+struct block {
+    uint16_t pc;
+    uint8_t count;
+    uint8_t idle;           // ops in the idle loop the block starts with, 0 if it doesn't
+    const uint8_t * page;   // the memory pc's page was mapped to
+    uint32_t epoch;         // pc's page's code_epoch, see trapCode()
+    struct micro_op ops[BLOCK_OPS];
+};
+
+static NYMPH_TLS struct block blocks[BLOCK_COUNT];
+
+#define BLOCK_ADDR_IMPL   0
+#define BLOCK_ADDR_ACC    0
+#define BLOCK_ADDR_IMM    op->operand
+#define BLOCK_ADDR_ZPG    op->operand
+#define BLOCK_ADDR_ZPG_X  (uint8_t) (op->operand + cpu->x)
+#define BLOCK_ADDR_ZPG_Y  (uint8_t) (op->operand + cpu->y)
+#define BLOCK_ADDR_ABS    op->operand
+#define BLOCK_ADDR_ABS_X  indexed(op->operand, cpu->x, &crossed)
+#define BLOCK_ADDR_ABS_Y  indexed(op->operand, cpu->y, &crossed)
+#define BLOCK_ADDR_IND    indirect_at(op->operand)
+#define BLOCK_ADDR_IND_X  zero_page_pointer(op->operand + cpu->x)
+#define BLOCK_ADDR_IND_Y  indexed(zero_page_pointer(op->operand), cpu->y, &crossed)
+#define BLOCK_ADDR_REL    op->operand
+
+// Anything that always leaves the straight line ends a block, branches only leave it when they're taken
+static int endsBlock(uint8_t opcode) {
+    const struct opcode * op = &opcodes[opcode];
+    return opcode == 0x00 || opcode == 0x20 || opcode == 0x40 || opcode == 0x4c
+        || opcode == 0x60 || opcode == 0x6c || strcmp(op->name, "JAM") == 0;
+}
+
+// Loads, compares and BIT only read, and with nothing else in the loop the same reads give the same registers
+static int onlyReads(uint8_t opcode) {
+    static const char * const names[] = { "LDA", "LDX", "LDY", "BIT", "CMP", "CPX", "CPY", "AND", "ORA", "EOR", "NOP" };
+    const struct opcode * op = &opcodes[opcode];
+    if(op->mode != IMM && op->mode != ZPG && op->mode != ABS && !(op->mode == IMPL && opcode == 0xea)) {
+        return 0;
+    }
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if(strcmp(op->name, names[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Reads then a branch back to the start of the block, LDA $2002 / BPL and the like
+static int idleLoop(const struct block * b) {
+    for(int i = 0; i < b->count; i++) {
+        const struct micro_op * op = &b->ops[i];
+        if(opcodes[op->opcode].mode == REL) {
+            return op->operand == b->pc ? i + 1 : 0;
+        }
+        if(!onlyReads(op->opcode)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// Nothing gets read through readRAM() here, a block only ever comes from a page that's plain memory
+static void decodeBlock(struct block * b, uint16_t pc) {
+    const uint8_t * page = mmu.read_page[pc >> 8];
+    b->pc = pc;
+    b->page = page;
+    b->count = 0;
+    int offset = pc & 0xff;
+    while(b->count < BLOCK_OPS) {
+        uint8_t opcode = page[offset];
+        const struct opcode * op = &opcodes[opcode];
+        if(offset + op->length > 0x100) {
+            break;          // runs off the page, the next page could be mapped to anything
+        }
+        uint8_t low = op->length > 1 ? page[offset + 1] : 0;
+        uint8_t high = op->length > 2 ? page[offset + 2] : 0;
+        uint16_t operand = (high << 8) | low;
+        if(op->mode == IMM) {
+            operand = (pc & 0xff00) + offset + 1;
+        } else if(op->mode == REL) {
+            operand = (pc & 0xff00) + offset + 2 + (int8_t) low;
+        }
+        b->ops[b->count].opcode = opcode;
+        b->ops[b->count].pc = (pc & 0xff00) + offset;
+        b->ops[b->count].operand = operand;
+        b->count++;
+        offset += op->length;
+        if(endsBlock(opcode)) {
+            break;
+        }
+    }
+    b->idle = idleLoop(b);
+    b->epoch = mmu.code_epoch[pc >> 8];
+    trapCode(pc);
+}
+
+void flushBlocks(void) {
+    memset(blocks, 0, sizeof(blocks));
+}
+
+// Carry on with the next op unless the block's done, a branch went somewhere else, time's up or code changed
+#define BLOCK_GOES_ON \
+    (++op != end && cpu->pc == op->pc && cpu->cycles < cpu->run_until && mmu.code_writes == writes)
+
+// The first cycle anything the idle loop reads could change, taken before it goes round so the reads can't have seen it
+static uint64_t stableFor(const struct block * b) {
+    uint64_t limit = EVENT_NEVER;
+    for(int i = 0; i < b->idle; i++) {
+        enum addr_mode mode = opcodes[b->ops[i].opcode].mode;
+        if(mode == ZPG || mode == ABS) {
+            uint64_t stable = stableUntil(b->ops[i].operand);
+            limit = stable < limit ? stable : limit;
+        }
+    }
+    return limit;
+}
+
+/*
+    One trip round an idle loop just finished back at its start. If nothing changed, every trip until
+    something it reads changes will be the same, so skip as many whole ones as fit before then.
+*/
+static void skipIdle(struct nesCPU * cpu, const struct block * b, const struct nesCPU * before, uint64_t limit) {
+    if(cpu->pc != b->pc || cpu->a != before->a || cpu->x != before->x || cpu->y != before->y || cpu->sp != before->sp
+       || cpu->flags != before->flags || cpu->n != before->n || cpu->z != before->z || cpu->c != before->c || cpu->v != before->v) {
+        return;
+    }
+    uint64_t period = cpu->cycles - before->cycles;
+    limit = cpu->run_until < limit ? cpu->run_until : limit;
+    if(limit > cpu->cycles) {
+        uint64_t skipped = (limit - cpu->cycles) / period * period;
+        cpu->cycles += skipped;
+        idle_cycles += skipped;
+    }
+}
+
+#if NYMPH_DISPATCH == NYMPH_DISPATCH_GOTO
+// Threaded through the ops the same way the goto backend threads through memory
+#define BLOCK_LABEL(op, name, fn, mode, cyc, pen, len) block_##op: EXECUTE_WITH(BLOCK_ADDR, op, fn, mode, cyc, pen, len) BLOCK_NEXT
+#define BLOCK_LABEL_ENTRY(op, name, fn, mode, cyc, pen, len) [op] = &&block_##op,
+#define BLOCK_NEXT                                  \
+    if(BLOCK_GOES_ON) {                             \
+        goto *labels[op->opcode];                   \
+    }                                               \
+    goto block_done;
+#define RUN_BLOCK                                   \
+    goto *labels[op->opcode];                       \
+    OPCODE_TABLE(BLOCK_LABEL)                       \
+    block_done:
+#else
+#define BLOCK_CASE(op, name, fn, mode, cyc, pen, len) case op: EXECUTE_WITH(BLOCK_ADDR, op, fn, mode, cyc, pen, len) break;
+#define RUN_BLOCK                                   \
+    do {                                            \
+        switch(op->opcode) {                        \
+            OPCODE_TABLE(BLOCK_CASE)                \
+        }                                           \
+    } while(BLOCK_GOES_ON);
+#endif
+
+int runCPU(struct nesCPU * cpu, int budget) {
+#if NYMPH_DISPATCH == NYMPH_DISPATCH_GOTO
+    static void * const labels[256] = { OPCODE_TABLE(BLOCK_LABEL_ENTRY) };
+#endif
+    uint64_t start = cpu->cycles;
+    cpu->run_until = start + budget;
+    while(cpu->cycles < cpu->run_until) {
+        uint16_t pc = cpu->pc;
+        const uint8_t * page = mmu.read_page[pc >> 8];
+        struct block * b = &blocks[(pc ^ (pc >> 12)) & (BLOCK_COUNT - 1)];     // folds the bank bits in so $8000 and $C000 don't collide
+        if(page == NULL) {
+            interpret(cpu);         // running out of I/O space, nothing to cache
+            continue;
+        }
+        if(b->pc != pc || b->page != page || b->epoch != mmu.code_epoch[pc >> 8]) {
+            decodeBlock(b, pc);
+        }
+        if(b->count == 0) {
+            interpret(cpu);         // the first instruction straddles two pages
+            continue;
+        }
+        uint32_t writes = mmu.code_writes;
+        const struct micro_op * op = b->ops;
+        const struct micro_op * end = op + b->count;
+        int cycles;
+        struct nesCPU before = { .cycles = 0 };     // only looked at when idle, this just keeps gcc quiet
+        uint64_t stable = 0;
+        int idle = b->idle && idle_skipping && !trace_enabled;
+        if(idle) {
+            before = *cpu;
+            stable = stableFor(b);
+        }
+        RUN_BLOCK
+        (void) cycles;
+        if(idle && op == b->ops + b->idle) {
+            skipIdle(cpu, b, &before, stable);
+        }
+    }
+    return cpu->cycles - start;
+}
+
+#else
+
+void flushBlocks(void) {}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include <stdio.h>
 #include <inttypes.h>
 
 #define CARRY_MASK 0x01
@@ -12,20 +13,165 @@
 #define OVERFLOW_MASK 0x40
 #define NEGATIVE_MASK 0x80
 
+/*
+    Everything a running CPU touches (the CPU itself, the memory map, the block cache and the event
+    queue) is declared with NYMPH_TLS. It's nothing normally, fuzz.c builds with
+    -DNYMPH_TLS=_Thread_local so every thread gets a machine of its own.
+*/
+#ifndef NYMPH_TLS
+#define NYMPH_TLS
+#endif
+
+/*
+    The dispatchers are big enough that GCC stops inlining into them, and then every instruction pays a
+    call for its opcode and another for each memory access. ALWAYS_INLINE goes on the instructions and the
+    bus, COLD on the I/O handlers the bus calls out to so that path gets moved out of the way.
+*/
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define COLD __attribute__((cold))
+#else
+#define ALWAYS_INLINE inline
+#define COLD
+#endif
+
 struct nesCPU {
     uint8_t a;
     uint8_t x;
     uint8_t y;
     uint8_t sp;
     uint16_t pc;
-    uint8_t status;
+
+    // The status register is kept in pieces so ALU ops just store their result instead of masking bits in
+    // and out of one byte, getStatus()/setStatus() pack it back up for the stack, interrupts and debuggers
+    uint8_t flags;          // I and D, plus B and the unused bit the way the last PLP/RTI/BRK left them
+    uint8_t n;              // N is bit 7 of this
+    uint8_t z;              // Z is set when this is 0
+    uint8_t c;              // 0 or 1
+    uint8_t v;              // 0 or 1
+    uint64_t cycles;        // CPU cycles since power on, the clock everything else is timed against
+    uint64_t run_until;     // runCPU() stops at the first instruction boundary at or past this
+
+    // Interrupt inputs, see setNMI()/setIRQ()
+    uint8_t nmi_line;       // the NMI input as it was last driven
+    uint8_t nmi_pending;    // latched when nmi_line goes up, taken at the next instruction boundary
+    uint8_t irq_lines;      // one bit per IRQ source holding the line, the CPU sees them ORed together
+    uint8_t polled_mask;    // the I flag from before the last CLI/SEI/PLP, which is what the next poll still sees
+    uint64_t mask_changed;  // the cycle that CLI/SEI/PLP finished on
+    uint8_t jammed;         // a JAM opcode stopped the CPU, it just burns cycles and ignores interrupts until resetCPU()
+};
+
+extern NYMPH_TLS struct nesCPU cpu;
+
+#define FIXED_FLAGS (IRQ_MASK | DECIMAL_MASK | BRK_MASK | UNUSED_MASK)
+
+static inline uint8_t getStatus(const struct nesCPU * cpu) {
+    return cpu->flags | (cpu->n & NEGATIVE_MASK) | (cpu->v << 6) | ((cpu->z == 0) << 1) | cpu->c;
+}
+
+static inline void setStatus(struct nesCPU * cpu, uint8_t status) {
+    cpu->flags = status & FIXED_FLAGS;
+    cpu->n = status;
+    cpu->z = ~status & ZERO_MASK;
+    cpu->c = status & CARRY_MASK;
+    cpu->v = (status >> 6) & 1;
+}
+
+enum addr_mode { IMPL, ACC, IMM, ZPG, ZPG_X, ZPG_Y, ABS, ABS_X, ABS_Y, IND, IND_X, IND_Y, REL };
+
+struct opcode {
+    const char * name;
+    enum addr_mode mode;
+    uint8_t cycles;
+    uint8_t penalty;
+    uint8_t length;
 };
 
-extern struct nesCPU cpu;
+extern const struct opcode opcodes[256];
+
+// Dispatch backends, pick one at build time with -DNYMPH_DISPATCH=...
+#define NYMPH_DISPATCH_SWITCH 0     // switch generated from the opcode table
+#define NYMPH_DISPATCH_TABLE 1      // function pointer table, one handler per opcode
+#define NYMPH_DISPATCH_GOTO 2       // computed goto, threaded through runCPU()
+
+#ifndef NYMPH_DISPATCH
+#ifdef __GNUC__
+#define NYMPH_DISPATCH NYMPH_DISPATCH_GOTO
+#else
+#define NYMPH_DISPATCH NYMPH_DISPATCH_TABLE
+#endif
+#endif
+
+/*
+    Branch profiling
+    Build with -DNYMPH_BRANCH_PROFILE=1 to count how often every branch is taken, falls through and
+    crosses a page, by address. Without it there's no counting at all and branchReport() returns -1.
+    The counts are by CPU address, so branches in different banks at the same address get lumped together.
+*/
+#ifndef NYMPH_BRANCH_PROFILE
+#define NYMPH_BRANCH_PROFILE 0
+#endif
+
+struct branch_stats {
+    uint32_t taken;
+    uint32_t not_taken;
+    uint32_t crossed;       // taken to another page
+};
+
+int branchReport(FILE * out, int top);
+void clearBranchProfile(void);
+
+/*
+    Block cache
+    runCPU() runs pre-decoded straight line blocks instead of decoding every instruction as it goes, see
+    cpu.c. -DNYMPH_BLOCK_CACHE=0 turns it off and runCPU() goes straight through the dispatch backend.
+    interpret() always decodes, it's the one instruction at a time path. Anything that changes memory
+    behind the CPU's back instead of through writeRAM() has to flushBlocks(), or invalidateCode() if
+    it only touched RAM (loading a save state, say).
+*/
+#ifndef NYMPH_BLOCK_CACHE
+#define NYMPH_BLOCK_CACHE 1
+#endif
+
+void flushBlocks(void);
+
+/*
+    Idle loops
+    Games mostly wait for vblank in a loop that reads something and branches back until it changes.
+    With the block cache on, a block that starts with one of those (only loads, compares and BIT
+    from immediate, zero page or absolute, then a branch back to the start) gets spotted when it's
+    decoded. Once it goes round without changing any register, the CPU jumps straight to the next
+    event, or to the next time what it's reading could change for $2002, in whole trips round the loop
+    so the cycle count lands where it would have anyway. Set idle_skipping to 0 to run them for real,
+    idle_cycles counts what got skipped. Nothing is skipped while tracing.
+*/
+extern int idle_skipping;
+extern NYMPH_TLS uint64_t idle_cycles;
+
+/*
+    Interrupts
+    Nothing gets checked between instructions. Raising an interrupt schedules EVENT_INTERRUPT for the
+    next instruction boundary and the handler there takes it if it still should, so runCPU() only ever
+    stops for one when there is one. NMI is edge triggered: setNMI() latches it when the line goes up,
+    and it gets taken even if the line's gone down again by then. IRQ is level triggered: each source
+    holds its own bit in irq_lines until whatever it's telling about has been acknowledged, and the CPU
+    keeps taking IRQs while any bit is set and I is clear.
+
+    Like the real 6502, CLI, SEI and PLP change I after the CPU has already polled for the next
+    interrupt, so an IRQ still gets in straight after SEI and waits one more instruction after CLI or
+    PLP. RTI's I takes effect straight away.
+*/
+#define IRQ_MAPPER 0x01     // MMC3 scanline counter and the like
+#define IRQ_FRAME 0x02      // APU frame counter
+#define IRQ_DMC 0x04        // APU DMC sample finished
 
-enum addr_mode { imm, zpg, zpg_X, abs, abs_X, abs_Y, ind_X, ind_Y  };
+void setNMI(struct nesCPU * cpu, int level);
+void setIRQ(struct nesCPU * cpu, uint8_t source);
+void clearIRQ(struct nesCPU * cpu, uint8_t source);
 
 int interpret(struct nesCPU * cpu);
+// Runs whole instructions until budget cycles are used up (or run_until gets pulled in), returns the cycles run
+int runCPU(struct nesCPU * cpu, int budget);
 void resetCPU(struct nesCPU * cpu);
 void pushStack(struct nesCPU * cpu, uint8_t value);
 uint8_t popStack(struct nesCPU * cpu);
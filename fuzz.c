@@ -0,0 +1,519 @@
+/*
+    Differential CPU fuzzer
+
+    fuzz [-n instructions] [-j threads] [-s seed]
+
+    Throws random instructions at random registers and memory, runs them through this build's CPU and
+    through a plain reference 6502 further down, and stops at the first instruction where the two end up
+    with different registers, P, pc, cycle counts or memory. The reference is deliberately the dumbest
+    thing that works, one switch over the mnemonic with a packed P, so it shares nothing with the
+    dispatch backends, the unpacked flags or the block cache that it's checking.
+
+    Most instructions go through one at a time, alternately with interpret() and runCPU(&cpu, 1). Every
+    so often a whole run of random code goes through runCPU() instead, which is what gets the block cache
+    and idle loop skipping looked at. The backend and the block cache are picked at build time, so build
+    it once for each combination you care about, with NYMPH_TLS so every thread gets its own CPU and memory:
+
+        gcc -O2 -pthread -DNYMPH_TLS=_Thread_local -DNYMPH_DISPATCH=2 -o fuzz fuzz.c cpu.c mmu.c ppu.c apu.c blip.c audio.c state.c rewind.c rom.c mapper.c nes.c render.c trace.c
+
+    Without NYMPH_TLS there's only one machine to go round and it runs on one thread.
+
+    The bus is 2 KB of RAM mirrored over all 64 KB, so any address an instruction comes up with lands
+    somewhere both sides can see, and the stack and zero page get hit plenty. There's no I/O, interrupts
+    or decimal mode (the NES hasn't got one), and the unstable opcodes are checked against the values
+    cpu.c picked for them.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <inttypes.h>
+#include "cpu.h"
+#include "mmu.h"
+
+#define RAM_SIZE 0x800
+#define RAM_MASK (RAM_SIZE - 1)
+#define RUN_EVERY 64            // one in this many goes is a whole run instead of one instruction
+#define RUN_CYCLES 500
+#define SCRAMBLE_EVERY 256      // all of memory gets rerolled this often, a few bytes every time in between
+#define MAX_THREADS 256
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// xorshift64*, each thread has its own so a seed always gives the same instructions
+static uint64_t random64(uint64_t * state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1d;
+}
+
+/*
+    Reference CPU
+*/
+#define MNEMONICS(X)                                                                                            \
+    X(ADC) X(ALR) X(ANC) X(AND) X(ANE) X(ARR) X(ASL) X(BCC) X(BCS) X(BEQ) X(BIT) X(BMI) X(BNE) X(BPL) X(BRK)  \
+    X(BVC) X(BVS) X(CLC) X(CLD) X(CLI) X(CLV) X(CMP) X(CPX) X(CPY) X(DCP) X(DEC) X(DEX) X(DEY) X(EOR) X(INC)  \
+    X(INX) X(INY) X(ISC) X(JAM) X(JMP) X(JSR) X(LAS) X(LAX) X(LDA) X(LDX) X(LDY) X(LSR) X(LXA) X(NOP) X(ORA)  \
+    X(PHA) X(PHP) X(PLA) X(PLP) X(RLA) X(ROL) X(ROR) X(RRA) X(RTI) X(RTS) X(SAX) X(SBC) X(SBX) X(SEC) X(SED)  \
+    X(SEI) X(SHA) X(SHX) X(SHY) X(SLO) X(SRE) X(STA) X(STX) X(STY) X(TAS) X(TAX) X(TAY) X(TSX) X(TXA) X(TXS)  \
+    X(TYA) X(USBC)
+
+#define MNEMONIC_ENUM(name) M_##name,
+#define MNEMONIC_NAME(name) #name,
+
+enum mnemonic { MNEMONICS(MNEMONIC_ENUM) MNEMONIC_COUNT };
+static const char * const mnemonic_names[] = { MNEMONICS(MNEMONIC_NAME) };
+static enum mnemonic mnemonics[256];
+
+struct ref {
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t sp;
+    uint8_t p;
+    uint16_t pc;
+    uint64_t cycles;
+    int jammed;
+    uint8_t ram[RAM_SIZE];
+};
+
+static int initReference(void) {
+    for(int i = 0; i < 256; i++) {
+        int found = 0;
+        for(int m = 0; m < MNEMONIC_COUNT; m++) {
+            if(strcmp(opcodes[i].name, mnemonic_names[m]) == 0) {
+                mnemonics[i] = m;
+                found = 1;
+            }
+        }
+        if(!found) {
+            fprintf(stderr, "opcode %02X: the reference doesn't know %s\n", i, opcodes[i].name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static uint8_t refRead(struct ref * r, uint16_t address) {
+    return r->ram[address & RAM_MASK];
+}
+
+static void refWrite(struct ref * r, uint16_t address, uint8_t value) {
+    r->ram[address & RAM_MASK] = value;
+}
+
+static void refPush(struct ref * r, uint8_t value) {
+    refWrite(r, 0x100 | r->sp--, value);
+}
+
+static uint8_t refPull(struct ref * r) {
+    return refRead(r, 0x100 | ++r->sp);
+}
+
+static uint16_t refWord(struct ref * r, uint16_t low, uint16_t high) {
+    return refRead(r, low) | (refRead(r, high) << 8);
+}
+
+static void setNZ(struct ref * r, uint8_t value) {
+    r->p = (r->p & ~(NEGATIVE_MASK | ZERO_MASK)) | (value & NEGATIVE_MASK) | (value ? 0 : ZERO_MASK);
+}
+
+static void setFlag(struct ref * r, uint8_t mask, int on) {
+    r->p = on ? r->p | mask : r->p & ~mask;
+}
+
+static void refADC(struct ref * r, uint8_t value) {
+    int sum = r->a + value + (r->p & CARRY_MASK);
+    setFlag(r, OVERFLOW_MASK, ~(r->a ^ value) & (r->a ^ sum) & 0x80);
+    setFlag(r, CARRY_MASK, sum > 0xff);
+    r->a = sum;
+    setNZ(r, r->a);
+}
+
+static void refCompare(struct ref * r, uint8_t reg, uint8_t value) {
+    setFlag(r, CARRY_MASK, reg >= value);
+    setNZ(r, reg - value);
+}
+
+// The shifts and rotates on their own, the callers pick where the value comes from and goes
+static uint8_t refShift(struct ref * r, enum mnemonic m, uint8_t value) {
+    uint8_t carry = r->p & CARRY_MASK;
+    uint8_t result;
+    switch(m) {
+        case M_ASL: setFlag(r, CARRY_MASK, value & 0x80); result = value << 1; break;
+        case M_LSR: setFlag(r, CARRY_MASK, value & 0x01); result = value >> 1; break;
+        case M_ROL: setFlag(r, CARRY_MASK, value & 0x80); result = (value << 1) | carry; break;
+        default:    setFlag(r, CARRY_MASK, value & 0x01); result = (value >> 1) | (carry << 7); break;
+    }
+    setNZ(r, result);
+    return result;
+}
+
+// SHA/SHX/SHY/TAS as cpu.c does them
+static void refStoreHigh(struct ref * r, uint16_t base, uint16_t address, uint8_t value) {
+    value &= (base >> 8) + 1;
+    if((base ^ address) & 0xff00) {
+        address = (value << 8) | (address & 0xff);
+    }
+    refWrite(r, address, value);
+}
+
+// One instruction, until is where a JAM parks the cycle count like runCPU()'s run_until
+static void refStep(struct ref * r, uint64_t until) {
+    uint8_t opcode = refRead(r, r->pc);
+    const struct opcode * op = &opcodes[opcode];
+    uint8_t low = refRead(r, r->pc + 1);
+    uint16_t word = low | (refRead(r, r->pc + 2) << 8);
+    uint16_t base = 0;
+    uint16_t address = 0;
+    switch(op->mode) {
+        case IMPL:
+        case ACC:   break;
+        case IMM:   address = r->pc + 1; break;
+        case ZPG:   address = low; break;
+        case ZPG_X: address = (uint8_t) (low + r->x); break;
+        case ZPG_Y: address = (uint8_t) (low + r->y); break;
+        case ABS:   address = word; break;
+        case ABS_X: base = word; address = base + r->x; break;
+        case ABS_Y: base = word; address = base + r->y; break;
+        case IND:   address = refWord(r, word, (word & 0xff00) | ((word + 1) & 0xff)); break;
+        case IND_X: address = refWord(r, (uint8_t) (low + r->x), (uint8_t) (low + r->x + 1)); break;
+        case IND_Y: base = refWord(r, low, (uint8_t) (low + 1)); address = base + r->y; break;
+        case REL:   address = r->pc + 2 + (int8_t) low; break;
+    }
+    int crossed = (op->mode == ABS_X || op->mode == ABS_Y || op->mode == IND_Y) && ((base ^ address) & 0xff00);
+    r->cycles += op->cycles + (op->penalty && crossed);
+    r->pc += op->length;
+
+    enum mnemonic m = mnemonics[opcode];
+    uint8_t value;
+    switch(m) {
+        case M_ADC: refADC(r, refRead(r, address)); break;
+        case M_SBC:
+        case M_USBC: refADC(r, ~refRead(r, address)); break;
+        case M_AND: r->a &= refRead(r, address); setNZ(r, r->a); break;
+        case M_ORA: r->a |= refRead(r, address); setNZ(r, r->a); break;
+        case M_EOR: r->a ^= refRead(r, address); setNZ(r, r->a); break;
+        case M_ASL:
+        case M_LSR:
+        case M_ROL:
+        case M_ROR:
+            if(op->mode == ACC) {
+                r->a = refShift(r, m, r->a);
+            } else {
+                refWrite(r, address, refShift(r, m, refRead(r, address)));
+            }
+            break;
+        case M_BCC: case M_BCS: case M_BEQ: case M_BMI:
+        case M_BNE: case M_BPL: case M_BVC: case M_BVS: {
+            // Bits 7-6 of the opcode pick N V C Z, bit 5 is the value it branches on
+            static const uint8_t masks[4] = { NEGATIVE_MASK, OVERFLOW_MASK, CARRY_MASK, ZERO_MASK };
+            if(((r->p & masks[opcode >> 6]) != 0) == ((opcode >> 5) & 1)) {
+                r->cycles += 1 + ((r->pc ^ address) >> 8 != 0);
+                r->pc = address;
+            }
+            break;
+        }
+        case M_BIT:
+            value = refRead(r, address);
+            r->p = (r->p & ~(NEGATIVE_MASK | OVERFLOW_MASK | ZERO_MASK)) | (value & 0xc0) | ((r->a & value) ? 0 : ZERO_MASK);
+            break;
+        case M_BRK:
+            refPush(r, (r->pc + 1) >> 8);
+            refPush(r, (r->pc + 1) & 0xff);
+            refPush(r, r->p | BRK_MASK | UNUSED_MASK);
+            r->p |= IRQ_MASK;
+            r->pc = refWord(r, 0xfffe, 0xffff);
+            break;
+        case M_CLC: r->p &= ~CARRY_MASK; break;
+        case M_CLD: r->p &= ~DECIMAL_MASK; break;
+        case M_CLI: r->p &= ~IRQ_MASK; break;
+        case M_CLV: r->p &= ~OVERFLOW_MASK; break;
+        case M_SEC: r->p |= CARRY_MASK; break;
+        case M_SED: r->p |= DECIMAL_MASK; break;
+        case M_SEI: r->p |= IRQ_MASK; break;
+        case M_CMP: refCompare(r, r->a, refRead(r, address)); break;
+        case M_CPX: refCompare(r, r->x, refRead(r, address)); break;
+        case M_CPY: refCompare(r, r->y, refRead(r, address)); break;
+        case M_DEC: value = refRead(r, address) - 1; refWrite(r, address, value); setNZ(r, value); break;
+        case M_INC: value = refRead(r, address) + 1; refWrite(r, address, value); setNZ(r, value); break;
+        case M_DEX: setNZ(r, --r->x); break;
+        case M_DEY: setNZ(r, --r->y); break;
+        case M_INX: setNZ(r, ++r->x); break;
+        case M_INY: setNZ(r, ++r->y); break;
+        case M_JMP: r->pc = address; break;
+        case M_JSR:
+            refPush(r, (r->pc - 1) >> 8);
+            refPush(r, (r->pc - 1) & 0xff);
+            r->pc = address;
+            break;
+        case M_RTS: r->pc = refPull(r); r->pc |= refPull(r) << 8; r->pc++; break;
+        case M_RTI: r->p = (refPull(r) & ~BRK_MASK) | UNUSED_MASK; r->pc = refPull(r); r->pc |= refPull(r) << 8; break;
+        case M_LDA: r->a = refRead(r, address); setNZ(r, r->a); break;
+        case M_LDX: r->x = refRead(r, address); setNZ(r, r->x); break;
+        case M_LDY: r->y = refRead(r, address); setNZ(r, r->y); break;
+        case M_NOP: break;
+        case M_PHA: refPush(r, r->a); break;
+        case M_PHP: refPush(r, r->p | BRK_MASK | UNUSED_MASK); break;
+        case M_PLA: r->a = refPull(r); setNZ(r, r->a); break;
+        case M_PLP: r->p = (refPull(r) & ~BRK_MASK) | UNUSED_MASK; break;
+        case M_STA: refWrite(r, address, r->a); break;
+        case M_STX: refWrite(r, address, r->x); break;
+        case M_STY: refWrite(r, address, r->y); break;
+        case M_TAX: r->x = r->a; setNZ(r, r->x); break;
+        case M_TAY: r->y = r->a; setNZ(r, r->y); break;
+        case M_TSX: r->x = r->sp; setNZ(r, r->x); break;
+        case M_TXA: r->a = r->x; setNZ(r, r->a); break;
+        case M_TYA: r->a = r->y; setNZ(r, r->a); break;
+        case M_TXS: r->sp = r->x; break;
+
+        // Illegal
+        case M_SLO: value = refShift(r, M_ASL, refRead(r, address)); refWrite(r, address, value); r->a |= value; setNZ(r, r->a); break;
+        case M_RLA: value = refShift(r, M_ROL, refRead(r, address)); refWrite(r, address, value); r->a &= value; setNZ(r, r->a); break;
+        case M_SRE: value = refShift(r, M_LSR, refRead(r, address)); refWrite(r, address, value); r->a ^= value; setNZ(r, r->a); break;
+        case M_RRA: value = refShift(r, M_ROR, refRead(r, address)); refWrite(r, address, value); refADC(r, value); break;
+        case M_DCP: value = refRead(r, address) - 1; refWrite(r, address, value); refCompare(r, r->a, value); break;
+        case M_ISC: value = refRead(r, address) + 1; refWrite(r, address, value); refADC(r, ~value); break;
+        case M_SAX: refWrite(r, address, r->a & r->x); break;
+        case M_LAX: r->a = r->x = refRead(r, address); setNZ(r, r->a); break;
+        case M_LAS: r->a = r->x = r->sp = r->sp & refRead(r, address); setNZ(r, r->a); break;
+        case M_SBX: value = refRead(r, address); setFlag(r, CARRY_MASK, (r->a & r->x) >= value); r->x = (r->a & r->x) - value; setNZ(r, r->x); break;
+        case M_ANC: r->a &= refRead(r, address); setNZ(r, r->a); setFlag(r, CARRY_MASK, r->a & 0x80); break;
+        case M_ALR: r->a &= refRead(r, address); r->a = refShift(r, M_LSR, r->a); break;
+        case M_ARR:
+            r->a = ((r->a & refRead(r, address)) >> 1) | ((r->p & CARRY_MASK) << 7);
+            setNZ(r, r->a);
+            setFlag(r, CARRY_MASK, r->a & 0x40);
+            setFlag(r, OVERFLOW_MASK, ((r->a >> 6) ^ (r->a >> 5)) & 1);
+            break;
+        case M_ANE: r->a = (r->a | 0xee) & r->x & refRead(r, address); setNZ(r, r->a); break;
+        case M_LXA: r->a = r->x = (r->a | 0xee) & refRead(r, address); setNZ(r, r->a); break;
+        case M_SHA: refStoreHigh(r, base, address, r->a & r->x); break;
+        case M_SHX: refStoreHigh(r, base, address, r->x); break;
+        case M_SHY: refStoreHigh(r, base, address, r->y); break;
+        case M_TAS: r->sp = r->a & r->x; refStoreHigh(r, base, address, r->sp); break;
+        case M_JAM:
+            r->pc -= op->length;
+            r->jammed = 1;
+            if(r->cycles < until) {
+                r->cycles = until;
+            }
+            break;
+        case MNEMONIC_COUNT: break;
+    }
+}
+
+/*
+    Workers
+*/
+struct worker {
+    int id;
+    uint64_t seed;
+    uint64_t count;
+    uint64_t done;
+    pthread_t thread;
+};
+
+static atomic_int failed;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct state {
+    uint8_t a, x, y, sp, p;
+    uint16_t pc;
+    uint64_t cycles;
+    int jammed;
+};
+
+static void printState(const char * what, const struct state * s) {
+    printf("  %-10s A:%02X X:%02X Y:%02X P:%02X SP:%02X PC:%04X CYC:%" PRIu64 "%s\n", what,
+           s->a, s->x, s->y, s->p, s->sp, s->pc, s->cycles, s->jammed ? " jammed" : "");
+}
+
+static struct state cpuState(void) {
+    return (struct state) { cpu.a, cpu.x, cpu.y, cpu.sp, getStatus(&cpu), cpu.pc, cpu.cycles, cpu.jammed };
+}
+
+static struct state refState(const struct ref * r) {
+    return (struct state) { r->a, r->x, r->y, r->sp, r->p, r->pc, r->cycles, r->jammed };
+}
+
+static void report(const struct worker * w, uint64_t iteration, const char * how, const uint8_t * code,
+                   const struct state * before, const uint8_t * ram, const struct ref * r) {
+    pthread_mutex_lock(&report_lock);
+    if(atomic_exchange(&failed, 1) == 0) {
+        const struct opcode * op = &opcodes[code[0]];
+        printf("mismatch in thread %d (seed %" PRIu64 ") after %" PRIu64 " goes, %s\n", w->id, w->seed, iteration, how);
+        printf("  %04X  %02X %02X %02X  %s\n", before->pc, code[0], code[1], code[2], op->name);
+        struct state emulated = cpuState();
+        struct state reference = refState(r);
+        printState("before", before);
+        printState("emulator", &emulated);
+        printState("reference", &reference);
+        for(int i = 0; i < RAM_SIZE; i++) {
+            if(ram[i] != r->ram[i]) {
+                printf("  memory at $%04X is %02X, should be %02X\n", i, ram[i], r->ram[i]);
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&report_lock);
+}
+
+static void * fuzz(void * arg) {
+    struct worker * w = arg;
+    struct ref * r = malloc(sizeof(struct ref));
+    uint8_t * ram = calloc(RAM_SIZE, 1);
+    if(r == NULL || ram == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    uint64_t state = w->seed * 0x9e3779b97f4a7c15 + w->id + 1;
+    mmu.cpu_mem = ram;                  // readRAM() goes straight here for $0000-$1FFF
+    mapMemory(0x0000, 0xffff, ram, RAM_SIZE, true);
+    flushBlocks();
+    cpu.jammed = 0;
+
+    for(uint64_t i = 0; i < w->count && !atomic_load_explicit(&failed, memory_order_relaxed); i++) {
+        // Through writeRAM() like a game would, so the block cache finds out about it
+        if(i % SCRAMBLE_EVERY == 0) {
+            for(int address = 0; address < RAM_SIZE; address++) {
+                writeRAM(address, random64(&state));
+            }
+        }
+        for(int j = 0; j < 4; j++) {
+            uint64_t bits = random64(&state);
+            writeRAM(bits, bits >> 16);
+        }
+        uint64_t bits = random64(&state);
+        uint16_t pc = bits;
+        writeRAM(pc, bits >> 16);
+        writeRAM(pc + 1, bits >> 24);
+        writeRAM(pc + 2, bits >> 32);
+
+        bits = random64(&state);
+        cpu.a = bits;
+        cpu.x = bits >> 8;
+        cpu.y = bits >> 16;
+        cpu.sp = bits >> 24;
+        setStatus(&cpu, bits >> 32);
+        cpu.pc = pc;
+        cpu.cycles = 0;
+        cpu.run_until = 0;
+        cpu.jammed = 0;
+        struct state before = cpuState();
+        uint8_t code[3] = { readRAM(pc), readRAM(pc + 1), readRAM(pc + 2) };
+        *r = (struct ref) { cpu.a, cpu.x, cpu.y, cpu.sp, before.p, pc, 0, 0, { 0 } };
+        memcpy(r->ram, ram, RAM_SIZE);
+
+        const char * how;
+        if(i % RUN_EVERY == RUN_EVERY - 1) {
+            how = "in a runCPU() run starting here";
+            runCPU(&cpu, RUN_CYCLES);
+            while(r->cycles < RUN_CYCLES) {
+                refStep(r, RUN_CYCLES);
+            }
+        } else if(i & 1) {
+            how = "stepping it with interpret()";
+            interpret(&cpu);
+            refStep(r, 0);
+        } else {
+            how = "stepping it with runCPU()";
+            runCPU(&cpu, 1);
+            refStep(r, 1);
+        }
+
+        if(cpu.a != r->a || cpu.x != r->x || cpu.y != r->y || cpu.sp != r->sp || getStatus(&cpu) != r->p
+           || cpu.pc != r->pc || cpu.cycles != r->cycles || cpu.jammed != r->jammed || memcmp(ram, r->ram, RAM_SIZE) != 0) {
+            report(w, i, how, code, &before, ram, r);
+            break;
+        }
+        w->done = i + 1;
+    }
+    free(ram);
+    free(r);
+    return NULL;
+}
+
+static void * whereIsCPU(void * out) {
+    *(const struct nesCPU **) out = &cpu;
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: fuzz [-n instructions] [-j threads] [-s seed]\n");
+    exit(2);
+}
+
+int main(int argc, char * argv[]) {
+    uint64_t count = 10000000;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    uint64_t seed = time(NULL);
+    int opt;
+    while((opt = getopt(argc, argv, "n:j:s:")) != -1) {
+        switch(opt) {
+            case 'n':
+                count = strtoull(optarg, NULL, 0);
+                break;
+            case 'j':
+                threads = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                usage();
+        }
+    }
+    if(optind != argc || threads <= 0) {
+        usage();
+    }
+    if(initReference() != 0) {
+        return 2;
+    }
+    threads = threads > MAX_THREADS ? MAX_THREADS : threads;
+
+    // NYMPH_TLS or not, every thread needs a CPU of its own or they'd all be scribbling on the one
+    pthread_t probe;
+    const struct nesCPU * theirs = NULL;
+    if(pthread_create(&probe, NULL, whereIsCPU, &theirs) != 0) {
+        perror("pthread_create");
+        return 2;
+    }
+    pthread_join(probe, NULL);
+    if(theirs == &cpu && threads > 1) {
+        printf("built without -DNYMPH_TLS=_Thread_local, running on one thread\n");
+        threads = 1;
+    }
+
+    static struct worker workers[MAX_THREADS];
+    printf("fuzzing %" PRIu64 " instructions on %ld threads, seed %" PRIu64 "\n", count, threads, seed);
+    double start = now();
+    for(long i = 0; i < threads; i++) {
+        workers[i] = (struct worker) { .id = i, .seed = seed, .count = count / threads + (i < (long) (count % threads)) };
+        if(pthread_create(&workers[i].thread, NULL, fuzz, &workers[i]) != 0) {
+            perror("pthread_create");
+            return 2;
+        }
+    }
+    uint64_t done = 0;
+    for(long i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        done += workers[i].done;
+    }
+    double seconds = now() - start;
+    printf("%" PRIu64 " instructions in %.2f s, %.1f million a second\n", done, seconds, done / seconds / 1e6);
+    if(atomic_load(&failed)) {
+        return 1;
+    }
+    printf("no mismatches\n");
+    return 0;
+}
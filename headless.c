@@ -0,0 +1,278 @@
+/*
+    nymph-headless
+
+    Runs a ROM with no window or input for a fixed number of frames as fast as it'll go, then
+    prints a hash of the framebuffer and how long it took. Hashes from two builds matching means they
+    drew the same thing, so this doubles as a quick regression check. A ROM that hits a JAM opcode stops
+    there with exit status 3.
+
+    nymph-headless [-n frames] [-e every] [-a sound.wav | -q] [-r mb] [-t trace.bin] [-b branches.txt] [-p pc] [-i] rom.nes
+        -n  frames to run (default 600, ten seconds of NTSC)
+        -a  write the sound out, 48 kHz mono 16 bit, as a WAV file if the name ends in .wav or raw otherwise
+        -q  don't synthesize sound at all, only what the CPU can see of the APU runs and hashes don't change
+        -e  also print the hash every this many frames
+        -r  push every frame into this many MB of rewind (up to 4095) and say what it cost, then go back
+            as far as it'll go and run those frames again, which has to end on the same hash
+        -t  log every instruction to this file, needs a -DNYMPH_TRACE=1 build (see tracetool.c)
+        -b  write the busiest branches to this file at the end, needs a -DNYMPH_BRANCH_PROFILE=1 build
+        -p  start here instead of at the reset vector, nestest's automated mode starts at 0xc000
+        -i  run idle loops instruction by instruction instead of skipping them, hashes should match either way
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include "mmu.h"
+#include "rom.h"
+#include "ppu.h"
+#include "apu.h"
+#include "audio.h"
+#include "nes.h"
+#include "trace.h"
+#include "rewind.h"
+
+#define NTSC_FPS 60.0988
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 64 bit FNV-1a over the framebuffer
+static uint64_t hashFrame(void) {
+    const uint8_t * bytes = (const uint8_t *) ppu.framebuffer;
+    uint64_t hash = 0xcbf29ce484222325;
+    for(size_t i = 0; i < sizeof(ppu.framebuffer); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3;
+    }
+    return hash;
+}
+
+/*
+    Sound goes through the same ring as in the window, with a thread at the other end writing it to a
+    file. Nothing's listening in real time so the rate stays put, and the emulator waits for room
+    rather than dropping anything.
+*/
+static struct audio_ring audio;
+static FILE * audio_file;
+static atomic_int audio_done;
+static uint64_t audio_written;
+
+static void put16(FILE * f, uint16_t value) {
+    fputc(value & 0xff, f);
+    fputc(value >> 8, f);
+}
+
+static void put32(FILE * f, uint32_t value) {
+    put16(f, value & 0xffff);
+    put16(f, value >> 16);
+}
+
+// 44 byte canonical header, written once up front and again at the end when the length is known
+static void writeWavHeader(FILE * f, uint32_t rate, uint64_t samples) {
+    uint32_t bytes = samples * 2 > 0xffffffff - 36 ? 0xffffffff - 36 : samples * 2;
+    fwrite("RIFF", 1, 4, f);
+    put32(f, 36 + bytes);
+    fwrite("WAVEfmt ", 1, 8, f);
+    put32(f, 16);
+    put16(f, 1);                // PCM
+    put16(f, 1);                // mono
+    put32(f, rate);
+    put32(f, rate * 2);
+    put16(f, 2);
+    put16(f, 16);
+    fwrite("data", 1, 4, f);
+    put32(f, bytes);
+}
+
+static void * writeAudio(void * unused) {
+    int16_t chunk[4096];
+    for(;;) {
+        int done = atomic_load(&audio_done);     // looked at before reading, so whatever came in before it was set still gets written
+        int n = ringRead(&audio, chunk, 4096);
+        if(n) {
+            for(int i = 0; i < n; i++) {
+                put16(audio_file, chunk[i]);
+            }
+            audio_written += n;
+        } else if(done) {
+            return NULL;
+        } else {
+            struct timespec wait = { 0, 1000000 };
+            nanosleep(&wait, NULL);
+        }
+    }
+}
+
+static void pushAllAudio(void) {
+    while(AUDIO_RING_SIZE - ringFill(&audio) < samplesAvailable()) {
+        sched_yield();
+    }
+    pushAudio(&audio);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: nymph-headless [-n frames] [-e every] [-a sound.wav | -q] [-r mb] [-t trace.bin] [-b branches.txt] [-p pc] [-i] rom.nes\n");
+    exit(2);
+}
+
+int main(int argc, char * argv[]) {
+    long frames = 600;
+    long every = 0;
+    const char * sound = NULL;
+    int quiet = 0;
+    long history = 0;
+    const char * trace = NULL;
+    const char * branches = NULL;
+    long pc = -1;
+    int opt;
+    while((opt = getopt(argc, argv, "n:e:a:qr:t:b:p:i")) != -1) {
+        switch(opt) {
+            case 'n':
+                frames = strtol(optarg, NULL, 0);
+                break;
+            case 'e':
+                every = strtol(optarg, NULL, 0);
+                break;
+            case 'a':
+                sound = optarg;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            case 'r':
+                history = strtol(optarg, NULL, 0);
+                break;
+            case 't':
+                trace = optarg;
+                break;
+            case 'b':
+                branches = optarg;
+                break;
+            case 'p':
+                pc = strtol(optarg, NULL, 0);
+                break;
+            case 'i':
+                idle_skipping = 0;
+                break;
+            default:
+                usage();
+        }
+    }
+    if(optind != argc - 1 || frames <= 0 || every < 0 || history < 0 || history > (long) (REWIND_MAX_BYTES >> 20) || pc > 0xffff || (quiet && sound)) {
+        usage();
+    }
+
+    char * rom = argv[optind];
+    init_mmu();
+    int status = loadROM(rom);
+    if(status != ROM_OK) {
+        fprintf(stderr, "%s: %s\n", rom, romError(status));
+        return 1;
+    }
+    initPPU(rom);
+    initAPU();
+    initNES();
+    setAudioEnabled(!quiet);
+    if(pc >= 0) {
+        cpu.pc = pc;
+    }
+    int wav = sound && strlen(sound) >= 4 && strcmp(sound + strlen(sound) - 4, ".wav") == 0;
+    pthread_t writer;
+    if(sound) {
+        audio_file = fopen(sound, "wb");
+        if(audio_file == NULL) {
+            perror(sound);
+            return 1;
+        }
+        if(wav) {
+            writeWavHeader(audio_file, APU_SAMPLE_RATE, 0);
+        }
+        ringInit(&audio, APU_SAMPLE_RATE, 0);
+        pthread_create(&writer, NULL, writeAudio, NULL);
+    }
+    struct rewind_buffer history_buffer;
+    if(history && rewindInit(&history_buffer, history << 20) != 0) {
+        fprintf(stderr, "no memory for %ld MB of rewind\n", history);
+        return 1;
+    }
+    double pushing = 0;
+    if(trace && traceStart(trace) != 0) {
+        fprintf(stderr, "%s: can't trace%s\n", trace, NYMPH_TRACE ? "" : ", built without NYMPH_TRACE");
+        return 1;
+    }
+
+    double start = now();
+    for(long frame = 1; frame <= frames; frame++) {
+        if(history) {
+            double before = now();
+            rewindPush(&history_buffer);
+            pushing += now() - before;
+        }
+        runFrame();
+        if(sound) {
+            pushAllAudio();
+        }
+        if(cpu.jammed) {
+            fprintf(stderr, "CPU jammed at $%04X in frame %ld\n", cpu.pc, frame);
+            frames = frame;
+            break;
+        }
+        if(every && frame % every == 0 && frame != frames) {
+            printf("frame %ld %016" PRIx64 "\n", frame, hashFrame());
+        }
+    }
+    uint64_t traced = traceStop();
+    if(sound) {
+        atomic_store(&audio_done, 1);
+        pthread_join(writer, NULL);
+    }
+    double seconds = now() - start;
+
+    printf("frame %ld %016" PRIx64 "\n", frames, hashFrame());
+    printf("%ld frames in %.3f s, %.1f fps, %.1fx realtime\n", frames, seconds, frames / seconds, frames / seconds / NTSC_FPS);
+    if(idle_cycles) {
+        printf("%" PRIu64 " cycles of idle loops skipped, %.1f%%\n", idle_cycles, 100.0 * idle_cycles / cpu.cycles);
+    }
+    if(sound) {
+        if(wav) {
+            rewind(audio_file);
+            writeWavHeader(audio_file, APU_SAMPLE_RATE, audio_written);
+        }
+        fclose(audio_file);
+        printf("%" PRIu64 " samples written to %s, %" PRIu64 " dropped\n", audio_written, sound,
+               (uint64_t) atomic_load(&audio.overruns));
+    }
+    if(history && !cpu.jammed) {
+        uint64_t hash = hashFrame();
+        int held = rewindFrames(&history_buffer);
+        printf("%d frames of rewind in %zu KB, %.0f bytes and %.2f us a frame\n", held, rewindUsed(&history_buffer) >> 10,
+               (double) rewindUsed(&history_buffer) / (held + 1), pushing / frames * 1e6);
+        int back = rewindSeek(&history_buffer, held);
+        for(int i = 0; i <= back; i++) {
+            runFrame();
+        }
+        printf("went back %d frames and ran them again, hash %s\n", back, hashFrame() == hash ? "matches" : "DOESN'T MATCH");
+        rewindFree(&history_buffer);
+    }
+    if(trace) {
+        printf("%" PRIu64 " instructions traced to %s\n", traced, trace);
+    }
+    if(branches) {
+        FILE * report = fopen(branches, "w");
+        if(report == NULL || branchReport(report, 100) != 0) {
+            fprintf(stderr, "%s: no branch report%s\n", branches, NYMPH_BRANCH_PROFILE ? "" : ", built without NYMPH_BRANCH_PROFILE");
+        }
+        if(report) {
+            fclose(report);
+        }
+    }
+    clean_mem();
+    return cpu.jammed ? 3 : 0;
+}
@@ -1,6 +1,71 @@
+#include <stdlib.h>
 #include <SDL2/SDL.h>
 #include "io.h"
+#include "apu.h"
 
-void handleWindowEvents(SDL_Event event) {
-    
-}
\ No newline at end of file
+void handleWindowEvents(void) {
+    SDL_Event event;
+    while(SDL_PollEvent(&event)) {
+        if(event.type == SDL_QUIT) {
+            exit(0);
+        }
+    }
+}
+
+// Runs on SDL's audio thread, the consumer end of the ring
+static void audioCallback(void * userdata, Uint8 * stream, int len) {
+    ringPlay(userdata, (int16_t *) stream, len / sizeof(int16_t));
+}
+
+static SDL_AudioDeviceID device;
+
+/*
+    Mono 16 bit at whatever rate the device would rather have near APU_SAMPLE_RATE, 0 if there's no
+    sound. The ring aims to stay a couple of callbacks' worth plus a frame full, enough that a late
+    frame doesn't run it dry.
+*/
+int openAudio(struct audio_ring * ring) {
+    if(SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        return 0;
+    }
+    SDL_AudioSpec want = { 0 };
+    SDL_AudioSpec have;
+    want.freq = APU_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = 1024;
+    want.callback = audioCallback;
+    want.userdata = ring;
+    device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if(device == 0) {
+        return 0;
+    }
+    ringInit(ring, have.freq, have.samples * 2 + have.freq / 60);
+    SDL_PauseAudioDevice(device, 0);
+    return 1;
+}
+
+void closeAudio(void) {
+    if(device) {
+        SDL_CloseAudioDevice(device);
+        device = 0;
+    }
+}
+
+// Sleeps until the next frame is due, starting over from now if we've fallen more than a frame behind
+void waitFrame(double fps) {
+    static Uint64 next;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    Uint64 period = frequency / fps;
+    Uint64 now = SDL_GetPerformanceCounter();
+    if(next == 0 || now > next + period) {
+        next = now;
+    }
+    next += period;
+    while((now = SDL_GetPerformanceCounter()) < next) {
+        Uint64 left = (next - now) * 1000 / frequency;
+        if(left > 1) {
+            SDL_Delay(left - 1);        // the last millisecond or so is spun, SDL_Delay oversleeps
+        }
+    }
+}
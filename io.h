@@ -1,8 +1,12 @@
 #ifndef IO_H
 #define IO_H
 
-#include <SDL2/SDL.h>
+#include "audio.h"
 
-void handleWindowEvents(SDL_Event event);
+// The SDL front end, kept out of the core so nothing else needs SDL headers to build
+void handleWindowEvents(void);
+int openAudio(struct audio_ring * ring);
+void closeAudio(void);
+void waitFrame(double fps);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,379 @@
+#include <string.h>
+#include "mapper.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "ppu.h"
+#include "nes.h"
+#include "rom.h"
+
+#define PRG_SLOT_SIZE 0x2000
+#define CHR_SLOT_SIZE 0x400
+
+const struct mapper * mapper;
+struct mapper_state mapper_state;
+
+static uint8_t * chr_mem;       // CHR-ROM out of the file, or ppu.graphics when the board has CHR-RAM
+static int chr_writable;
+static int prg_banks;           // in 8 KB banks
+static int chr_banks;           // in 1 KB banks
+
+// Negative banks count back from the end, so -1 is always the last one
+static int wrapBank(int bank, int count) {
+    bank %= count;
+    return bank < 0 ? bank + count : bank;
+}
+
+// slot 0-3 is $8000, $A000, $C000, $E000
+void mapPRG(int slot, int bank) {
+    uint8_t * base = (uint8_t *) cart.prg + wrapBank(bank, prg_banks) * PRG_SLOT_SIZE;
+    int first = 0x80 + slot * (PRG_SLOT_SIZE >> 8);
+    if(mmu.read_page[first] != base) {
+        mmu.code_writes++;              // a block running out of the old bank has to stop here
+    }
+    for(int i = 0; i < (PRG_SLOT_SIZE >> 8); i++) {
+        mmu.read_page[first + i] = base + (i << 8);
+    }
+}
+
+// slot 0-7 is each 1 KB of the pattern tables
+void mapCHR(int slot, int bank) {
+    uint8_t * base = chr_mem + wrapBank(bank, chr_banks) * CHR_SLOT_SIZE;
+    if(mmu.ppu_page[slot] != base) {
+        invalidateTiles(slot * 64, 64);     // MMC3 resyncs every slot on any write, most of them land on the same bank
+    }
+    mmu.ppu_page[slot] = base;
+    mmu.ppu_write_page[slot] = chr_writable ? base : NULL;
+}
+
+void setMirroring(int mode) {
+    static const uint8_t layouts[5][4] = {
+        { 0, 0, 1, 1 },     // horizontal
+        { 0, 1, 0, 1 },     // vertical
+        { 0, 1, 2, 3 },     // four screen
+        { 0, 0, 0, 0 },     // single screen, lower bank
+        { 1, 1, 1, 1 },     // single screen, upper bank
+    };
+    if(cart.mirroring == MIRROR_FOUR_SCREEN) {
+        mode = MIRROR_FOUR_SCREEN;      // the extra VRAM is on the board, nothing can switch it off
+    }
+    mapper_state.mirroring = mode;
+    for(int i = 0; i < 4; i++) {
+        int table = layouts[mode][i];
+        uint8_t * page = (table < 2) ? ppu.vram + table * 0x400 : mmu.ppu_mem + (table - 2) * 0x400;
+        mmu.ppu_page[8 + i] = page;
+        mmu.ppu_page[12 + i] = page;
+        mmu.ppu_write_page[8 + i] = page;
+        mmu.ppu_write_page[12 + i] = page;
+    }
+}
+
+static void mapperWrite(uint16_t address, uint8_t value) {
+    mapper->write(address, value);
+}
+
+/*
+    NROM (0)
+    Up to 32 KB PRG and 8 KB CHR, no registers. 16 KB carts show up twice.
+*/
+static void nromSync(void) {
+    for(int i = 0; i < 4; i++) {
+        mapPRG(i, i);
+    }
+    for(int i = 0; i < 8; i++) {
+        mapCHR(i, i);
+    }
+    setMirroring(cart.mirroring);
+}
+
+static void nromReset(void) {
+    memset(&mapper_state, 0, sizeof(mapper_state));
+    nromSync();
+}
+
+static void nromWrite(uint16_t address, uint8_t value) {}
+
+/*
+    MMC1 (1)
+    Registers are loaded one bit at a time through a 5 bit shift register, the fifth write picks
+    the register from bits 13-14 of its address. Writing with bit 7 set resets the shift register.
+*/
+#define MMC1_CONTROL 0
+#define MMC1_CHR0 1
+#define MMC1_CHR1 2
+#define MMC1_PRG 3
+
+static void mmc1Sync(void) {
+    uint8_t control = mapper_state.regs[MMC1_CONTROL];
+    static const int mirroring[4] = { MIRROR_SINGLE_LOWER, MIRROR_SINGLE_UPPER, MIRROR_VERTICAL, MIRROR_HORIZONTAL };
+    setMirroring(mirroring[control & 3]);
+
+    // 512 KB boards (SUROM) use CHR bit 4 to pick which 256 KB half of PRG the other banks come from
+    int outer = (prg_banks > 32) ? (mapper_state.regs[MMC1_CHR0] & 0x10) << 1 : 0;
+    int bank = (mapper_state.regs[MMC1_PRG] & 0x0f) * 2 + outer;
+    switch((control >> 2) & 3) {
+        case 0:
+        case 1:                                 // 32 KB, low bit ignored
+            bank &= ~3;
+            mapPRG(0, bank);
+            mapPRG(1, bank + 1);
+            mapPRG(2, bank + 2);
+            mapPRG(3, bank + 3);
+            break;
+        case 2:                                 // first bank fixed at $8000, switch $C000
+            mapPRG(0, outer);
+            mapPRG(1, outer + 1);
+            mapPRG(2, bank);
+            mapPRG(3, bank + 1);
+            break;
+        case 3:                                 // switch $8000, last bank fixed at $C000
+            mapPRG(0, bank);
+            mapPRG(1, bank + 1);
+            mapPRG(2, outer + (prg_banks > 32 ? 31 : prg_banks - 1) - 1);
+            mapPRG(3, outer + (prg_banks > 32 ? 31 : prg_banks - 1));
+            break;
+    }
+
+    if(control & 0x10) {                        // two 4 KB banks
+        for(int i = 0; i < 4; i++) {
+            mapCHR(i, mapper_state.regs[MMC1_CHR0] * 4 + i);
+            mapCHR(4 + i, mapper_state.regs[MMC1_CHR1] * 4 + i);
+        }
+    } else {                                    // one 8 KB bank, low bit ignored
+        for(int i = 0; i < 8; i++) {
+            mapCHR(i, (mapper_state.regs[MMC1_CHR0] & ~1) * 4 + i);
+        }
+    }
+}
+
+static void mmc1Reset(void) {
+    memset(&mapper_state, 0, sizeof(mapper_state));
+    mapper_state.regs[MMC1_CONTROL] = 0x0c;    // powers up with the last bank fixed at $C000
+    mmc1Sync();
+}
+
+static void mmc1Write(uint16_t address, uint8_t value) {
+    if(value & 0x80) {
+        mapper_state.shift = 0;
+        mapper_state.shift_count = 0;
+        mapper_state.regs[MMC1_CONTROL] |= 0x0c;
+        mmc1Sync();
+        return;
+    }
+    mapper_state.shift |= (value & 1) << mapper_state.shift_count;
+    if(++mapper_state.shift_count < 5) {
+        return;
+    }
+    mapper_state.regs[(address >> 13) & 3] = mapper_state.shift;
+    mapper_state.shift = 0;
+    mapper_state.shift_count = 0;
+    mmc1Sync();
+}
+
+/*
+    UxROM (2)
+    16 KB bank at $8000 picked by any write, last bank fixed at $C000. CHR is usually RAM.
+*/
+static void uxromSync(void) {
+    mapPRG(0, mapper_state.regs[0] * 2);
+    mapPRG(1, mapper_state.regs[0] * 2 + 1);
+    mapPRG(2, -2);
+    mapPRG(3, -1);
+    for(int i = 0; i < 8; i++) {
+        mapCHR(i, i);
+    }
+    setMirroring(cart.mirroring);
+}
+
+static void uxromReset(void) {
+    memset(&mapper_state, 0, sizeof(mapper_state));
+    uxromSync();
+}
+
+static void uxromWrite(uint16_t address, uint8_t value) {
+    mapper_state.regs[0] = value;
+    uxromSync();
+}
+
+/*
+    CNROM (3)
+    Fixed PRG like NROM, any write picks the 8 KB CHR bank.
+*/
+static void cnromSync(void) {
+    for(int i = 0; i < 4; i++) {
+        mapPRG(i, i);
+    }
+    for(int i = 0; i < 8; i++) {
+        mapCHR(i, mapper_state.regs[0] * 8 + i);
+    }
+    setMirroring(cart.mirroring);
+}
+
+static void cnromReset(void) {
+    memset(&mapper_state, 0, sizeof(mapper_state));
+    cnromSync();
+}
+
+static void cnromWrite(uint16_t address, uint8_t value) {
+    mapper_state.regs[0] = value;
+    cnromSync();
+}
+
+/*
+    MMC3 (4)
+    Eight bank registers behind a select/data pair at $8000/$8001, two 8 KB PRG and six CHR banks.
+    Bit 6 of the select swaps which end of PRG is fixed, bit 7 swaps the 2 KB and 1 KB CHR halves.
+    The IRQ counter is clocked once per scanline by the PPU through scanline(). The PPU only runs when
+    something catches it up, so EVENT_MAPPER is kept at the scanline the counter will run out on to make
+    sure that happens in time for the IRQ.
+*/
+static void mmc3Sync(void) {
+    uint8_t * r = mapper_state.regs;
+    if(mapper_state.bank_select & 0x40) {
+        mapPRG(0, -2);
+        mapPRG(2, r[6]);
+    } else {
+        mapPRG(0, r[6]);
+        mapPRG(2, -2);
+    }
+    mapPRG(1, r[7]);
+    mapPRG(3, -1);
+
+    int flip = (mapper_state.bank_select & 0x80) ? 4 : 0;
+    mapCHR(0 ^ flip, r[0] & ~1);
+    mapCHR(1 ^ flip, r[0] | 1);
+    mapCHR(2 ^ flip, r[1] & ~1);
+    mapCHR(3 ^ flip, r[1] | 1);
+    mapCHR(4 ^ flip, r[2]);
+    mapCHR(5 ^ flip, r[3]);
+    mapCHR(6 ^ flip, r[4]);
+    mapCHR(7 ^ flip, r[5]);
+
+    setMirroring(mapper_state.mirroring);
+}
+
+// Scanlines until the counter next gets to zero, the clock that reloads it counts as one
+static void mmc3Predict(void) {
+    if(!mapper_state.irq_enabled) {
+        cancelEvent(EVENT_MAPPER);
+        return;
+    }
+    int clocks = mapper_state.irq_counter;
+    if(mapper_state.irq_counter == 0 || mapper_state.irq_reload) {
+        clocks = mapper_state.irq_latch + 1;
+    }
+    scheduleEvent(EVENT_MAPPER, nextScanlineClock(clocks));
+}
+
+static void mmc3Reset(void) {
+    memset(&mapper_state, 0, sizeof(mapper_state));
+    mapper_state.mirroring = cart.mirroring;
+    clearIRQ(&cpu, IRQ_MAPPER);
+    mmc3Sync();
+    mmc3Predict();
+}
+
+static void mmc3Write(uint16_t address, uint8_t value) {
+    switch(address & 0xe001) {
+        case 0x8000:
+            mapper_state.bank_select = value;
+            mmc3Sync();
+            break;
+        case 0x8001:
+            mapper_state.regs[mapper_state.bank_select & 7] = value;
+            mmc3Sync();
+            break;
+        case 0xa000:
+            setMirroring((value & 1) ? MIRROR_HORIZONTAL : MIRROR_VERTICAL);
+            break;
+        case 0xa001:                            // PRG-RAM protect, the RAM is always left enabled
+            break;
+        case 0xc000:
+            catchUpPPU(cpu.cycles);             // the scanlines so far counted with the old values
+            mapper_state.irq_latch = value;
+            mmc3Predict();
+            break;
+        case 0xc001:
+            catchUpPPU(cpu.cycles);
+            mapper_state.irq_counter = 0;
+            mapper_state.irq_reload = 1;
+            mmc3Predict();
+            break;
+        case 0xe000:
+            catchUpPPU(cpu.cycles);
+            mapper_state.irq_enabled = 0;
+            mapper_state.irq_pending = 0;
+            clearIRQ(&cpu, IRQ_MAPPER);
+            mmc3Predict();
+            break;
+        case 0xe001:
+            catchUpPPU(cpu.cycles);
+            mapper_state.irq_enabled = 1;
+            mmc3Predict();
+            break;
+    }
+}
+
+// Runs inside catchUpPPU(), so the prediction made here is from the dot that's just been reached
+static void mmc3Scanline(void) {
+    int reloaded = mapper_state.irq_counter == 0 || mapper_state.irq_reload;
+    if(reloaded) {
+        mapper_state.irq_counter = mapper_state.irq_latch;
+        mapper_state.irq_reload = 0;
+    } else {
+        mapper_state.irq_counter--;
+    }
+    if(mapper_state.irq_counter == 0 && mapper_state.irq_enabled) {
+        mapper_state.irq_pending = 1;
+        setIRQ(&cpu, IRQ_MAPPER);
+    }
+    if(reloaded) {
+        mmc3Predict();                          // a new count's started, anything else is still on schedule
+    }
+}
+
+// Catching up is all it takes, the counter gets clocked on the way and raises the IRQ itself
+static void mapperEvent(uint64_t when) {
+    catchUpPPU(cpu.cycles);
+}
+
+static const struct mapper mappers[] = {
+    { 0, "NROM", nromReset, nromWrite, nromSync, NULL, NULL },
+    { 1, "MMC1", mmc1Reset, mmc1Write, mmc1Sync, NULL, NULL },
+    { 2, "UxROM", uxromReset, uxromWrite, uxromSync, NULL, NULL },
+    { 3, "CNROM", cnromReset, cnromWrite, cnromSync, NULL, NULL },
+    { 4, "MMC3", mmc3Reset, mmc3Write, mmc3Sync, mmc3Scanline, mmc3Predict },
+};
+
+// Picks the board for the loaded cart and lays out its power on banks
+int initMapper(void) {
+    mapper = NULL;
+    for(size_t i = 0; i < sizeof(mappers) / sizeof(mappers[0]); i++) {
+        if(mappers[i].id == cart.mapper) {
+            mapper = &mappers[i];
+        }
+    }
+    if(mapper == NULL) {
+        return ROM_BAD_MAPPER;
+    }
+
+    prg_banks = cart.prg_size / PRG_SLOT_SIZE;
+    if(cart.chr) {
+        chr_mem = (uint8_t *) cart.chr;
+        chr_banks = cart.chr_size / CHR_SLOT_SIZE;
+        chr_writable = 0;
+    } else {
+        chr_mem = ppu.graphics;
+        chr_banks = sizeof(ppu.graphics) / CHR_SLOT_SIZE;
+        chr_writable = 1;
+    }
+
+    invalidateTiles(0, 512);            // a new ROM can get mapped right where the old one was
+    for(int page = 0x80; page < PAGE_COUNT; page++) {
+        mmu.write_page[page] = NULL;
+        mmu.write_io[page] = mapperWrite;
+    }
+    cancelEvent(EVENT_MAPPER);
+    setEventHandler(EVENT_MAPPER, mapperEvent);
+    mapper->reset();
+    return ROM_OK;
+}
@@ -0,0 +1,48 @@
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include <inttypes.h>
+
+// On top of the MIRROR_ modes from the iNES header
+#define MIRROR_SINGLE_LOWER 3
+#define MIRROR_SINGLE_UPPER 4
+
+/*
+    Cartridge boards
+
+    Bank switching never copies anything, it just repoints pages in the CPU and PPU page tables at a
+    different part of the ROM mapping. So a switch costs the same few pointer stores however big the bank is.
+*/
+struct mapper {
+    uint16_t id;
+    const char * name;
+    void (* reset)(void);
+    void (* write)(uint16_t address, uint8_t value);    // CPU writes to $8000-$FFFF
+    void (* sync)(void);                                // reapply the banks from mapper_state
+    void (* scanline)(void);                            // clocked once per rendered line, NULL if unused
+    void (* predict)(void);                             // reschedule EVENT_MAPPER after rendering goes on or off, NULL if unused
+};
+
+// Everything a board remembers, kept flat so it can be saved and put back with sync()
+struct mapper_state {
+    uint8_t regs[8];            // bank registers, MMC3 R0-R7 / MMC1 control, chr0, chr1, prg / latch for the simple boards
+    uint8_t bank_select;        // MMC3 $8000
+    uint8_t shift;              // MMC1 serial port
+    uint8_t shift_count;
+    uint8_t mirroring;
+    uint8_t irq_latch;
+    uint8_t irq_counter;
+    uint8_t irq_reload;
+    uint8_t irq_enabled;
+    uint8_t irq_pending;
+};
+
+extern const struct mapper * mapper;
+extern struct mapper_state mapper_state;
+
+int initMapper(void);
+void mapPRG(int slot, int bank);
+void mapCHR(int slot, int bank);
+void setMirroring(int mode);
+
+#endif
@@ -2,89 +2,209 @@
 #include <inttypes.h>
 #include <string.h>
 #include "mmu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "rom.h"
+#include "mapper.h"
+#include "nes.h"
 
-#define CPU_MEM_SIZE 0x10000
-#define PPU_MEM_SIZE 0x4000
-#define OAM_MEM_SIZE 256
+NYMPH_TLS struct memory_map mmu;
 
-struct memory_map mmu;
-bool pbc = false;
+int loadROM(char * filename) {
+    mapIO(0x8000, 0xffff, NULL, NULL);      // nothing may point into the old mapping once it's gone
+    closeROM(&cart);
+    int status = openROM(filename, &cart);
+    if(status != ROM_OK) {
+        return status;
+    }
+    if(cart.trainer) {
+        memcpy(mmu.prg_ram + 0x1000, cart.trainer, 512);
+    }
+    return initMapper();
+}
 
-void loadROM(char * filename) {
-    // load the rom
+// Nothing drives the bus here, so reads see the last byte on it which is usually the high byte of the address
+static uint8_t openBus(uint16_t address) {
+    return address >> 8;
 }
 
-void init_mmu(void) {
-    pbc = false;
-    mmu.cpu_mem = malloc(sizeof(uint8_t) * CPU_MEM_SIZE);
-    mmu.ppu_mem = malloc(sizeof(uint8_t) * PPU_MEM_SIZE);
-    mmu.oam = malloc(sizeof(uint8_t) * OAM_MEM_SIZE);
-    memset(mmu.cpu_mem, 0, sizeof(*mmu.cpu_mem));
-    memset(mmu.ppu_mem, 0, sizeof(*mmu.ppu_mem));
-    memset(mmu.oam, 0xff, sizeof(*mmu.oam));
+static void ignoreWrite(uint16_t address, uint8_t value) {}
+
+/*
+    $4000-$401F: APU, OAM DMA and the controller ports
+    Everything that isn't ours gets passed on to the APU
+*/
+static uint8_t readIO(uint16_t address) {
+    if(address == 0x4016 || address == 0x4017) {
+        int port = address & 1;
+        uint8_t bit = mmu.controller_shift[port] & 1;
+        if(!mmu.controller_strobe) {
+            mmu.controller_shift[port] = (mmu.controller_shift[port] >> 1) | 0x80;     // official pads read 1 once empty
+        }
+        return 0x40 | bit;
+    }
+    if(address >= 0x4018) {
+        return openBus(address);
+    }
+    return readAPU(address);
 }
 
-void clean_mem(void) {
-    free(mmu.cpu_mem);
-    free(mmu.ppu_mem);
-    free(mmu.oam);
+static void writeIO(uint16_t address, uint8_t value) {
+    if(address == 0x4014) {             // OAM DMA, copies a whole CPU page into sprite memory
+        uint16_t base = value << 8;
+        catchUpPPU(cpu.cycles);         // the PPU has to see OAM as it was up to now
+        for(int i = 0; i < OAM_MEM_SIZE; i++) {
+            mmu.oam[i] = readRAM(base + i);
+        }
+        scheduleSprite0();
+        cpu.cycles += 513 + (cpu.cycles & 1);   // the CPU is halted for the copy, one more to line up on an odd cycle
+        return;
+    }
+    if(address == 0x4016) {
+        mmu.controller_strobe = value & 1;
+        if(mmu.controller_strobe) {
+            mmu.controller_shift[0] = mmu.controller[0];
+            mmu.controller_shift[1] = mmu.controller[1];
+        }
+        return;
+    }
+    if(address >= 0x4018) {
+        return;
+    }
+    writeAPU(address, value);
+}
+
+// size is how much backing memory there is, the range repeats over it to make mirrors
+void mapMemory(uint16_t start, uint16_t end, uint8_t * mem, size_t size, bool writable) {
+    for(int page = start >> 8; page <= end >> 8; page++) {
+        uint8_t * ptr = mem + ((((page << 8) - start) % size) & ~0xff);
+        mmu.read_page[page] = ptr;
+        mmu.write_page[page] = writable ? ptr : NULL;
+        mmu.read_io[page] = openBus;
+        mmu.write_io[page] = ignoreWrite;
+        mmu.code_page[page] = NULL;
+        mmu.code_epoch[page]++;
+    }
+    mmu.code_writes++;
 }
 
-uint16_t indirect_X_index(struct nesCPU * cpu) {
-    uint8_t rel_addr = readRAM(cpu->pc + 1);
-    uint16_t address = (rel_addr + cpu->x) & 0xff;
-    uint16_t address2 = (rel_addr + cpu->x + 1) & 0xff;
-    uint8_t high = readRAM(address2);
-    uint8_t low = readRAM(address);
-    uint16_t final_addr = (high << 8) | low;
-    return final_addr;
+void mapIO(uint16_t start, uint16_t end, read_handler read, write_handler write) {
+    for(int page = start >> 8; page <= end >> 8; page++) {
+        mmu.read_page[page] = NULL;
+        mmu.write_page[page] = NULL;
+        mmu.read_io[page] = read ? read : openBus;
+        mmu.write_io[page] = write ? write : ignoreWrite;
+        mmu.code_page[page] = NULL;
+        mmu.code_epoch[page]++;
+    }
+    mmu.code_writes++;
 }
 
-uint16_t indirect_Y_index(struct nesCPU * cpu) {
-    uint8_t rel_addr = readRAM(cpu->pc+1);
-    uint8_t low = readRAM(rel_addr);
-    uint8_t high = readRAM((rel_addr + 1) & 0xff);
-    uint16_t address = (high << 8) | low;
-    pbc = (address & 0xff00) != ((address + cpu->y) & 0xff00);
-    return (address + cpu->y) & 0xffff;
+/*
+    Code in RAM
+    The CPU's block cache decodes instructions ahead of time, so it needs to hear about writes to memory
+    it has decoded from. trapCode() takes every page backed by the same memory off the direct write path
+    (mirrors included), so the next write to any of them comes through codeWrite(), which puts them all
+    back and bumps code_writes. Every time a page stops being trapped its code_epoch goes up too, and
+    blocks only trust a page while it's still in the epoch they were decoded in. Just checking the page
+    is still trapped isn't enough, decoding some other block there traps it again after the write.
+*/
+static void codeWrite(uint16_t address, uint8_t value) {
+    uint8_t * memory = mmu.code_page[address >> 8];
+    for(int page = 0; page < PAGE_COUNT; page++) {
+        if(mmu.code_page[page] == memory) {
+            mmu.write_page[page] = memory;
+            mmu.write_io[page] = ignoreWrite;
+            mmu.code_page[page] = NULL;
+            mmu.code_epoch[page]++;
+        }
+    }
+    memory[address & 0xff] = value;
+    mmu.code_writes++;
 }
 
-uint16_t zero_page(struct nesCPU * cpu) {
-    return readRAM(cpu->pc+1);
+void trapCode(uint16_t address) {
+    uint8_t * memory = mmu.write_page[address >> 8];
+    if(memory == NULL) {
+        return;         // ROM, or already trapped
+    }
+    for(int page = 0; page < PAGE_COUNT; page++) {
+        if(mmu.write_page[page] == memory) {
+            mmu.code_page[page] = memory;
+            mmu.write_page[page] = NULL;
+            mmu.write_io[page] = codeWrite;
+        }
+    }
 }
 
-uint16_t zero_page_X(struct nesCPU * cpu) {
-    uint8_t rel_addr = readRAM(cpu->pc+1);
-    return (rel_addr + cpu->x) & 0xff;
+/*
+    Something other than the CPU rewrote RAM (a save state got loaded, say), so nothing decoded from
+    any writable page can be trusted. Trapped pages go back to plain writes and every writable page
+    moves on an epoch, which costs a pass over the page table instead of emptying the whole block cache.
+    Blocks from ROM stay as they are.
+*/
+void invalidateCode(void) {
+    for(int page = 0; page < PAGE_COUNT; page++) {
+        if(mmu.code_page[page]) {
+            mmu.write_page[page] = mmu.code_page[page];
+            mmu.write_io[page] = ignoreWrite;
+            mmu.code_page[page] = NULL;
+        }
+        if(mmu.write_page[page]) {
+            mmu.code_epoch[page]++;
+        }
+    }
+    mmu.code_writes++;
 }
 
-uint16_t zero_page_Y(struct nesCPU * cpu) {
-    uint8_t rel_addr = readRAM(cpu->pc+1);
-    return (rel_addr + cpu->y) & 0xff;
+// The first cycle a read from here could give something different when nothing writes to it, for idle loops
+uint64_t stableUntil(uint16_t address) {
+    if(mmu.read_page[address >> 8]) {
+        return EVENT_NEVER;             // memory only changes when something writes it
+    }
+    if(address >= 0x2000 && address < 0x4000 && (address & 7) == 2) {
+        catchUpPPU(cpu.cycles);
+        return nextStatusChange();
+    }
+    return 0;                           // anything else might change on every read
 }
 
-uint16_t absolute_X(struct nesCPU * cpu) {
-    uint8_t low = readRAM(cpu->pc+1);
-    uint8_t high = readRAM(cpu->pc+2);
-    uint16_t address = (high << 8) | low;
-    pbc = (address & 0xff00) != ((address + cpu->x) & 0xff00);
-    return (address + cpu->x) & 0xffff;
+uint8_t readHandler(uint16_t address) {
+    return mmu.read_io[address >> 8](address);
 }
 
-uint16_t absolute_Y(struct nesCPU * cpu) {
-    uint8_t low = readRAM(cpu->pc+1);
-    uint8_t high = readRAM(cpu->pc+2);
-    uint16_t address = (high << 8) | low;
-    pbc = (address & 0xff00) != ((address + cpu->y) & 0xff00);
-    return (address + cpu->y) & 0xffff;
+void writeHandler(uint16_t address, uint8_t value) {
+    mmu.write_io[address >> 8](address, value);
 }
 
-uint16_t absolute(struct nesCPU * cpu) {
-    uint8_t low = readRAM(cpu->pc + 1);
-    uint8_t high = readRAM(cpu->pc + 2);
-    return (high << 8) | low;
+void setController(int port, uint8_t buttons) {
+    mmu.controller[port & 1] = buttons;
+    if(mmu.controller_strobe) {
+        mmu.controller_shift[port & 1] = buttons;
+    }
 }
 
-bool pageBoundaryCross(void) {
-    return pbc;
-}
\ No newline at end of file
+void init_mmu(void) {
+    mmu.cpu_mem = malloc(sizeof(uint8_t) * CPU_MEM_SIZE);
+    mmu.prg_ram = malloc(sizeof(uint8_t) * PRG_RAM_SIZE);
+    mmu.ppu_mem = malloc(sizeof(uint8_t) * PPU_MEM_SIZE);
+    mmu.oam = malloc(sizeof(uint8_t) * OAM_MEM_SIZE);
+    memset(mmu.cpu_mem, 0, CPU_MEM_SIZE);
+    memset(mmu.prg_ram, 0, PRG_RAM_SIZE);
+    memset(mmu.ppu_mem, 0, PPU_MEM_SIZE);
+    memset(mmu.oam, 0xff, OAM_MEM_SIZE);
+
+    mapIO(0x0000, 0xffff, NULL, NULL);                          // cartridge space stays open bus until a mapper claims it
+    mapMemory(0x0000, 0x1fff, mmu.cpu_mem, CPU_MEM_SIZE, true);  // 2 KB RAM mirrored 4 times
+    mapIO(0x2000, 0x3fff, readPPU, writePPU);                   // 8 PPU registers mirrored every 8 bytes
+    mapIO(0x4000, 0x40ff, readIO, writeIO);
+    mapMemory(0x6000, 0x7fff, mmu.prg_ram, PRG_RAM_SIZE, true);
+}
+
+void clean_mem(void) {
+    closeROM(&cart);
+    free(mmu.cpu_mem);
+    free(mmu.prg_ram);
+    free(mmu.ppu_mem);
+    free(mmu.oam);
+}
@@ -1,41 +1,170 @@
 #ifndef MMU_H
 #define MMU_H
 
+#include <stddef.h>
 #include <inttypes.h>
 #include "cpu.h"
 
+typedef enum { false, true } bool;
+
+typedef uint8_t (* read_handler)(uint16_t address);
+typedef void (* write_handler)(uint16_t address, uint8_t value);
+
+#define PAGE_COUNT 0x100        // CPU bus is split into 256 byte pages
+#define PPU_PAGE_COUNT 16       // PPU bus is split into 1 KB pages, $3000-$3FFF mirrors the nametables
+
+#define CPU_MEM_SIZE 0x800
+#define PRG_RAM_SIZE 0x2000
+#define PPU_MEM_SIZE 0x4000
+#define OAM_MEM_SIZE 256
+
+/*
+    Each page either points straight at its backing memory, or is NULL and goes through the I/O handler
+    for that page instead. RAM mirrors and bank switching are just several pages pointing at the same memory.
+    The 2 KB of RAM is always at $0000-$1FFF, so reads from there go straight to cpu_mem (see readRAM()).
+*/
 struct memory_map {
-    uint8_t * cpu_mem;
+    uint8_t * cpu_mem;      // 2 KB internal RAM
+    uint8_t * prg_ram;      // 8 KB cartridge RAM at $6000
     uint8_t * ppu_mem;
     uint8_t * oam;
-};
+    uint8_t * read_page[PAGE_COUNT];
+    uint8_t * write_page[PAGE_COUNT];
+    read_handler read_io[PAGE_COUNT];
+    write_handler write_io[PAGE_COUNT];
+    uint8_t * ppu_page[PPU_PAGE_COUNT];         // pattern tables and nametables as seen by the PPU
+    uint8_t * ppu_write_page[PPU_PAGE_COUNT];   // NULL for CHR-ROM
 
-extern struct memory_map mmu;
+    // Writable pages the CPU has cached code from have their writes trapped (see trapCode())
+    uint8_t * code_page[PAGE_COUNT];            // the real write pointer while a page is trapped
+    uint32_t code_writes;                       // goes up on every trapped write and every remapping
+    uint32_t code_epoch[PAGE_COUNT];            // goes up every time a page stops being trapped
+    // Controller ports, the buttons are the front end's, the rest is what the console remembers
+    uint8_t controller[2];
+    uint8_t controller_shift[2];                // bits still to be read out since the last strobe
+    uint8_t controller_strobe;
+};
 
-typedef enum { false, true } bool;
+extern NYMPH_TLS struct memory_map mmu;
 
-void loadROM(char * filename);
+int loadROM(char * filename);
 void init_mmu(void);
 void clean_mem(void);
-uint16_t indirect_X_index(struct nesCPU * cpu);
-uint16_t indirect_Y_index(struct nesCPU * cpu);
-uint16_t zero_page(struct nesCPU * cpu);
-uint16_t zero_page_X(struct nesCPU * cpu);
-uint16_t zero_page_Y(struct nesCPU * cpu);
-uint16_t absolute(struct nesCPU * cpu);
-uint16_t absolute_X(struct nesCPU * cpu);
-uint16_t absolute_Y(struct nesCPU * cpu);
-bool pageBoundaryCross(void);
+void mapMemory(uint16_t start, uint16_t end, uint8_t * mem, size_t size, bool writable);
+void mapIO(uint16_t start, uint16_t end, read_handler read, write_handler write);
+void trapCode(uint16_t address);
+void invalidateCode(void);
+uint64_t stableUntil(uint16_t address);
+void setController(int port, uint8_t buttons);
+COLD uint8_t readHandler(uint16_t address);
+COLD void writeHandler(uint16_t address, uint8_t value);
+
+// Direct pages are a table lookup and an index, anything else goes out of line so this stays small once inlined
+static ALWAYS_INLINE void writeRAM(uint16_t address, uint8_t value) {
+    uint8_t * page = mmu.write_page[address >> 8];
+    if(page) {
+        page[address & 0xff] = value;
+        return;
+    }
+    writeHandler(address, value);
+}
+
+/*
+    RAM doesn't need the page table at all, and that's code running from it, the zero page and the stack.
+    Those addresses are known to be under $2000 once this is inlined, so the check goes too. Writes still
+    go through the table, RAM pages with code cached from them trap their writes.
+*/
+static ALWAYS_INLINE uint8_t readRAM(uint16_t address) {
+    if(address < 0x2000) {
+        return mmu.cpu_mem[address & (CPU_MEM_SIZE - 1)];
+    }
+    uint8_t * page = mmu.read_page[address >> 8];
+    if(page) {
+        return page[address & 0xff];
+    }
+    return readHandler(address);
+}
+
+// PPU side, palettes at $3F00 are the PPU's own business and never get here
+static inline uint8_t readVRAM(uint16_t address) {
+    return mmu.ppu_page[(address >> 10) & 0xf][address & 0x3ff];
+}
+
+static inline void writeVRAM(uint16_t address, uint8_t value) {
+    uint8_t * page = mmu.ppu_write_page[(address >> 10) & 0xf];
+    if(page) {
+        page[address & 0x3ff] = value;
+    }
+}
+
+/*
+    Addressing modes
+
+    These all read their operand from right after the opcode at pc and return the effective address.
+    The indexed ones also report through crossed whether adding the index moved to another page,
+    which costs read instructions an extra cycle. Kept inline here so the dispatcher doesn't pay
+    a call per instruction and nothing is shared between CPUs.
+*/
 
+static ALWAYS_INLINE uint16_t zero_page(struct nesCPU * cpu) {
+    return readRAM(cpu->pc + 1);
+}
+
+static ALWAYS_INLINE uint16_t zero_page_X(struct nesCPU * cpu) {
+    uint8_t rel_addr = readRAM(cpu->pc + 1);
+    return (rel_addr + cpu->x) & 0xff;
+}
+
+static ALWAYS_INLINE uint16_t zero_page_Y(struct nesCPU * cpu) {
+    uint8_t rel_addr = readRAM(cpu->pc + 1);
+    return (rel_addr + cpu->y) & 0xff;
+}
+
+static ALWAYS_INLINE uint16_t absolute(struct nesCPU * cpu) {
+    uint8_t low = readRAM(cpu->pc + 1);
+    uint8_t high = readRAM(cpu->pc + 2);
+    return (high << 8) | low;
+}
+
+// The index part of abs,X abs,Y and (zp),Y on its own
+static ALWAYS_INLINE uint16_t indexed(uint16_t address, uint8_t index, uint8_t * crossed) {
+    uint16_t final_addr = address + index;
+    *crossed = (address ^ final_addr) >> 8 != 0;
+    return final_addr;
+}
 
+static ALWAYS_INLINE uint16_t absolute_X(struct nesCPU * cpu, uint8_t * crossed) {
+    return indexed(absolute(cpu), cpu->x, crossed);
+}
+
+static ALWAYS_INLINE uint16_t absolute_Y(struct nesCPU * cpu, uint8_t * crossed) {
+    return indexed(absolute(cpu), cpu->y, crossed);
+}
+
+// JMP ($xxff) fetches the high byte from $xx00 instead of crossing the page
+static ALWAYS_INLINE uint16_t indirect_at(uint16_t ind_addr) {
+    uint8_t low = readRAM(ind_addr);
+    uint8_t high = readRAM((ind_addr & 0xff00) | ((ind_addr + 1) & 0xff));
+    return (high << 8) | low;
+}
+
+static ALWAYS_INLINE uint16_t indirect(struct nesCPU * cpu) {
+    return indirect_at(absolute(cpu));
+}
+
+// The pointer stays in the zero page, ($ff,X) wraps round to $00 for the high byte
+static ALWAYS_INLINE uint16_t zero_page_pointer(uint8_t rel_addr) {
+    uint8_t low = readRAM(rel_addr);
+    uint8_t high = readRAM((rel_addr + 1) & 0xff);
+    return (high << 8) | low;
+}
 
-static inline void writeRAM(uint16_t address, uint8_t value) {
-    // Need to handle mirroring
-    mmu.cpu_mem[address] = value;
+static ALWAYS_INLINE uint16_t indirect_X_index(struct nesCPU * cpu) {
+    return zero_page_pointer(readRAM(cpu->pc + 1) + cpu->x);
 }
 
-static inline uint8_t readRAM(uint16_t address) {
-    return mmu.cpu_mem[address];
+static ALWAYS_INLINE uint16_t indirect_Y_index(struct nesCPU * cpu, uint8_t * crossed) {
+    return indexed(zero_page_pointer(readRAM(cpu->pc + 1)), cpu->y, crossed);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,98 @@
+#include "nes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+
+static NYMPH_TLS uint64_t events[EVENT_COUNT];
+static NYMPH_TLS event_handler handlers[EVENT_COUNT];
+static NYMPH_TLS uint64_t next_event = EVENT_NEVER;
+static NYMPH_TLS int next_type;
+
+static void findNextEvent(void) {
+    next_event = EVENT_NEVER;
+    for(int i = 0; i < EVENT_COUNT; i++) {
+        if(events[i] < next_event) {
+            next_event = events[i];
+            next_type = i;
+        }
+    }
+}
+
+void setEventHandler(int type, event_handler handler) {
+    handlers[type] = handler;
+}
+
+// An event sooner than where the CPU was told to stop pulls the stop in, so this works from inside an instruction too
+void scheduleEvent(int type, uint64_t when) {
+    events[type] = when;
+    findNextEvent();
+    if(when < cpu.run_until) {
+        cpu.run_until = when;
+    }
+}
+
+void cancelEvent(int type) {
+    events[type] = EVENT_NEVER;
+    findNextEvent();
+}
+
+uint64_t eventTime(int type) {
+    return events[type];
+}
+
+// Handlers may schedule more events, including ones that are already due, so keep going until none are
+static void fireEvents(void) {
+    while(next_event <= cpu.cycles) {
+        int type = next_type;
+        uint64_t when = next_event;
+        events[type] = EVENT_NEVER;
+        findNextEvent();
+        if(handlers[type]) {
+            handlers[type](when);
+        }
+    }
+}
+
+// Frames end as vblank starts, by then the picture is done
+static void endFrame(uint64_t when) {
+    catchUpPPU(cpu.cycles);
+    catchUpAPU(cpu.cycles);
+    scheduleEvent(EVENT_FRAME, nextVblank());
+}
+
+void initNES(void) {
+    for(int i = 0; i < EVENT_COUNT; i++) {
+        events[i] = EVENT_NEVER;
+    }
+    findNextEvent();
+    resetCPU(&cpu);
+    resetPPU();
+    resetAPU();
+    setEventHandler(EVENT_FRAME, endFrame);
+    scheduleEvent(EVENT_FRAME, nextVblank());
+}
+
+// Runs at least this many cycles, stopping at every event on the way
+void runCycles(int cycles) {
+    uint64_t target = cpu.cycles + cycles;
+    do {
+        uint64_t until = next_event < target ? next_event : target;
+        if(cpu.cycles < until) {
+            runCPU(&cpu, until - cpu.cycles);
+        }
+        fireEvents();
+    } while(cpu.cycles < target);
+    catchUpPPU(cpu.cycles);
+    catchUpAPU(cpu.cycles);
+}
+
+void runFrame(void) {
+    uint64_t frame = ppu.frame;
+    while(ppu.frame == frame) {
+        runCycles(events[EVENT_FRAME] - cpu.cycles);
+    }
+}
+
+uint64_t frameCount(void) {
+    return ppu.frame;
+}
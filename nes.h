@@ -0,0 +1,38 @@
+#ifndef NES_H
+#define NES_H
+
+#include <inttypes.h>
+
+/*
+    Scheduler
+
+    The CPU runs flat out for as many cycles as it can before the next thing that has to happen at a
+    known time, then the event fires and the PPU and APU catch up to the CPU clock. Everything is timed
+    in CPU cycles from cpu.cycles. Components own their events: they schedule them for when they need
+    to run again and get called back with the cycle the event was due at.
+*/
+enum event_type {
+    EVENT_FRAME,            // end of the frame, runFrame() returns after this
+    EVENT_VBLANK,           // vblank flag goes up, and the NMI line with it
+    EVENT_INTERRUPT,        // an NMI or IRQ waiting for the next instruction boundary
+    EVENT_MAPPER,           // a mapper's IRQ counter runs out
+    EVENT_SPRITE0,          // sprite 0 hit flag goes up
+    EVENT_APU_FRAME,        // APU frame counter step
+    EVENT_DMA,              // DMC sample fetch, OAM DMA is a plain stall charged in $4014
+    EVENT_COUNT
+};
+
+#define EVENT_NEVER UINT64_MAX
+
+typedef void (* event_handler)(uint64_t when);
+
+void initNES(void);
+void setEventHandler(int type, event_handler handler);
+void scheduleEvent(int type, uint64_t when);
+void cancelEvent(int type);
+uint64_t eventTime(int type);
+void runCycles(int cycles);
+void runFrame(void);
+uint64_t frameCount(void);
+
+#endif
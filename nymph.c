@@ -4,15 +4,16 @@
 #include <SDL2/SDL.h>
 #include "cpu.h"
 #include "mmu.h"
+#include "rom.h"
 #include "apu.h"
 #include "ppu.h"
 #include "io.h"
+#include "nes.h"
 
 #define W_RES 256
 #define H_RES 240
 #define SCREEN_NAME "Nymph NES"
-
-typedef enum { false, true } bool;
+#define NTSC_FPS 60.0988
 
 struct {
     bool running;
@@ -34,41 +35,48 @@ struct {
     }
 };
 
-SDL_Event event;
-
 char * test_rom = "nestest.nes";
 
-int lastcyc = 0;
-int ppus = 0;
+static struct audio_ring audio;      // filled here, emptied on SDL's audio thread
 
 int main(int argc, char * argv[]) {
     
-    loadROM(test_rom);
+    char * rom = (argc > 1) ? argv[1] : test_rom;
+    init_mmu();
+    int status = loadROM(rom);
+    if(status != ROM_OK) {
+        fprintf(stderr, "%s: %s\n", rom, romError(status));
+        return 1;
+    }
     
-    initPPU(test_rom);
-    resetCPU();
+    initPPU(rom);
     initAPU();
+    initNES();
+    int sound = openAudio(&audio);
+    if(!sound) {
+        fprintf(stderr, "no sound: %s\n", SDL_GetError());
+    }
 
+    // One whole frame at a time, the window only needs looking at between them
     for(;;) {
         if(Emu.running) {
-            lastcyc = stepCPU();
-            ppus = lastcyc * 3;
-            while(ppus--) {
-                stepPPU();
+            runFrame();
+            if(cpu.jammed) {
+                fprintf(stderr, "CPU jammed at $%04X\n", cpu.pc);
+                Emu.running = false;        // nothing more is going to happen until a reset
+            }
+            if(sound) {
+                pushAudio(&audio);
             }
-            stepAPU(lastcyc);
         }
 
-        handleWindowEvents(event);
+        handleWindowEvents();
+        waitFrame(NTSC_FPS);
     }
 
     return 1;
 }
 
-int getLastCyc(void) {
-    return lastcyc;
-}
-
 void togglePause(void) {
     Emu.running ^= 1;
 }
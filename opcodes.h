@@ -0,0 +1,276 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+
+/*
+    6502 opcode descriptor table (X-macro)
+
+    One row per opcode: X(opcode, mnemonic, handler, addressing mode, base cycles, page cross penalty, length)
+
+    -> handler is the helper in cpu.c that does the actual work
+    -> page cross penalty is the extra cycle taken by indexed reads when the index crosses a page
+    -> length is how far pc moves before the handler runs, so jumps/branches/returns just overwrite it
+    -> all eight branches share BRANCH, which works out its condition from the opcode
+    -> JAM halts the CPU until the next reset, see cpu.h
+
+    Every dispatch backend in cpu.c is generated from this table so it is the only place cycle counts live.
+*/
+
+#define OPCODE_TABLE(X) \
+    X(0x00, BRK, BRK,   IMPL,  7, 0, 1) \
+    X(0x01, ORA, ORA,   IND_X, 6, 0, 2) \
+    X(0x02, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x03, SLO, SLO,   IND_X, 8, 0, 2) \
+    X(0x04, NOP, IGN,   ZPG,   3, 0, 2) \
+    X(0x05, ORA, ORA,   ZPG,   3, 0, 2) \
+    X(0x06, ASL, ASL,   ZPG,   5, 0, 2) \
+    X(0x07, SLO, SLO,   ZPG,   5, 0, 2) \
+    X(0x08, PHP, PHP,   IMPL,  3, 0, 1) \
+    X(0x09, ORA, ORA,   IMM,   2, 0, 2) \
+    X(0x0A, ASL, ASL_A, ACC,   2, 0, 1) \
+    X(0x0B, ANC, ANC,   IMM,   2, 0, 2) \
+    X(0x0C, NOP, IGN,   ABS,   4, 0, 3) \
+    X(0x0D, ORA, ORA,   ABS,   4, 0, 3) \
+    X(0x0E, ASL, ASL,   ABS,   6, 0, 3) \
+    X(0x0F, SLO, SLO,   ABS,   6, 0, 3) \
+    X(0x10, BPL, BRANCH, REL,   2, 0, 2) \
+    X(0x11, ORA, ORA,   IND_Y, 5, 1, 2) \
+    X(0x12, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x13, SLO, SLO,   IND_Y, 8, 0, 2) \
+    X(0x14, NOP, IGN,   ZPG_X, 4, 0, 2) \
+    X(0x15, ORA, ORA,   ZPG_X, 4, 0, 2) \
+    X(0x16, ASL, ASL,   ZPG_X, 6, 0, 2) \
+    X(0x17, SLO, SLO,   ZPG_X, 6, 0, 2) \
+    X(0x18, CLC, CLC,   IMPL,  2, 0, 1) \
+    X(0x19, ORA, ORA,   ABS_Y, 4, 1, 3) \
+    X(0x1A, NOP, NOP,   IMPL,  2, 0, 1) \
+    X(0x1B, SLO, SLO,   ABS_Y, 7, 0, 3) \
+    X(0x1C, NOP, IGN,   ABS_X, 4, 1, 3) \
+    X(0x1D, ORA, ORA,   ABS_X, 4, 1, 3) \
+    X(0x1E, ASL, ASL,   ABS_X, 7, 0, 3) \
+    X(0x1F, SLO, SLO,   ABS_X, 7, 0, 3) \
+    X(0x20, JSR, JSR,   ABS,   6, 0, 3) \
+    X(0x21, AND, AND,   IND_X, 6, 0, 2) \
+    X(0x22, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x23, RLA, RLA,   IND_X, 8, 0, 2) \
+    X(0x24, BIT, BIT,   ZPG,   3, 0, 2) \
+    X(0x25, AND, AND,   ZPG,   3, 0, 2) \
+    X(0x26, ROL, ROL,   ZPG,   5, 0, 2) \
+    X(0x27, RLA, RLA,   ZPG,   5, 0, 2) \
+    X(0x28, PLP, PLP,   IMPL,  4, 0, 1) \
+    X(0x29, AND, AND,   IMM,   2, 0, 2) \
+    X(0x2A, ROL, ROL_A, ACC,   2, 0, 1) \
+    X(0x2B, ANC, ANC,   IMM,   2, 0, 2) \
+    X(0x2C, BIT, BIT,   ABS,   4, 0, 3) \
+    X(0x2D, AND, AND,   ABS,   4, 0, 3) \
+    X(0x2E, ROL, ROL,   ABS,   6, 0, 3) \
+    X(0x2F, RLA, RLA,   ABS,   6, 0, 3) \
+    X(0x30, BMI, BRANCH, REL,   2, 0, 2) \
+    X(0x31, AND, AND,   IND_Y, 5, 1, 2) \
+    X(0x32, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x33, RLA, RLA,   IND_Y, 8, 0, 2) \
+    X(0x34, NOP, IGN,   ZPG_X, 4, 0, 2) \
+    X(0x35, AND, AND,   ZPG_X, 4, 0, 2) \
+    X(0x36, ROL, ROL,   ZPG_X, 6, 0, 2) \
+    X(0x37, RLA, RLA,   ZPG_X, 6, 0, 2) \
+    X(0x38, SEC, SEC,   IMPL,  2, 0, 1) \
+    X(0x39, AND, AND,   ABS_Y, 4, 1, 3) \
+    X(0x3A, NOP, NOP,   IMPL,  2, 0, 1) \
+    X(0x3B, RLA, RLA,   ABS_Y, 7, 0, 3) \
+    X(0x3C, NOP, IGN,   ABS_X, 4, 1, 3) \
+    X(0x3D, AND, AND,   ABS_X, 4, 1, 3) \
+    X(0x3E, ROL, ROL,   ABS_X, 7, 0, 3) \
+    X(0x3F, RLA, RLA,   ABS_X, 7, 0, 3) \
+    X(0x40, RTI, RTI,   IMPL,  6, 0, 1) \
+    X(0x41, EOR, EOR,   IND_X, 6, 0, 2) \
+    X(0x42, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x43, SRE, SRE,   IND_X, 8, 0, 2) \
+    X(0x44, NOP, IGN,   ZPG,   3, 0, 2) \
+    X(0x45, EOR, EOR,   ZPG,   3, 0, 2) \
+    X(0x46, LSR, LSR,   ZPG,   5, 0, 2) \
+    X(0x47, SRE, SRE,   ZPG,   5, 0, 2) \
+    X(0x48, PHA, PHA,   IMPL,  3, 0, 1) \
+    X(0x49, EOR, EOR,   IMM,   2, 0, 2) \
+    X(0x4A, LSR, LSR_A, ACC,   2, 0, 1) \
+    X(0x4B, ALR, ALR,   IMM,   2, 0, 2) \
+    X(0x4C, JMP, JMP,   ABS,   3, 0, 3) \
+    X(0x4D, EOR, EOR,   ABS,   4, 0, 3) \
+    X(0x4E, LSR, LSR,   ABS,   6, 0, 3) \
+    X(0x4F, SRE, SRE,   ABS,   6, 0, 3) \
+    X(0x50, BVC, BRANCH, REL,   2, 0, 2) \
+    X(0x51, EOR, EOR,   IND_Y, 5, 1, 2) \
+    X(0x52, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x53, SRE, SRE,   IND_Y, 8, 0, 2) \
+    X(0x54, NOP, IGN,   ZPG_X, 4, 0, 2) \
+    X(0x55, EOR, EOR,   ZPG_X, 4, 0, 2) \
+    X(0x56, LSR, LSR,   ZPG_X, 6, 0, 2) \
+    X(0x57, SRE, SRE,   ZPG_X, 6, 0, 2) \
+    X(0x58, CLI, CLI,   IMPL,  2, 0, 1) \
+    X(0x59, EOR, EOR,   ABS_Y, 4, 1, 3) \
+    X(0x5A, NOP, NOP,   IMPL,  2, 0, 1) \
+    X(0x5B, SRE, SRE,   ABS_Y, 7, 0, 3) \
+    X(0x5C, NOP, IGN,   ABS_X, 4, 1, 3) \
+    X(0x5D, EOR, EOR,   ABS_X, 4, 1, 3) \
+    X(0x5E, LSR, LSR,   ABS_X, 7, 0, 3) \
+    X(0x5F, SRE, SRE,   ABS_X, 7, 0, 3) \
+    X(0x60, RTS, RTS,   IMPL,  6, 0, 1) \
+    X(0x61, ADC, ADC,   IND_X, 6, 0, 2) \
+    X(0x62, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x63, RRA, RRA,   IND_X, 8, 0, 2) \
+    X(0x64, NOP, IGN,   ZPG,   3, 0, 2) \
+    X(0x65, ADC, ADC,   ZPG,   3, 0, 2) \
+    X(0x66, ROR, ROR,   ZPG,   5, 0, 2) \
+    X(0x67, RRA, RRA,   ZPG,   5, 0, 2) \
+    X(0x68, PLA, PLA,   IMPL,  4, 0, 1) \
+    X(0x69, ADC, ADC,   IMM,   2, 0, 2) \
+    X(0x6A, ROR, ROR_A, ACC,   2, 0, 1) \
+    X(0x6B, ARR, ARR,   IMM,   2, 0, 2) \
+    X(0x6C, JMP, JMP,   IND,   5, 0, 3) \
+    X(0x6D, ADC, ADC,   ABS,   4, 0, 3) \
+    X(0x6E, ROR, ROR,   ABS,   6, 0, 3) \
+    X(0x6F, RRA, RRA,   ABS,   6, 0, 3) \
+    X(0x70, BVS, BRANCH, REL,   2, 0, 2) \
+    X(0x71, ADC, ADC,   IND_Y, 5, 1, 2) \
+    X(0x72, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x73, RRA, RRA,   IND_Y, 8, 0, 2) \
+    X(0x74, NOP, IGN,   ZPG_X, 4, 0, 2) \
+    X(0x75, ADC, ADC,   ZPG_X, 4, 0, 2) \
+    X(0x76, ROR, ROR,   ZPG_X, 6, 0, 2) \
+    X(0x77, RRA, RRA,   ZPG_X, 6, 0, 2) \
+    X(0x78, SEI, SEI,   IMPL,  2, 0, 1) \
+    X(0x79, ADC, ADC,   ABS_Y, 4, 1, 3) \
+    X(0x7A, NOP, NOP,   IMPL,  2, 0, 1) \
+    X(0x7B, RRA, RRA,   ABS_Y, 7, 0, 3) \
+    X(0x7C, NOP, IGN,   ABS_X, 4, 1, 3) \
+    X(0x7D, ADC, ADC,   ABS_X, 4, 1, 3) \
+    X(0x7E, ROR, ROR,   ABS_X, 7, 0, 3) \
+    X(0x7F, RRA, RRA,   ABS_X, 7, 0, 3) \
+    X(0x80, NOP, IGN,   IMM,   2, 0, 2) \
+    X(0x81, STA, STA,   IND_X, 6, 0, 2) \
+    X(0x82, NOP, IGN,   IMM,   2, 0, 2) \
+    X(0x83, SAX, SAX,   IND_X, 6, 0, 2) \
+    X(0x84, STY, STY,   ZPG,   3, 0, 2) \
+    X(0x85, STA, STA,   ZPG,   3, 0, 2) \
+    X(0x86, STX, STX,   ZPG,   3, 0, 2) \
+    X(0x87, SAX, SAX,   ZPG,   3, 0, 2) \
+    X(0x88, DEY, DEY,   IMPL,  2, 0, 1) \
+    X(0x89, NOP, IGN,   IMM,   2, 0, 2) \
+    X(0x8A, TXA, TXA,   IMPL,  2, 0, 1) \
+    X(0x8B, ANE, ANE,   IMM,   2, 0, 2) \
+    X(0x8C, STY, STY,   ABS,   4, 0, 3) \
+    X(0x8D, STA, STA,   ABS,   4, 0, 3) \
+    X(0x8E, STX, STX,   ABS,   4, 0, 3) \
+    X(0x8F, SAX, SAX,   ABS,   4, 0, 3) \
+    X(0x90, BCC, BRANCH, REL,   2, 0, 2) \
+    X(0x91, STA, STA,   IND_Y, 6, 0, 2) \
+    X(0x92, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0x93, SHA, SHA,   IND_Y, 6, 0, 2) \
+    X(0x94, STY, STY,   ZPG_X, 4, 0, 2) \
+    X(0x95, STA, STA,   ZPG_X, 4, 0, 2) \
+    X(0x96, STX, STX,   ZPG_Y, 4, 0, 2) \
+    X(0x97, SAX, SAX,   ZPG_Y, 4, 0, 2) \
+    X(0x98, TYA, TYA,   IMPL,  2, 0, 1) \
+    X(0x99, STA, STA,   ABS_Y, 5, 0, 3) \
+    X(0x9A, TXS, TXS,   IMPL,  2, 0, 1) \
+    X(0x9B, TAS, TAS,   ABS_Y, 5, 0, 3) \
+    X(0x9C, SHY, SHY,   ABS_X, 5, 0, 3) \
+    X(0x9D, STA, STA,   ABS_X, 5, 0, 3) \
+    X(0x9E, SHX, SHX,   ABS_Y, 5, 0, 3) \
+    X(0x9F, SHA, SHA,   ABS_Y, 5, 0, 3) \
+    X(0xA0, LDY, LDY,   IMM,   2, 0, 2) \
+    X(0xA1, LDA, LDA,   IND_X, 6, 0, 2) \
+    X(0xA2, LDX, LDX,   IMM,   2, 0, 2) \
+    X(0xA3, LAX, LAX,   IND_X, 6, 0, 2) \
+    X(0xA4, LDY, LDY,   ZPG,   3, 0, 2) \
+    X(0xA5, LDA, LDA,   ZPG,   3, 0, 2) \
+    X(0xA6, LDX, LDX,   ZPG,   3, 0, 2) \
+    X(0xA7, LAX, LAX,   ZPG,   3, 0, 2) \
+    X(0xA8, TAY, TAY,   IMPL,  2, 0, 1) \
+    X(0xA9, LDA, LDA,   IMM,   2, 0, 2) \
+    X(0xAA, TAX, TAX,   IMPL,  2, 0, 1) \
+    X(0xAB, LXA, LXA,   IMM,   2, 0, 2) \
+    X(0xAC, LDY, LDY,   ABS,   4, 0, 3) \
+    X(0xAD, LDA, LDA,   ABS,   4, 0, 3) \
+    X(0xAE, LDX, LDX,   ABS,   4, 0, 3) \
+    X(0xAF, LAX, LAX,   ABS,   4, 0, 3) \
+    X(0xB0, BCS, BRANCH, REL,   2, 0, 2) \
+    X(0xB1, LDA, LDA,   IND_Y, 5, 1, 2) \
+    X(0xB2, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0xB3, LAX, LAX,   IND_Y, 5, 1, 2) \
+    X(0xB4, LDY, LDY,   ZPG_X, 4, 0, 2) \
+    X(0xB5, LDA, LDA,   ZPG_X, 4, 0, 2) \
+    X(0xB6, LDX, LDX,   ZPG_Y, 4, 0, 2) \
+    X(0xB7, LAX, LAX,   ZPG_Y, 4, 0, 2) \
+    X(0xB8, CLV, CLV,   IMPL,  2, 0, 1) \
+    X(0xB9, LDA, LDA,   ABS_Y, 4, 1, 3) \
+    X(0xBA, TSX, TSX,   IMPL,  2, 0, 1) \
+    X(0xBB, LAS, LAS,   ABS_Y, 4, 1, 3) \
+    X(0xBC, LDY, LDY,   ABS_X, 4, 1, 3) \
+    X(0xBD, LDA, LDA,   ABS_X, 4, 1, 3) \
+    X(0xBE, LDX, LDX,   ABS_Y, 4, 1, 3) \
+    X(0xBF, LAX, LAX,   ABS_Y, 4, 1, 3) \
+    X(0xC0, CPY, CPY,   IMM,   2, 0, 2) \
+    X(0xC1, CMP, CMP,   IND_X, 6, 0, 2) \
+    X(0xC2, NOP, IGN,   IMM,   2, 0, 2) \
+    X(0xC3, DCP, DCP,   IND_X, 8, 0, 2) \
+    X(0xC4, CPY, CPY,   ZPG,   3, 0, 2) \
+    X(0xC5, CMP, CMP,   ZPG,   3, 0, 2) \
+    X(0xC6, DEC, DEC,   ZPG,   5, 0, 2) \
+    X(0xC7, DCP, DCP,   ZPG,   5, 0, 2) \
+    X(0xC8, INY, INY,   IMPL,  2, 0, 1) \
+    X(0xC9, CMP, CMP,   IMM,   2, 0, 2) \
+    X(0xCA, DEX, DEX,   IMPL,  2, 0, 1) \
+    X(0xCB, SBX, SBX,   IMM,   2, 0, 2) \
+    X(0xCC, CPY, CPY,   ABS,   4, 0, 3) \
+    X(0xCD, CMP, CMP,   ABS,   4, 0, 3) \
+    X(0xCE, DEC, DEC,   ABS,   6, 0, 3) \
+    X(0xCF, DCP, DCP,   ABS,   6, 0, 3) \
+    X(0xD0, BNE, BRANCH, REL,   2, 0, 2) \
+    X(0xD1, CMP, CMP,   IND_Y, 5, 1, 2) \
+    X(0xD2, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0xD3, DCP, DCP,   IND_Y, 8, 0, 2) \
+    X(0xD4, NOP, IGN,   ZPG_X, 4, 0, 2) \
+    X(0xD5, CMP, CMP,   ZPG_X, 4, 0, 2) \
+    X(0xD6, DEC, DEC,   ZPG_X, 6, 0, 2) \
+    X(0xD7, DCP, DCP,   ZPG_X, 6, 0, 2) \
+    X(0xD8, CLD, CLD,   IMPL,  2, 0, 1) \
+    X(0xD9, CMP, CMP,   ABS_Y, 4, 1, 3) \
+    X(0xDA, NOP, NOP,   IMPL,  2, 0, 1) \
+    X(0xDB, DCP, DCP,   ABS_Y, 7, 0, 3) \
+    X(0xDC, NOP, IGN,   ABS_X, 4, 1, 3) \
+    X(0xDD, CMP, CMP,   ABS_X, 4, 1, 3) \
+    X(0xDE, DEC, DEC,   ABS_X, 7, 0, 3) \
+    X(0xDF, DCP, DCP,   ABS_X, 7, 0, 3) \
+    X(0xE0, CPX, CPX,   IMM,   2, 0, 2) \
+    X(0xE1, SBC, SBC,   IND_X, 6, 0, 2) \
+    X(0xE2, NOP, IGN,   IMM,   2, 0, 2) \
+    X(0xE3, ISC, ISC,   IND_X, 8, 0, 2) \
+    X(0xE4, CPX, CPX,   ZPG,   3, 0, 2) \
+    X(0xE5, SBC, SBC,   ZPG,   3, 0, 2) \
+    X(0xE6, INC, INC,   ZPG,   5, 0, 2) \
+    X(0xE7, ISC, ISC,   ZPG,   5, 0, 2) \
+    X(0xE8, INX, INX,   IMPL,  2, 0, 1) \
+    X(0xE9, SBC, SBC,   IMM,   2, 0, 2) \
+    X(0xEA, NOP, NOP,   IMPL,  2, 0, 1) \
+    X(0xEB, USBC, USBC,  IMM,   2, 0, 2) \
+    X(0xEC, CPX, CPX,   ABS,   4, 0, 3) \
+    X(0xED, SBC, SBC,   ABS,   4, 0, 3) \
+    X(0xEE, INC, INC,   ABS,   6, 0, 3) \
+    X(0xEF, ISC, ISC,   ABS,   6, 0, 3) \
+    X(0xF0, BEQ, BRANCH, REL,   2, 0, 2) \
+    X(0xF1, SBC, SBC,   IND_Y, 5, 1, 2) \
+    X(0xF2, JAM, JAM,   IMPL,  2, 0, 1) \
+    X(0xF3, ISC, ISC,   IND_Y, 8, 0, 2) \
+    X(0xF4, NOP, IGN,   ZPG_X, 4, 0, 2) \
+    X(0xF5, SBC, SBC,   ZPG_X, 4, 0, 2) \
+    X(0xF6, INC, INC,   ZPG_X, 6, 0, 2) \
+    X(0xF7, ISC, ISC,   ZPG_X, 6, 0, 2) \
+    X(0xF8, SED, SED,   IMPL,  2, 0, 1) \
+    X(0xF9, SBC, SBC,   ABS_Y, 4, 1, 3) \
+    X(0xFA, NOP, NOP,   IMPL,  2, 0, 1) \
+    X(0xFB, ISC, ISC,   ABS_Y, 7, 0, 3) \
+    X(0xFC, NOP, IGN,   ABS_X, 4, 1, 3) \
+    X(0xFD, SBC, SBC,   ABS_X, 4, 1, 3) \
+    X(0xFE, INC, INC,   ABS_X, 7, 0, 3) \
+    X(0xFF, ISC, ISC,   ABS_X, 7, 0, 3)
+
+#endif
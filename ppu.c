@@ -1,5 +1,593 @@
+#include <string.h>
 #include "ppu.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "nes.h"
+#include "mapper.h"
+#include "render.h"
+
+struct nymphPPU ppu;
+
+// 2C02 colours as ARGB
+static const uint32_t nes_palette[64] = {
+    0xff666666, 0xff002a88, 0xff1412a7, 0xff3b00a4, 0xff5c007e, 0xff6e0040, 0xff6c0600, 0xff561d00,
+    0xff333500, 0xff0b4800, 0xff005200, 0xff004f08, 0xff00404d, 0xff000000, 0xff000000, 0xff000000,
+    0xffadadad, 0xff155fd9, 0xff4240ff, 0xff7527fe, 0xffa01acc, 0xffb71e7b, 0xffb53120, 0xff994e00,
+    0xff6b6d00, 0xff388700, 0xff0c9300, 0xff008f32, 0xff007c8d, 0xff000000, 0xff000000, 0xff000000,
+    0xfffffeff, 0xff64b0ff, 0xff9290ff, 0xffc676ff, 0xfff36aff, 0xfffe6ecc, 0xfffe8170, 0xffea9e22,
+    0xffbcbe00, 0xff88d800, 0xff5ce430, 0xff45e082, 0xff48cdde, 0xff4f4f4f, 0xff000000, 0xff000000,
+    0xfffffeff, 0xffc0dfff, 0xffd3d2ff, 0xffe8c8ff, 0xfffbc2ff, 0xfffec4ea, 0xfffeccc5, 0xfff7d8a5,
+    0xffe4e594, 0xffcfef96, 0xffbdf4ab, 0xffb3f3cc, 0xffb5ebf2, 0xffb8b8b8, 0xff000000, 0xff000000,
+};
+
+static int rendering(void) {
+    return ppu.mask & (MASK_BG | MASK_SPRITES);
+}
+
+// The NMI output is just the vblank flag gated by $2000 bit 7, the CPU watches for it going up
+static void updateNMI(void) {
+    setNMI(&cpu, (ppu.status & STATUS_VBLANK) && (ppu.ctrl & CTRL_NMI));
+}
+
+// $3F10/$3F14/$3F18/$3F1C are the same bytes as $3F00/$3F04/$3F08/$3F0C
+static int paletteIndex(uint16_t address) {
+    int index = address & 0x1f;
+    if((index & 0x13) == 0x10) {
+        index &= ~0x10;
+    }
+    return index;
+}
+
+static void incrementV(void) {
+    ppu.v = (ppu.v + ((ppu.ctrl & CTRL_INCREMENT_32) ? 32 : 1)) & 0x7fff;
+}
+
+/*
+    Scrolling
+    v is laid out as 0yyy NNYY YYYX XXXX: fine Y, nametable, coarse Y, coarse X.
+*/
+static void incrementX(uint16_t * v) {
+    if((*v & 0x001f) == 31) {
+        *v &= ~0x001f;
+        *v ^= 0x0400;               // wrap into the next nametable across
+    } else {
+        *v += 1;
+    }
+}
+
+static void incrementY(void) {
+    if((ppu.v & 0x7000) != 0x7000) {
+        ppu.v += 0x1000;
+        return;
+    }
+    ppu.v &= ~0x7000;
+    int y = (ppu.v & 0x03e0) >> 5;
+    if(y == 29) {
+        y = 0;
+        ppu.v ^= 0x0800;            // wrap into the next nametable down
+    } else if(y == 31) {
+        y = 0;                      // out of bounds rows wrap without switching tables
+    } else {
+        y++;
+    }
+    ppu.v = (ppu.v & ~0x03e0) | (y << 5);
+}
+
+/*
+    Tile cache
+    Both pattern tables decoded into pixel values ahead of time, plus a mirrored copy of every tile for
+    sprites flipped horizontally. A tile gets decoded the first time it's drawn and stays until the
+    CHR under it changes, which is a $2007 write to CHR-RAM or the mapper swapping its 1 KB slot.
+*/
+static struct {
+    uint8_t pixels[512][64];
+    uint8_t flipped[512][64];
+    uint8_t valid[512];
+} tiles;
+
+void invalidateTiles(int first, int count) {
+    memset(&tiles.valid[first], 0, count);
+}
+
+static void decodeTile(int tile) {
+    const uint8_t * data = &mmu.ppu_page[tile >> 6][(tile & 63) * 16];     // never straddles a 1 KB page
+    uint8_t * pixels = tiles.pixels[tile];
+    uint8_t * flipped = tiles.flipped[tile];
+    decodeRows(data, data + 8, pixels, 8);
+    for(int row = 0; row < 64; row += 8) {
+        for(int i = 0; i < 8; i++) {
+            flipped[row + i] = pixels[row + 7 - i];
+        }
+    }
+    tiles.valid[tile] = 1;
+}
+
+// The 8 pixels of a tile row, from the pattern table address of its low plane byte
+static const uint8_t * tileRow(uint16_t address, int flip) {
+    int tile = (address >> 4) & 0x1ff;
+    if(!tiles.valid[tile]) {
+        decodeTile(tile);
+    }
+    return (flip ? tiles.flipped[tile] : tiles.pixels[tile]) + (address & 7) * 8;
+}
+
+// Palette index for each pixel of the background on the line v points at, 0 where it's see through
+static void backgroundLine(uint8_t * line) {
+    uint16_t v = ppu.v;
+    uint16_t table = (ppu.ctrl & CTRL_BG_TABLE) ? 0x1000 : 0;
+    uint8_t palette[33];
+    uint8_t pixels[33 * 8];
+    for(int tile = 0; tile < 33; tile++) {     // 33 so fine X can scroll part of one more tile in
+        uint8_t index = readVRAM(0x2000 | (v & 0x0fff));
+        uint8_t attribute = readVRAM(0x23c0 | (v & 0x0c00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+        palette[tile] = ((attribute >> (((v >> 4) & 4) | (v & 2))) & 3) << 2;
+        memcpy(pixels + tile * 8, tileRow(table + index * 16 + (v >> 12), 0), 8);
+        incrementX(&v);
+    }
+    for(int x = 0; x < SCREEN_WIDTH; x++) {
+        uint8_t pixel = pixels[x + ppu.x];
+        line[x] = pixel ? palette[(x + ppu.x) >> 3] | pixel : 0;
+    }
+}
+
+static int spriteHeight(void) {
+    return (ppu.ctrl & CTRL_SPRITE_16) ? 16 : 8;
+}
+
+// OAM Y is one less than the first line a sprite shows on
+static int spriteRowOn(int sprite, int line) {
+    return line - mmu.oam[sprite * 4] - 1;
+}
+
+static void spriteRow(int sprite, int line, uint8_t * out) {
+    uint8_t * s = &mmu.oam[sprite * 4];
+    int row = spriteRowOn(sprite, line);
+    uint16_t address;
+    if(ppu.ctrl & CTRL_SPRITE_16) {
+        if(s[2] & 0x80) {
+            row = 15 - row;
+        }
+        address = ((s[1] & 1) << 12) | ((s[1] & 0xfe) << 4) | ((row & 8) << 1) | (row & 7);
+    } else {
+        if(s[2] & 0x80) {
+            row = 7 - row;
+        }
+        address = ((ppu.ctrl & CTRL_SPRITE_TABLE) << 9) | (s[1] << 4) | row;
+    }
+    memcpy(out, tileRow(address, s[2] & 0x40), 8);
+}
+
+// The first eight sprites on the line in OAM order, a ninth sets the overflow flag
+static int spritesOnLine(int line, uint8_t * found) {
+    int height = spriteHeight();
+    int count = 0;
+    for(int i = 0; i < 64; i++) {
+        int row = spriteRowOn(i, line);
+        if(row >= 0 && row < height) {
+            if(count == 8) {
+                ppu.status |= STATUS_OVERFLOW;
+                break;
+            }
+            found[count++] = i;
+        }
+    }
+    return count;
+}
+
+static void renderLine(int line) {
+    uint8_t bg[SCREEN_WIDTH];
+    uint8_t colour[SCREEN_WIDTH];
+    memset(bg, 0, sizeof(bg));
+    if(ppu.mask & MASK_BG) {
+        backgroundLine(bg);
+        if(!(ppu.mask & MASK_BG_LEFT)) {
+            memset(bg, 0, 8);
+        }
+    }
+    memcpy(colour, bg, sizeof(colour));
+
+    if(ppu.mask & MASK_SPRITES) {
+        // Front to back, a lower sprite owns its pixels even when it's behind the background
+        uint8_t found[8];
+        uint8_t taken[SCREEN_WIDTH];
+        memset(taken, 0, sizeof(taken));
+        int count = spritesOnLine(line, found);
+        for(int i = 0; i < count; i++) {
+            uint8_t * s = &mmu.oam[found[i] * 4];
+            uint8_t pixels[8];
+            spriteRow(found[i], line, pixels);
+            for(int j = 0; j < 8; j++) {
+                int x = s[3] + j;
+                if(x >= SCREEN_WIDTH || !pixels[j] || taken[x]) {
+                    continue;
+                }
+                if(x < 8 && !(ppu.mask & MASK_SPRITE_LEFT)) {
+                    continue;
+                }
+                taken[x] = 1;
+                if(!((s[2] & 0x20) && bg[x])) {
+                    colour[x] = 0x10 | ((s[2] & 3) << 2) | pixels[j];
+                }
+            }
+        }
+    }
+
+    // What each of the 32 palette entries shows as right now, then the whole line goes through that
+    uint8_t gray = (ppu.mask & MASK_GRAYSCALE) ? 0x30 : 0x3f;
+    uint32_t colours[32];
+    for(int i = 0; i < 32; i++) {
+        colours[i] = nes_palette[ppu.palettes[i] & gray];
+    }
+    lookupColours(colour, colours, &ppu.framebuffer[line * SCREEN_WIDTH], SCREEN_WIDTH);
+}
+
+/*
+    Sprite 0 hit
+    Worked out when a line starts rather than when it gets rendered, so a game polling $2002 sees the
+    flag go up on the right dot instead of at the end of the line.
+*/
+static void findSprite0(int line) {
+    ppu.sprite0_dot = -1;
+    if((ppu.mask & (MASK_BG | MASK_SPRITES)) != (MASK_BG | MASK_SPRITES) || (ppu.status & STATUS_SPRITE0)) {
+        return;
+    }
+    int row = spriteRowOn(0, line);
+    if(row < 0 || row >= spriteHeight()) {
+        return;
+    }
+    uint8_t bg[SCREEN_WIDTH];
+    uint8_t pixels[8];
+    backgroundLine(bg);
+    spriteRow(0, line, pixels);
+    int clipped = (ppu.mask & (MASK_BG_LEFT | MASK_SPRITE_LEFT)) != (MASK_BG_LEFT | MASK_SPRITE_LEFT);
+    for(int j = 0; j < 8; j++) {
+        int x = mmu.oam[3] + j;
+        if(x == 255) {              // never hits on the last pixel
+            break;
+        }
+        if(x < 8 && clipped) {
+            continue;
+        }
+        if(pixels[j] && bg[x]) {
+            ppu.sprite0_dot = x + 1;
+            return;
+        }
+    }
+}
+
+// Dots from where the PPU is now to the next time it gets to line, dot, assuming rendering stays how it is now
+static int dotsUntil(int line, int dot) {
+    int position = ppu.line * DOTS_PER_LINE + ppu.dot;
+    int dots = line * DOTS_PER_LINE + dot - position;
+    if(dots <= 0) {
+        dots += LINES_PER_FRAME * DOTS_PER_LINE;
+        if(!ppu.odd && rendering()) {
+            dots--;
+        }
+    }
+    return dots;
+}
+
+/*
+    Dots from here to the earliest sprite 0 could hit in what's left of this frame, -1 if it can't. That's
+    the dot worked out for this line if it's still to come, otherwise the first dot under the sprite on
+    the next line it covers, since the background there isn't known until the line starts.
+*/
+static int sprite0Dots(void) {
+    if((ppu.mask & (MASK_BG | MASK_SPRITES)) != (MASK_BG | MASK_SPRITES) || (ppu.status & STATUS_SPRITE0)) {
+        return -1;
+    }
+    if(ppu.line < SCREEN_HEIGHT && ppu.sprite0_dot > ppu.dot) {
+        return ppu.sprite0_dot - ppu.dot;
+    }
+    int top = mmu.oam[0] + 1;
+    int line = ppu.line < SCREEN_HEIGHT ? ppu.line + 1 : 0;
+    line = line > top ? line : top;
+    if(line >= SCREEN_HEIGHT || line >= top + spriteHeight() || mmu.oam[3] == 255) {
+        return -1;
+    }
+    return dotsUntil(line, mmu.oam[3] + 1);
+}
+
+/*
+    Wake up when sprite 0 can next hit, so nothing that skips ahead to the next event jumps over it. It
+    goes again from each wake up until it's hit or run out of lines, and anything that changes where
+    sprite 0 is or whether it can show at all has to call this after catching up.
+*/
+void scheduleSprite0(void) {
+    int dots = sprite0Dots();
+    if(dots < 0) {
+        cancelEvent(EVENT_SPRITE0);
+        return;
+    }
+    scheduleEvent(EVENT_SPRITE0, (ppu.clock + dots + 2) / 3);
+}
+
+/*
+    Timing
+    A line only needs stopping on at the dots below, everything between them is skipped over in one go.
+    256 renders the line and steps Y, 257 copies X back from t, 260 is roughly where MMC3 sees A12 rise
+    and 280 copies Y from t on the pre-render line.
+*/
+static int nextPoint(void) {
+    static const int visible[] = { 256, 257, 260, DOTS_PER_LINE };
+    static const int vblank[] = { 1, DOTS_PER_LINE };
+    static const int prerender[] = { 1, 256, 257, 260, 280, DOTS_PER_LINE };
+    static const int idle[] = { DOTS_PER_LINE };
+    const int * points = idle;
+    if(ppu.line < SCREEN_HEIGHT) {
+        points = visible;
+    } else if(ppu.line == VBLANK_LINE) {
+        points = vblank;
+    } else if(ppu.line == PRERENDER_LINE) {
+        points = prerender;
+    }
+    while(*points <= ppu.dot) {
+        points++;
+    }
+    if(ppu.sprite0_dot > ppu.dot && ppu.sprite0_dot < *points) {
+        return ppu.sprite0_dot;
+    }
+    return *points;
+}
+
+static void startLine(void) {
+    ppu.dot = 0;
+    ppu.sprite0_dot = -1;
+    if(++ppu.line == LINES_PER_FRAME) {
+        ppu.line = 0;
+        ppu.odd ^= 1;
+        if(ppu.odd && rendering()) {
+            ppu.dot = 1;            // odd frames skip the idle dot at the start
+        }
+    }
+    if(ppu.line < SCREEN_HEIGHT) {
+        findSprite0(ppu.line);
+    }
+}
+
+static void runDot(int dot) {
+    if(dot == ppu.sprite0_dot) {
+        ppu.status |= STATUS_SPRITE0;
+    }
+    if(ppu.line == VBLANK_LINE) {
+        ppu.status |= STATUS_VBLANK;
+        ppu.frame++;
+        updateNMI();
+        return;
+    }
+    if(ppu.line == PRERENDER_LINE && dot == 1) {
+        ppu.status &= ~(STATUS_VBLANK | STATUS_SPRITE0 | STATUS_OVERFLOW);
+        updateNMI();
+        scheduleSprite0();
+        return;
+    }
+    if(ppu.line < SCREEN_HEIGHT && dot == 256) {
+        renderLine(ppu.line);
+    }
+    if(!rendering()) {
+        return;
+    }
+    switch(dot) {
+        case 256:
+            incrementY();
+            break;
+        case 257:
+            ppu.v = (ppu.v & ~0x041f) | (ppu.t & 0x041f);
+            break;
+        case 260:
+            if(mapper && mapper->scanline) {
+                mapper->scanline();
+            }
+            break;
+        case 280:
+            ppu.v = (ppu.v & ~0x7be0) | (ppu.t & 0x7be0);
+            break;
+    }
+}
+
+void catchUpPPU(uint64_t cycle) {
+    uint64_t target = cycle * 3;
+    while(ppu.clock < target) {
+        int next = nextPoint();
+        uint64_t when = ppu.clock + (next - ppu.dot);
+        if(when > target) {
+            ppu.dot += target - ppu.clock;
+            ppu.clock = target;
+            return;
+        }
+        ppu.clock = when;
+        if(next == DOTS_PER_LINE) {
+            startLine();
+        } else {
+            ppu.dot = next;
+            runDot(next);
+        }
+    }
+}
+
+// CPU cycle the next vblank starts on
+uint64_t nextVblank(void) {
+    return (ppu.clock + dotsUntil(VBLANK_LINE, 1) + 2) / 3;
+}
+
+/*
+    CPU cycle of the next time $2002 might read differently without anyone touching the PPU, for idle
+    loop skipping. Vblank going up, the pre-render line clearing all the flags, the first dot sprite 0
+    could hit on whatever lines of it are left, and sprite overflow can go up on any line that gets drawn.
+*/
+uint64_t nextStatusChange(void) {
+    int dots = dotsUntil(VBLANK_LINE, 1);
+    int cleared = dotsUntil(PRERENDER_LINE, 1);
+    dots = cleared < dots ? cleared : dots;
+    int hit = sprite0Dots();
+    if(hit >= 0 && hit < dots) {
+        dots = hit;
+    }
+    if(rendering() && !(ppu.status & STATUS_OVERFLOW)) {
+        int line = ppu.dot < 256 ? ppu.line : ppu.line + 1;
+        int drawn = dotsUntil(line < SCREEN_HEIGHT ? line : 0, 256);
+        dots = drawn < dots ? drawn : dots;
+    }
+    return (ppu.clock + dots) / 3;
+}
+
+// CPU cycle the mapper's scanline() gets called for the nth time from now, counting on rendering staying on
+uint64_t nextScanlineClock(int n) {
+    if(!rendering() || n <= 0) {
+        return EVENT_NEVER;
+    }
+    int line = ppu.line;
+    int odd = ppu.odd;
+    int64_t dots = 260 - ppu.dot;       // to dot 260 on this line, which has already gone if it's not positive
+    for(;;) {
+        if(dots > 0 && (line < SCREEN_HEIGHT || line == PRERENDER_LINE) && --n == 0) {
+            return (ppu.clock + dots + 2) / 3;
+        }
+        dots += DOTS_PER_LINE;
+        if(++line == LINES_PER_FRAME) {
+            line = 0;
+            odd ^= 1;
+            if(odd) {
+                dots--;
+            }
+        }
+    }
+}
+
+// Catching up sets the flag and raises the NMI line, the CPU takes it at the next instruction boundary
+static void vblankEvent(uint64_t when) {
+    catchUpPPU(cpu.cycles);
+    scheduleEvent(EVENT_VBLANK, nextVblank());
+}
+
+static void sprite0Event(uint64_t when) {
+    catchUpPPU(cpu.cycles);
+    scheduleSprite0();
+}
 
 void initPPU(char * filename) {
-    
-}
\ No newline at end of file
+
+}
+
+// Registers and timing back to power on, the PPU starts at the top of the frame in step with the CPU
+void resetPPU(void) {
+    ppu.ctrl = 0;
+    ppu.mask = 0;
+    ppu.status = 0;
+    ppu.oam_addr = 0;
+    ppu.read_buffer = 0;
+    ppu.latch = 0;
+    ppu.v = 0;
+    ppu.t = 0;
+    ppu.x = 0;
+    ppu.w = 0;
+    ppu.clock = cpu.cycles * 3;
+    ppu.line = 0;
+    ppu.dot = 0;
+    ppu.odd = 0;
+    ppu.sprite0_dot = -1;
+    ppu.frame = 0;
+    setNMI(&cpu, 0);
+    setEventHandler(EVENT_VBLANK, vblankEvent);
+    setEventHandler(EVENT_SPRITE0, sprite0Event);
+    scheduleEvent(EVENT_VBLANK, nextVblank());
+    scheduleSprite0();
+}
+
+// CPU side of the PPU registers at $2000-$2007 (mirrored through $3FFF)
+uint8_t readPPU(uint16_t address) {
+    catchUpPPU(cpu.cycles);
+    uint8_t value = ppu.latch;      // write only registers read back whatever was last on the bus
+    switch(address & 7) {
+        case 2:
+            value = ppu.status | (ppu.latch & 0x1f);
+            ppu.status &= ~STATUS_VBLANK;
+            ppu.w = 0;
+            updateNMI();
+            break;
+        case 4:
+            value = mmu.oam[ppu.oam_addr];
+            break;
+        case 7: {
+            uint16_t vaddr = ppu.v & 0x3fff;
+            if(vaddr >= 0x3f00) {   // palette reads skip the buffer, which gets the nametable underneath
+                value = (ppu.palettes[paletteIndex(vaddr)] & 0x3f) | (ppu.latch & 0xc0);
+                ppu.read_buffer = readVRAM(vaddr);
+            } else {
+                value = ppu.read_buffer;
+                ppu.read_buffer = readVRAM(vaddr);
+            }
+            incrementV();
+            break;
+        }
+    }
+    ppu.latch = value;
+    return value;
+}
+
+void writePPU(uint16_t address, uint8_t value) {
+    catchUpPPU(cpu.cycles);
+    ppu.latch = value;
+    switch(address & 7) {
+        case 0:
+            ppu.ctrl = value;
+            ppu.t = (ppu.t & ~0x0c00) | ((value & 3) << 10);
+            updateNMI();                        // turning NMIs on during vblank fires one straight away
+            scheduleSprite0();                  // 8x16 sprites cover more lines
+            break;
+        case 1: {
+            int was_rendering = rendering() != 0;
+            ppu.mask = value;
+            if((rendering() != 0) != was_rendering && mapper && mapper->predict) {
+                mapper->predict();              // scanline counters only count while it's rendering
+            }
+            scheduleSprite0();
+            break;
+        }
+        case 3:
+            ppu.oam_addr = value;
+            break;
+        case 4:
+            mmu.oam[ppu.oam_addr++] = value;
+            scheduleSprite0();
+            break;
+        case 5:
+            if(!ppu.w) {
+                ppu.t = (ppu.t & ~0x001f) | (value >> 3);
+                ppu.x = value & 7;
+            } else {
+                ppu.t = (ppu.t & ~0x73e0) | ((value & 7) << 12) | ((value & 0xf8) << 2);
+            }
+            ppu.w ^= 1;
+            break;
+        case 6:
+            if(!ppu.w) {
+                ppu.t = (ppu.t & 0x00ff) | ((value & 0x3f) << 8);
+            } else {
+                ppu.t = (ppu.t & 0xff00) | value;
+                ppu.v = ppu.t;
+            }
+            ppu.w ^= 1;
+            break;
+        case 7: {
+            uint16_t vaddr = ppu.v & 0x3fff;
+            if(vaddr >= 0x3f00) {
+                ppu.palettes[paletteIndex(vaddr)] = value & 0x3f;
+            } else {
+                if(vaddr < 0x2000) {
+                    // Every slot showing this 1 KB of CHR-RAM has the same tile in it
+                    const uint8_t * page = mmu.ppu_page[vaddr >> 10];
+                    for(int slot = 0; slot < 8; slot++) {
+                        if(mmu.ppu_page[slot] == page) {
+                            invalidateTiles(slot * 64 + ((vaddr >> 4) & 63), 1);
+                        }
+                    }
+                }
+                writeVRAM(vaddr, value);
+            }
+            incrementV();
+            break;
+        }
+    }
+}
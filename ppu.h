@@ -3,12 +3,71 @@
 
 #include <inttypes.h>
 
-typedef struct nymphPPU {
+#define SCREEN_WIDTH 256
+#define SCREEN_HEIGHT 240
+#define DOTS_PER_LINE 341
+#define LINES_PER_FRAME 262
+#define VBLANK_LINE 241
+#define PRERENDER_LINE 261
+
+#define CTRL_NMI 0x80
+#define CTRL_SPRITE_16 0x20
+#define CTRL_BG_TABLE 0x10
+#define CTRL_SPRITE_TABLE 0x08
+#define CTRL_INCREMENT_32 0x04
+
+#define MASK_GRAYSCALE 0x01
+#define MASK_BG_LEFT 0x02
+#define MASK_SPRITE_LEFT 0x04
+#define MASK_BG 0x08
+#define MASK_SPRITES 0x10
+
+#define STATUS_OVERFLOW 0x20
+#define STATUS_SPRITE0 0x40
+#define STATUS_VBLANK 0x80
+
+/*
+    The PPU only runs when something needs it to: a CPU access to its registers or $4014, the vblank
+    NMI or the end of a frame. catchUpPPU() then runs it forward to the CPU's clock a scanline at a time,
+    stopping only on the few dots where something happens (rendering the line, scroll copies, vblank).
+*/
+struct nymphPPU {
     uint8_t vram[2048];
-    uint8_t graphics[8192];
-    uint8_t palettes;
-} ppu;
+    uint8_t graphics[8192];     // CHR-RAM for boards without CHR-ROM
+    uint8_t palettes[32];
+
+    uint8_t ctrl;               // $2000
+    uint8_t mask;               // $2001
+    uint8_t status;             // $2002
+    uint8_t oam_addr;           // $2003
+    uint8_t read_buffer;        // $2007 reads lag one behind
+    uint8_t latch;              // last value written to any register, the undriven bits of $2002 read this back
+    uint16_t v;                 // current VRAM address, doubles as the scroll position while rendering
+    uint16_t t;                 // temporary VRAM address, top left of the screen
+    uint8_t x;                  // fine X scroll
+    uint8_t w;                  // first or second write to $2005/$2006
+
+    uint64_t clock;             // dots since power on, three to a CPU cycle
+    int line;
+    int dot;
+    int odd;                    // odd frames skip a dot when rendering
+    int sprite0_dot;            // dot on this line where sprite 0 hits, -1 if it doesn't
+    uint64_t frame;             // vblanks so far
+
+    uint32_t framebuffer[SCREEN_WIDTH * SCREEN_HEIGHT];     // ARGB
+};
+
+extern struct nymphPPU ppu;
 
 void initPPU(char * filename);
+void resetPPU(void);
+uint8_t readPPU(uint16_t address);
+void writePPU(uint16_t address, uint8_t value);
+void catchUpPPU(uint64_t cycle);
+uint64_t nextVblank(void);
+uint64_t nextStatusChange(void);
+void scheduleSprite0(void);
+uint64_t nextScanlineClock(int n);
+void invalidateTiles(int first, int count);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,239 @@
+#include <string.h>
+#include "render.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Bit 7 of each plane is the leftmost pixel
+void decodeRowsScalar(const uint8_t * low, const uint8_t * high, uint8_t * out, int count) {
+    for(int row = 0; row < count; row++) {
+        for(int i = 0; i < 8; i++) {
+            out[row * 8 + i] = ((low[row] >> (7 - i)) & 1) | (((high[row] >> (7 - i)) & 1) << 1);
+        }
+    }
+}
+
+void lookupColoursScalar(const uint8_t * index, const uint32_t * table, uint32_t * out, int count) {
+    for(int i = 0; i < count; i++) {
+        out[i] = table[index[i] & 0x1f];
+    }
+}
+
+/*
+    Decoding
+    Each plane byte gets copied into all 8 bytes of its pixel row, ANDed with 80 40 20 .. 01 and
+    compared against that mask, which leaves $FF in every byte whose bit was set. Masking the low plane
+    with 1 and the high one with 2 and ORing them gives the pixel values.
+*/
+#if defined(__AVX2__)
+
+void decodeRows(const uint8_t * low, const uint8_t * high, uint8_t * out, int count) {
+    // shuffle is per 128 bit lane, both lanes have the same 4 bytes so the top one picks 2 and 3
+    const __m256i spread = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                            2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bits = _mm256_set1_epi64x(0x0102040810204080);
+    const __m256i one = _mm256_set1_epi8(1);
+    const __m256i two = _mm256_set1_epi8(2);
+    int row = 0;
+    for(; row + 4 <= count; row += 4) {
+        uint32_t l, h;
+        memcpy(&l, low + row, 4);
+        memcpy(&h, high + row, 4);
+        __m256i lo = _mm256_shuffle_epi8(_mm256_set1_epi32(l), spread);
+        __m256i hi = _mm256_shuffle_epi8(_mm256_set1_epi32(h), spread);
+        lo = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(lo, bits), bits), one);
+        hi = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(hi, bits), bits), two);
+        _mm256_storeu_si256((__m256i *) (out + row * 8), _mm256_or_si256(lo, hi));
+    }
+    decodeRowsScalar(low + row, high + row, out + row * 8, count - row);
+}
+
+#elif defined(__SSE2__)
+
+// Two more rounds of unpacking a register of doubled bytes with itself leaves each byte filling 8, two rows per register
+static inline void spreadPairs(__m128i pairs, __m128i * rows) {
+    __m128i lo = _mm_unpacklo_epi16(pairs, pairs);
+    __m128i hi = _mm_unpackhi_epi16(pairs, pairs);
+    rows[0] = _mm_unpacklo_epi32(lo, lo);
+    rows[1] = _mm_unpackhi_epi32(lo, lo);
+    rows[2] = _mm_unpacklo_epi32(hi, hi);
+    rows[3] = _mm_unpackhi_epi32(hi, hi);
+}
+
+static inline __m128i decodePair(__m128i lo, __m128i hi) {
+    const __m128i bits = _mm_set1_epi64x(0x0102040810204080);
+    __m128i l = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo, bits), bits), _mm_set1_epi8(1));
+    __m128i h = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi, bits), bits), _mm_set1_epi8(2));
+    return _mm_or_si128(l, h);
+}
+
+// 16 rows at a time, then the 8 of a single tile, which is how the PPU asks for them
+void decodeRows(const uint8_t * low, const uint8_t * high, uint8_t * out, int count) {
+    __m128i lo[8];
+    __m128i hi[8];
+    int row = 0;
+    for(; row + 16 <= count; row += 16) {
+        __m128i l = _mm_loadu_si128((const __m128i *) (low + row));
+        __m128i h = _mm_loadu_si128((const __m128i *) (high + row));
+        spreadPairs(_mm_unpacklo_epi8(l, l), lo);
+        spreadPairs(_mm_unpackhi_epi8(l, l), lo + 4);
+        spreadPairs(_mm_unpacklo_epi8(h, h), hi);
+        spreadPairs(_mm_unpackhi_epi8(h, h), hi + 4);
+        for(int i = 0; i < 8; i++) {
+            _mm_storeu_si128((__m128i *) (out + (row + i * 2) * 8), decodePair(lo[i], hi[i]));
+        }
+    }
+    if(row + 8 <= count) {
+        __m128i l = _mm_loadl_epi64((const __m128i *) (low + row));
+        __m128i h = _mm_loadl_epi64((const __m128i *) (high + row));
+        spreadPairs(_mm_unpacklo_epi8(l, l), lo);
+        spreadPairs(_mm_unpacklo_epi8(h, h), hi);
+        for(int i = 0; i < 4; i++) {
+            _mm_storeu_si128((__m128i *) (out + (row + i * 2) * 8), decodePair(lo[i], hi[i]));
+        }
+        row += 8;
+    }
+    decodeRowsScalar(low + row, high + row, out + row * 8, count - row);
+}
+
+#else
+
+void decodeRows(const uint8_t * low, const uint8_t * high, uint8_t * out, int count) {
+    decodeRowsScalar(low, high, out, count);
+}
+
+#endif
+
+/*
+    Colours
+    A build that's only allowed SSE2 (the default on x86-64) still gets the SSSE3 or AVX2 kernel if
+    the CPU it runs on has one: they're compiled for that target on their own, and lookupColours()
+    goes through a pointer set once at startup. A build with -mssse3 or -mavx2 calls its kernel
+    straight.
+*/
+#if defined(__SSE2__) && !defined(__AVX2__) && defined(__GNUC__)
+#define COLOURS_AT_RUNTIME 1
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define COLOURS_AT_RUNTIME 0
+#define TARGET_AVX2
+#define TARGET_SSSE3
+#endif
+
+#if defined(__AVX2__) || COLOURS_AT_RUNTIME
+TARGET_AVX2 static void lookupColoursAVX2(const uint8_t * index, const uint32_t * table, uint32_t * out, int count) {
+    const __m256i mask = _mm256_set1_epi32(0x1f);
+    int i = 0;
+    for(; i + 8 <= count; i += 8) {
+        __m256i indexes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (index + i)));
+        indexes = _mm256_and_si256(indexes, mask);
+        _mm256_storeu_si256((__m256i *) (out + i), _mm256_i32gather_epi32((const int *) table, indexes, 4));
+    }
+    lookupColoursScalar(index + i, table, out + i, count - i);
+}
+#endif
+
+#if (defined(__SSSE3__) && !defined(__AVX2__)) || COLOURS_AT_RUNTIME
+/*
+    No gather before AVX2, but 32 entries is small enough to split into byte planes: pshufb looks up
+    16 bytes at once out of a 16 entry table, so each byte of the ARGB value is two lookups (one per
+    half of the table) and a select on bit 4 of the index. The four planes then get interleaved back
+    into whole pixels.
+*/
+TARGET_SSSE3 static void lookupColoursSSSE3(const uint8_t * index, const uint32_t * table, uint32_t * out, int count) {
+    uint8_t planes[4][32];
+    for(int i = 0; i < 32; i++) {
+        for(int b = 0; b < 4; b++) {
+            planes[b][i] = table[i] >> (b * 8);
+        }
+    }
+    __m128i lower[4];
+    __m128i upper[4];
+    for(int b = 0; b < 4; b++) {
+        lower[b] = _mm_loadu_si128((const __m128i *) planes[b]);
+        upper[b] = _mm_loadu_si128((const __m128i *) (planes[b] + 16));
+    }
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i bit4 = _mm_set1_epi8(0x10);
+    int i = 0;
+    for(; i + 16 <= count; i += 16) {
+        __m128i indexes = _mm_loadu_si128((const __m128i *) (index + i));
+        __m128i select = _mm_cmpeq_epi8(_mm_and_si128(indexes, bit4), bit4);
+        indexes = _mm_and_si128(indexes, nibble);
+        __m128i bytes[4];
+        for(int b = 0; b < 4; b++) {
+            __m128i l = _mm_shuffle_epi8(lower[b], indexes);
+            __m128i u = _mm_shuffle_epi8(upper[b], indexes);
+            bytes[b] = _mm_or_si128(_mm_and_si128(select, u), _mm_andnot_si128(select, l));
+        }
+        __m128i blue_green_lo = _mm_unpacklo_epi8(bytes[0], bytes[1]);
+        __m128i blue_green_hi = _mm_unpackhi_epi8(bytes[0], bytes[1]);
+        __m128i red_alpha_lo = _mm_unpacklo_epi8(bytes[2], bytes[3]);
+        __m128i red_alpha_hi = _mm_unpackhi_epi8(bytes[2], bytes[3]);
+        _mm_storeu_si128((__m128i *) (out + i), _mm_unpacklo_epi16(blue_green_lo, red_alpha_lo));
+        _mm_storeu_si128((__m128i *) (out + i + 4), _mm_unpackhi_epi16(blue_green_lo, red_alpha_lo));
+        _mm_storeu_si128((__m128i *) (out + i + 8), _mm_unpacklo_epi16(blue_green_hi, red_alpha_hi));
+        _mm_storeu_si128((__m128i *) (out + i + 12), _mm_unpackhi_epi16(blue_green_hi, red_alpha_hi));
+    }
+    lookupColoursScalar(index + i, table, out + i, count - i);
+}
+#endif
+
+#if defined(__AVX2__)
+
+const char * render_backend = "avx2 decode, avx2 gather colours";
+int render_vector_decode = 1;
+int render_vector_colours = 1;
+
+void lookupColours(const uint8_t * index, const uint32_t * table, uint32_t * out, int count) {
+    lookupColoursAVX2(index, table, out, count);
+}
+
+#elif COLOURS_AT_RUNTIME
+
+const char * render_backend = "sse2 decode, scalar colours";
+int render_vector_decode = 1;
+int render_vector_colours = 0;
+
+static void (* colours)(const uint8_t *, const uint32_t *, uint32_t *, int) = lookupColoursScalar;
+
+__attribute__((constructor)) static void pickColours(void) {
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        colours = lookupColoursAVX2;
+        render_backend = "sse2 decode, avx2 gather colours (picked at startup)";
+        render_vector_colours = 1;
+    } else if(__builtin_cpu_supports("ssse3")) {
+        colours = lookupColoursSSSE3;
+        render_backend = "sse2 decode, ssse3 shuffle colours (picked at startup)";
+        render_vector_colours = 1;
+    }
+}
+
+void lookupColours(const uint8_t * index, const uint32_t * table, uint32_t * out, int count) {
+    colours(index, table, out, count);
+}
+
+#elif defined(__SSSE3__)
+
+const char * render_backend = "sse2 decode, ssse3 shuffle colours";
+int render_vector_decode = 1;
+int render_vector_colours = 1;
+
+void lookupColours(const uint8_t * index, const uint32_t * table, uint32_t * out, int count) {
+    lookupColoursSSSE3(index, table, out, count);
+}
+
+#else
+
+const char * render_backend = "scalar";
+int render_vector_decode = 0;
+int render_vector_colours = 0;
+
+void lookupColours(const uint8_t * index, const uint32_t * table, uint32_t * out, int count) {
+    lookupColoursScalar(index, table, out, count);
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <inttypes.h>
+
+/*
+    Pixel kernels for the PPU
+
+    The vector versions are picked at build time from whatever the compiler is allowed to use
+    (SSE2 is always there on x86-64, build with -mssse3 or -mavx2 for more), except that an SSE2
+    build with gcc or clang picks the colour kernel at startup from what the CPU has. The scalar
+    versions are the reference the vector ones get checked and benchmarked against, and the
+    fallback on everything else.
+*/
+
+// count tile rows, given as their two bit planes, into 8 pixel values of 0-3 each
+void decodeRows(const uint8_t * low, const uint8_t * high, uint8_t * out, int count);
+void decodeRowsScalar(const uint8_t * low, const uint8_t * high, uint8_t * out, int count);
+
+// count palette RAM indexes (0-31) into ARGB through a 32 entry table of what each one shows as
+void lookupColours(const uint8_t * index, const uint32_t * table, uint32_t * out, int count);
+void lookupColoursScalar(const uint8_t * index, const uint32_t * table, uint32_t * out, int count);
+
+extern const char * render_backend;
+extern int render_vector_decode;        // 0 when decodeRows()/lookupColours() are only the scalar versions
+extern int render_vector_colours;
+
+#endif
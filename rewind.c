@@ -0,0 +1,232 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rewind.h"
+#include "state.h"
+
+/*
+    A delta is the size of the state it takes you back to, then runs of: how many bytes are the same,
+    how many differ, and those XORed. Counts are 7 bits a byte, low first. A gap of fewer than MIN_GAP
+    unchanged bytes costs less left in the changed run than it would starting a new one.
+*/
+#define MIN_GAP 4
+
+static uint8_t * putCount(uint8_t * out, size_t n) {
+    while(n >= 0x80) {
+        *out++ = n | 0x80;
+        n >>= 7;
+    }
+    *out++ = n;
+    return out;
+}
+
+static const uint8_t * getCount(const uint8_t * in, size_t * n) {
+    size_t value = 0;
+    int shift = 0;
+    while(*in & 0x80) {
+        value |= (size_t) (*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *n = value | (size_t) *in++ << shift;
+    return in;
+}
+
+// Where the bytes stop being the same, 8 at a time while it can since that's nearly all of it
+static size_t skipSame(const uint8_t * a, const uint8_t * b, size_t i, size_t size) {
+    while(i + 8 <= size) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if(x != y) {
+            break;
+        }
+        i += 8;
+    }
+    while(i < size && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+// Same bytes at the end don't need saying, the decoder stops when the delta does
+static size_t encodeDelta(const uint8_t * a, const uint8_t * b, size_t size, uint8_t * out) {
+    uint8_t * p = out;
+    size_t i = 0;
+    for(;;) {
+        size_t start = i;
+        i = skipSame(a, b, i, size);
+        if(i == size) {
+            return p - out;
+        }
+        size_t end = i + 1;
+        for(size_t j = end; j < size && j - end < MIN_GAP; j++) {
+            if(a[j] != b[j]) {
+                end = j + 1;
+            }
+        }
+        p = putCount(p, i - start);
+        p = putCount(p, end - i);
+        for(; i < end; i++) {
+            *p++ = a[i] ^ b[i];
+        }
+    }
+}
+
+static void applyDelta(uint8_t * state, const uint8_t * in, const uint8_t * end) {
+    size_t i = 0;
+    while(in < end) {
+        size_t same, count;
+        in = getCount(in, &same);
+        in = getCount(in, &count);
+        i += same;
+        while(count--) {
+            state[i++] ^= *in++;
+        }
+    }
+}
+
+// Sized for the cart that's in now, so push straight after this for somewhere to come back to
+int rewindInit(struct rewind_buffer * r, size_t bytes) {
+    memset(r, 0, sizeof(*r));
+    if(bytes > REWIND_MAX_BYTES) {
+        return -1;
+    }
+    r->state_size = stateSize();
+    r->capacity = bytes;
+    r->max_entries = bytes / 8 + 1;     // a frame of nothing happening is still a few bytes
+    r->data = malloc(bytes);
+    r->entries = malloc(r->max_entries * sizeof(struct rewind_entry));
+    r->latest = calloc(r->state_size, 1);
+    r->next = calloc(r->state_size, 1);
+    r->scratch = malloc(2 * r->state_size + 16);
+    if(!r->data || !r->entries || !r->latest || !r->next || !r->scratch) {
+        rewindFree(r);
+        return -1;
+    }
+    return 0;
+}
+
+void rewindFree(struct rewind_buffer * r) {
+    free(r->data);
+    free(r->entries);
+    free(r->latest);
+    free(r->next);
+    free(r->scratch);
+    memset(r, 0, sizeof(*r));
+}
+
+void rewindClear(struct rewind_buffer * r) {
+    memset(r->latest, 0, r->latest_size);
+    r->latest_size = 0;
+    r->head = 0;
+    r->used = 0;
+    r->first = 0;
+    r->count = 0;
+}
+
+static struct rewind_entry * oldest(struct rewind_buffer * r) {
+    return &r->entries[r->first];
+}
+
+static struct rewind_entry * newest(struct rewind_buffer * r) {
+    return &r->entries[(r->first + r->count - 1) % r->max_entries];
+}
+
+static void dropOldest(struct rewind_buffer * r) {
+    r->used -= oldest(r)->length;
+    r->first = (r->first + 1) % r->max_entries;
+    r->count--;
+}
+
+/*
+    Entries sit in the data in the order they came in, wrapping round once, so going on from head the
+    first one you hit is the oldest. Anything in the way of the new one goes oldest first until it fits.
+    If it doesn't fit before the end it starts again at 0, and whatever's between head and the end is
+    older than everything at the start, so that goes first.
+*/
+static void store(struct rewind_buffer * r, const uint8_t * delta, size_t length) {
+    if(length > r->capacity) {
+        rewindClear(r);
+        return;
+    }
+    size_t offset = r->head;
+    if(offset + length > r->capacity) {
+        while(r->count && oldest(r)->offset >= r->head) {
+            dropOldest(r);
+        }
+        offset = 0;
+    }
+    while(r->count && oldest(r)->offset < offset + length && offset < oldest(r)->offset + oldest(r)->length) {
+        dropOldest(r);
+    }
+    if(r->count == r->max_entries) {
+        dropOldest(r);
+    }
+    memcpy(r->data + offset, delta, length);
+    r->count++;
+    *newest(r) = (struct rewind_entry) { offset, length };
+    r->used += length;
+    r->head = offset + length;
+}
+
+// Once a frame, returns -1 if the state doesn't fit, which means the cart's changed since rewindInit()
+int rewindPush(struct rewind_buffer * r) {
+    size_t size = saveState(r->next, r->state_size);
+    if(!size) {
+        return -1;
+    }
+    if(r->next_size > size) {
+        memset(r->next + size, 0, r->next_size - size);     // PRG-RAM went back to all zero and out of the state
+    }
+    r->next_size = size;
+    if(r->latest_size) {
+        size_t span = r->latest_size > size ? r->latest_size : size;
+        uint8_t * p = putCount(r->scratch, r->latest_size);
+        p += encodeDelta(r->latest, r->next, span, p);
+        store(r, r->scratch, p - r->scratch);
+    }
+    uint8_t * swap = r->latest;
+    r->latest = r->next;
+    r->next = swap;
+    r->next_size = r->latest_size;
+    r->latest_size = size;
+    return 0;
+}
+
+// How many frames back it can go from the newest one
+int rewindFrames(const struct rewind_buffer * r) {
+    return r->count;
+}
+
+size_t rewindUsed(const struct rewind_buffer * r) {
+    return r->used + r->latest_size;
+}
+
+/*
+    Puts the machine back to frames pushes before the newest one, 0 being the newest itself, or as far
+    as it goes if that's not far enough. Less than 0 counts as 0, there's nothing newer to go forward to.
+    Returns how many frames back that was, -1 if there's nothing to go back to yet.
+*/
+int rewindSeek(struct rewind_buffer * r, int frames) {
+    if(!r->latest_size) {
+        return -1;
+    }
+    if(frames < 0) {
+        frames = 0;
+    }
+    if(frames > r->count) {
+        frames = r->count;
+    }
+    for(int i = 0; i < frames; i++) {
+        struct rewind_entry * entry = newest(r);
+        const uint8_t * delta = r->data + entry->offset;
+        const uint8_t * p = getCount(delta, &r->latest_size);
+        applyDelta(r->latest, p, delta + entry->length);
+        r->head = entry->offset;
+        r->used -= entry->length;
+        r->count--;
+    }
+    if(loadState(r->latest, r->latest_size) != STATE_OK) {
+        return -1;
+    }
+    return frames;
+}
@@ -0,0 +1,55 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+    Rewind
+
+    A save state every frame, kept in a fixed amount of memory that's handed out round and round, so
+    the oldest frames fall off the back as new ones come in. Only the newest state is kept whole. Each
+    one before it is stored as the XOR against the one after it, which is zero almost everywhere since
+    a frame only changes a few bytes of RAM, VRAM and OAM, and the zeros are squeezed out as runs. An
+    NROM game comes to somewhere from tens to a few hundred bytes a frame, so a few MB holds minutes.
+
+    Going back N frames XORs the newest N deltas into the whole state one after another and loads what
+    comes out. The frames after it are gone once you've gone back, same as everywhere else that does
+    this, what gets pushed next carries on from there.
+
+    The state buffers are sized for the cart that's loaded when rewindInit() is called.
+*/
+#define REWIND_MAX_BYTES UINT32_MAX     // so every offset fits an entry, a bigger buffer gets turned down
+
+// Where one frame's delta is in the data
+struct rewind_entry {
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct rewind_buffer {
+    uint8_t * data;                     // the deltas, handed out from head and wrapped back to 0
+    size_t capacity;
+    size_t head;
+    size_t used;                        // bytes of it the entries take up
+    struct rewind_entry * entries;      // oldest at first, newest at first + count - 1, both mod max_entries
+    int max_entries;
+    int first;
+    int count;
+    uint8_t * latest;                   // the newest state, whole
+    uint8_t * next;                     // where the state being pushed goes before it's swapped in
+    uint8_t * scratch;                  // a delta before it's copied into data
+    size_t latest_size;                 // 0 until something's pushed
+    size_t next_size;
+    size_t state_size;                  // what latest and next are allocated for, past each state they're zero
+};
+
+int rewindInit(struct rewind_buffer * r, size_t bytes);
+void rewindFree(struct rewind_buffer * r);
+void rewindClear(struct rewind_buffer * r);
+int rewindPush(struct rewind_buffer * r);
+int rewindFrames(const struct rewind_buffer * r);
+size_t rewindUsed(const struct rewind_buffer * r);
+int rewindSeek(struct rewind_buffer * r, int frames);
+
+#endif
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "rom.h"
+
+#define HEADER_SIZE 16
+#define TRAINER_SIZE 512
+#define PRG_BANK_SIZE 0x4000
+#define CHR_BANK_SIZE 0x2000
+
+struct nesROM cart;
+
+// NES 2.0 shift counts: 0 means none, otherwise 64 << n bytes
+static size_t shiftSize(uint8_t n) {
+    return n ? (size_t) 64 << n : 0;
+}
+
+/*
+    NES 2.0 ROM sizes: a 12 bit bank count, or when the top nibble is $F an exponent-multiplier
+    form of 2^E * (M * 2 + 1) bytes. Returns 0 if the size can't be right so the caller rejects it.
+*/
+static size_t romSize(uint8_t lsb, uint8_t msb, size_t bank) {
+    if(msb != 0xf) {
+        return ((msb << 8) | lsb) * bank;
+    }
+    int exponent = lsb >> 2;
+    int multiplier = (lsb & 3) * 2 + 1;
+    if(exponent > 30) {
+        return 0;
+    }
+    return ((size_t) 1 << exponent) * multiplier;
+}
+
+int parseROM(const uint8_t * data, size_t size, struct nesROM * rom) {
+    memset(rom, 0, sizeof(*rom));
+    if(data == NULL || size < HEADER_SIZE) {
+        return ROM_TOO_SMALL;
+    }
+    if(memcmp(data, "NES\x1a", 4) != 0) {
+        return ROM_BAD_MAGIC;
+    }
+
+    const uint8_t * header = data;
+    rom->nes2 = (header[7] & 0x0c) == 0x08;
+    rom->mapper = (header[6] >> 4) | (header[7] & 0xf0);
+    rom->battery = (header[6] >> 1) & 1;
+    if(header[6] & 0x08) {
+        rom->mirroring = MIRROR_FOUR_SCREEN;
+    } else {
+        rom->mirroring = (header[6] & 1) ? MIRROR_VERTICAL : MIRROR_HORIZONTAL;
+    }
+
+    if(rom->nes2) {
+        rom->mapper |= (header[8] & 0x0f) << 8;
+        rom->submapper = header[8] >> 4;
+        rom->prg_size = romSize(header[4], header[9] & 0x0f, PRG_BANK_SIZE);
+        rom->chr_size = romSize(header[5], header[9] >> 4, CHR_BANK_SIZE);
+        rom->prg_ram_size = shiftSize(header[10] & 0x0f) + shiftSize(header[10] >> 4);
+        rom->chr_ram_size = shiftSize(header[11] & 0x0f) + shiftSize(header[11] >> 4);
+    } else {
+        // Old dumps with junk like "DiskDude!" in bytes 7-15 have a garbage upper mapper nibble
+        if(header[12] | header[13] | header[14] | header[15]) {
+            rom->mapper &= 0x0f;
+        }
+        rom->prg_size = header[4] * PRG_BANK_SIZE;
+        rom->chr_size = header[5] * CHR_BANK_SIZE;
+        rom->prg_ram_size = 0x2000;
+        rom->chr_ram_size = rom->chr_size ? 0 : 0x2000;
+    }
+    // Mappers bank PRG in 8 KB and CHR in 1 KB pieces, anything that doesn't divide into those can't be mapped
+    if(rom->prg_size == 0 || rom->prg_size % 0x2000 || rom->chr_size % 0x400) {
+        return ROM_BAD_SIZE;
+    }
+
+    // Walk the file making sure every piece actually fits in it before pointing at it
+    size_t offset = HEADER_SIZE;
+    if(header[6] & 0x04) {
+        if(size - offset < TRAINER_SIZE) {
+            return ROM_TRUNCATED;
+        }
+        rom->trainer = data + offset;
+        offset += TRAINER_SIZE;
+    }
+    if(size - offset < rom->prg_size) {
+        return ROM_TRUNCATED;
+    }
+    rom->prg = data + offset;
+    offset += rom->prg_size;
+    if(size - offset < rom->chr_size) {
+        return ROM_TRUNCATED;
+    }
+    rom->chr = rom->chr_size ? data + offset : NULL;
+
+    rom->data = data;
+    rom->size = size;
+    return ROM_OK;
+}
+
+int openROM(const char * filename, struct nesROM * rom) {
+    memset(rom, 0, sizeof(*rom));
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) {
+        return ROM_OPEN_FAILED;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return ROM_OPEN_FAILED;
+    }
+    if(info.st_size < HEADER_SIZE) {
+        close(fd);
+        return ROM_TOO_SMALL;
+    }
+
+    // Read only and lazily paged in, so only the banks a game touches ever become resident
+    size_t size = info.st_size;
+    uint8_t * data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        return ROM_MAP_FAILED;
+    }
+
+    int status = parseROM(data, size, rom);
+    if(status != ROM_OK) {
+        munmap(data, size);
+        memset(rom, 0, sizeof(*rom));
+        return status;
+    }
+    rom->mapped = 1;
+    return ROM_OK;
+}
+
+void closeROM(struct nesROM * rom) {
+    if(rom->mapped) {
+        munmap((void *) rom->data, rom->size);
+    }
+    memset(rom, 0, sizeof(*rom));
+}
+
+const char * romError(int status) {
+    switch(status) {
+        case ROM_OK:            return "ok";
+        case ROM_OPEN_FAILED:   return "couldn't open file";
+        case ROM_MAP_FAILED:    return "couldn't map file";
+        case ROM_TOO_SMALL:     return "file too small for an iNES header";
+        case ROM_BAD_MAGIC:     return "not an iNES file";
+        case ROM_BAD_SIZE:      return "bad PRG/CHR size in header";
+        case ROM_TRUNCATED:     return "file shorter than its header says";
+        case ROM_BAD_MAPPER:    return "mapper not supported";
+        default:                return "unknown error";
+    }
+}
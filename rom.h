@@ -0,0 +1,44 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+#define MIRROR_HORIZONTAL 0
+#define MIRROR_VERTICAL 1
+#define MIRROR_FOUR_SCREEN 2
+
+enum rom_status { ROM_OK, ROM_OPEN_FAILED, ROM_MAP_FAILED, ROM_TOO_SMALL, ROM_BAD_MAGIC, ROM_BAD_SIZE, ROM_TRUNCATED, ROM_BAD_MAPPER };
+
+/*
+    iNES / NES 2.0 cartridge image
+
+    The file is mapped read only and never copied, prg/chr/trainer point straight into the mapping.
+    Every pointer and size has been checked against the file size by parseROM() before it gets used.
+*/
+struct nesROM {
+    const uint8_t * data;       // whole file
+    size_t size;
+    int mapped;                 // data came from openROM() and needs munmap()
+    const uint8_t * trainer;    // 512 bytes for $7000 or NULL
+    const uint8_t * prg;
+    size_t prg_size;
+    const uint8_t * chr;        // NULL when the board has CHR-RAM instead
+    size_t chr_size;
+    size_t prg_ram_size;
+    size_t chr_ram_size;
+    uint16_t mapper;
+    uint8_t submapper;
+    uint8_t mirroring;
+    uint8_t battery;
+    uint8_t nes2;
+};
+
+extern struct nesROM cart;
+
+int openROM(const char * filename, struct nesROM * rom);
+int parseROM(const uint8_t * data, size_t size, struct nesROM * rom);
+void closeROM(struct nesROM * rom);
+const char * romError(int status);
+
+#endif
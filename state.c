@@ -0,0 +1,181 @@
+#include <string.h>
+#include <stddef.h>
+#include "state.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "nes.h"
+#include "rom.h"
+#include "mapper.h"
+
+#define EXTRA_VRAM_SIZE 0x800       // nametables 2 and 3 for four screen boards, at the start of ppu_mem
+
+// Which of the optional parts are in a state
+#define STATE_PRG_RAM 0x01
+#define STATE_CHR_RAM 0x02
+#define STATE_EXTRA_VRAM 0x04
+
+struct state_header {
+    char magic[4];              // "NYMS"
+    uint16_t version;
+    uint16_t parts;             // STATE_ bits
+    uint32_t size;              // the whole state, header included
+    uint16_t mapper;            // the cart it came from
+    uint16_t reserved;          // 0, so there's no padding and two saves of the same machine are the same bytes
+    uint32_t prg_size;
+    uint32_t chr_size;
+};
+
+// The PPU from its palettes up to the framebuffer, which isn't worth saving
+#define PPU_REGS_START offsetof(struct nymphPPU, palettes)
+#define PPU_REGS_SIZE (offsetof(struct nymphPPU, framebuffer) - PPU_REGS_START)
+
+static size_t partsSize(int parts) {
+    size_t size = sizeof(struct state_header) + sizeof(struct nesCPU) + CPU_MEM_SIZE + OAM_MEM_SIZE
+                + 3 + 2 + sizeof(ppu.vram) + PPU_REGS_SIZE + sizeof(struct nymphAPU) + sizeof(struct mapper_state)
+                + EVENT_COUNT * sizeof(uint64_t);
+    size += (parts & STATE_PRG_RAM) ? PRG_RAM_SIZE : 0;
+    size += (parts & STATE_CHR_RAM) ? sizeof(ppu.graphics) : 0;
+    size += (parts & STATE_EXTRA_VRAM) ? EXTRA_VRAM_SIZE : 0;
+    return size;
+}
+
+// Most games never touch PRG-RAM, that's 8 KB of zeros not to bother with
+static int allZero(const uint8_t * memory, size_t size) {
+    uint64_t any = 0;
+    for(size_t i = 0; i < size; i += 8) {
+        uint64_t word;
+        memcpy(&word, memory + i, 8);
+        any |= word;
+    }
+    return any == 0;
+}
+
+// The parts the board itself decides on, every state for a cart has the same ones
+static int cartParts(void) {
+    return (cart.chr == NULL ? STATE_CHR_RAM : 0) | (cart.mirroring == MIRROR_FOUR_SCREEN ? STATE_EXTRA_VRAM : 0);
+}
+
+static int partsNeeded(void) {
+    return cartParts() | (allZero(mmu.prg_ram, PRG_RAM_SIZE) ? 0 : STATE_PRG_RAM);
+}
+
+static uint8_t * put(uint8_t * out, const void * data, size_t size) {
+    memcpy(out, data, size);
+    return out + size;
+}
+
+static const uint8_t * get(const uint8_t * in, void * data, size_t size) {
+    memcpy(data, in, size);
+    return in + size;
+}
+
+// Big enough for any state of the cart that's loaded now
+size_t stateSize(void) {
+    return partsSize(STATE_PRG_RAM | partsNeeded());
+}
+
+// Returns the size of the state, 0 if it didn't fit
+size_t saveState(uint8_t * out, size_t size) {
+    int parts = partsNeeded();
+    struct state_header header = { { 'N', 'Y', 'M', 'S' }, STATE_VERSION, parts, partsSize(parts), cart.mapper, 0, cart.prg_size, cart.chr_size };
+    if(size < header.size) {
+        return 0;
+    }
+    uint64_t events[EVENT_COUNT];
+    for(int i = 0; i < EVENT_COUNT; i++) {
+        events[i] = eventTime(i);
+    }
+    uint8_t * p = put(out, &header, sizeof(header));
+    p = put(p, &cpu, sizeof(cpu));
+    p = put(p, mmu.cpu_mem, CPU_MEM_SIZE);      // the backing memory, which is there whether its pages are trapped or not
+    p = put(p, mmu.oam, OAM_MEM_SIZE);
+    p = put(p, mmu.controller_shift, 2);
+    p = put(p, &mmu.controller_strobe, 1);
+    p = put(p, mmu.controller, 2);
+    p = put(p, ppu.vram, sizeof(ppu.vram));
+    p = put(p, (uint8_t *) &ppu + PPU_REGS_START, PPU_REGS_SIZE);
+    p = put(p, &apu, sizeof(apu));
+    p = put(p, &mapper_state, sizeof(mapper_state));
+    p = put(p, events, sizeof(events));
+    if(parts & STATE_PRG_RAM) {
+        p = put(p, mmu.prg_ram, PRG_RAM_SIZE);
+    }
+    if(parts & STATE_CHR_RAM) {
+        p = put(p, ppu.graphics, sizeof(ppu.graphics));
+    }
+    if(parts & STATE_EXTRA_VRAM) {
+        p = put(p, mmu.ppu_mem, EXTRA_VRAM_SIZE);
+    }
+    return p - out;
+}
+
+// Everything's checked before anything gets touched, a state that won't load leaves the machine as it was
+int loadState(const uint8_t * in, size_t size) {
+    struct state_header header;
+    if(size < sizeof(header)) {
+        return STATE_TOO_SMALL;
+    }
+    memcpy(&header, in, sizeof(header));
+    if(memcmp(header.magic, "NYMS", 4) != 0) {
+        return STATE_BAD_MAGIC;
+    }
+    if(header.version != STATE_VERSION) {
+        return STATE_BAD_VERSION;
+    }
+    if(header.mapper != cart.mapper || header.prg_size != cart.prg_size || header.chr_size != cart.chr_size
+       || (header.parts & ~STATE_PRG_RAM) != cartParts()) {
+        return STATE_WRONG_CART;
+    }
+    if(header.size != partsSize(header.parts) || size < header.size) {
+        return STATE_BAD_SIZE;
+    }
+
+    uint64_t events[EVENT_COUNT];
+    const uint8_t * p = in + sizeof(header);
+    p = get(p, &cpu, sizeof(cpu));
+    p = get(p, mmu.cpu_mem, CPU_MEM_SIZE);
+    p = get(p, mmu.oam, OAM_MEM_SIZE);
+    p = get(p, mmu.controller_shift, 2);
+    p = get(p, &mmu.controller_strobe, 1);
+    p = get(p, mmu.controller, 2);
+    p = get(p, ppu.vram, sizeof(ppu.vram));
+    p = get(p, (uint8_t *) &ppu + PPU_REGS_START, PPU_REGS_SIZE);
+    p = get(p, &apu, sizeof(apu));
+    p = get(p, &mapper_state, sizeof(mapper_state));
+    p = get(p, events, sizeof(events));
+    if(header.parts & STATE_PRG_RAM) {
+        p = get(p, mmu.prg_ram, PRG_RAM_SIZE);
+    } else {
+        memset(mmu.prg_ram, 0, PRG_RAM_SIZE);
+    }
+    if(header.parts & STATE_CHR_RAM) {
+        p = get(p, ppu.graphics, sizeof(ppu.graphics));
+    }
+    if(header.parts & STATE_EXTRA_VRAM) {
+        p = get(p, mmu.ppu_mem, EXTRA_VRAM_SIZE);
+    }
+
+    // Now whatever was worked out from all that
+    mapper->sync();
+    invalidateTiles(0, 512);
+    invalidateCode();
+    for(int i = 0; i < EVENT_COUNT; i++) {
+        scheduleEvent(i, events[i]);
+    }
+    syncAPU();
+    return STATE_OK;
+}
+
+const char * stateError(int status) {
+    switch(status) {
+        case STATE_OK:              return "ok";
+        case STATE_TOO_SMALL:       return "too small for a save state";
+        case STATE_BAD_MAGIC:       return "not a save state";
+        case STATE_BAD_VERSION:     return "save state from another version";
+        case STATE_WRONG_CART:      return "save state for another cart";
+        case STATE_BAD_SIZE:        return "save state size doesn't match its header";
+        default:                    return "unknown error";
+    }
+}
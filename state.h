@@ -0,0 +1,30 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+enum state_status { STATE_OK, STATE_TOO_SMALL, STATE_BAD_MAGIC, STATE_BAD_VERSION, STATE_WRONG_CART, STATE_BAD_SIZE };
+
+/*
+    Save states
+    Everything the machine remembers, as a flat blob: a header, then the CPU, the memory the cart
+    can't bring back, the PPU and APU registers, the mapper and the event times, each copied straight
+    out of the struct it lives in. Memory that doesn't need saving gets left out and the header says
+    so: PRG-RAM that's still all zero, CHR-RAM on boards with CHR-ROM, the extra nametables on boards
+    without four screen VRAM. That makes an NROM game about 4.5 KB.
+
+    Loading copies it all back and then redoes what depends on it: the mapper's banks, the decoded
+    tiles, code decoded from RAM and the synthesizer. It's the same build's structs byte for byte, so a
+    state only loads into the build that saved it (STATE_VERSION goes up whenever a struct in here
+    changes) and the same cart. The framebuffer isn't in it, the first frame after a load is partly
+    what was there before.
+*/
+#define STATE_VERSION 2
+
+size_t stateSize(void);
+size_t saveState(uint8_t * out, size_t size);
+int loadState(const uint8_t * in, size_t size);
+const char * stateError(int status);
+
+#endif
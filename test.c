@@ -1,10 +1,25 @@
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include "mmu.h"
 #include "cpu.h"
+#include "rom.h"
+#include "mapper.h"
+#include "nes.h"
+#include "ppu.h"
+#include "apu.h"
+#include "audio.h"
+#include "state.h"
+#include "rewind.h"
+#include "trace.h"
+#include "render.h"
 
-int main(int argc, char * argv[]) {
+static int failures = 0;
+
+#define CHECK(cond) do { if(!(cond)) { printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while(0)
 
+static void testOpcodes(void) {
     uint8_t opcodes[5] = {0xa9, 0xc0, 0xaa, 0xe8, 0x00};
     /*
         LDA #$c0    ; a9 c0
@@ -12,18 +27,1355 @@ int main(int argc, char * argv[]) {
         INX         ; e8
         BRK         ; 00
     */
-    
-    init_mmu();
+
     resetCPU(&cpu);
-    
+
     for(int i = 0; i < 5; i++) {
         writeRAM(cpu.pc + i, opcodes[i]);
     }
 
     for(int j = 0; j < 4; j++) {
         interpret(&cpu);
-    }    
-    
+    }
+}
+
+/*
+    Flags
+    Every ALU op that touches the status register, over every A, operand and carry in, against the
+    flag rules written out longhand on a packed P byte.
+*/
+static uint8_t setFlag(uint8_t p, int condition, uint8_t mask) {
+    return condition ? p | mask : p & ~mask;
+}
+
+static uint8_t negZero(uint8_t p, uint8_t value) {
+    return setFlag(setFlag(p, value & 0x80, NEGATIVE_MASK), value == 0, ZERO_MASK);
+}
+
+static uint8_t referenceFlags(uint8_t opcode, uint8_t a, uint8_t m, uint8_t p, uint8_t * result) {
+    int carry = p & CARRY_MASK;
+    int sum;
+    switch(opcode) {
+        case 0xe9:      // SBC is ADC of the complement
+            m = ~m;
+            // fall through
+        case 0x69:
+            sum = a + m + carry;
+            *result = sum;
+            p = setFlag(p, ~(a ^ m) & (a ^ sum) & 0x80, OVERFLOW_MASK);
+            return negZero(setFlag(p, sum > 0xff, CARRY_MASK), sum);
+        case 0x29: *result = a & m; return negZero(p, a & m);
+        case 0x09: *result = a | m; return negZero(p, a | m);
+        case 0x49: *result = a ^ m; return negZero(p, a ^ m);
+        case 0xa9: *result = m; return negZero(p, m);
+        case 0xc9:      // CMP, CPX and CPY all get A, X or Y set to a
+        case 0xe0:
+        case 0xc0: *result = a; return negZero(setFlag(p, a >= m, CARRY_MASK), a - m);
+        case 0x24:
+            *result = a;
+            p = setFlag(setFlag(p, m & 0x40, OVERFLOW_MASK), m & 0x80, NEGATIVE_MASK);
+            return setFlag(p, (a & m) == 0, ZERO_MASK);
+        case 0x0a: *result = a << 1; return negZero(setFlag(p, a & 0x80, CARRY_MASK), a << 1);
+        case 0x4a: *result = a >> 1; return negZero(setFlag(p, a & 1, CARRY_MASK), a >> 1);
+        case 0x2a: *result = (a << 1) | carry; return negZero(setFlag(p, a & 0x80, CARRY_MASK), (a << 1) | carry);
+        case 0x6a: *result = (a >> 1) | (carry << 7); return negZero(setFlag(p, a & 1, CARRY_MASK), (a >> 1) | (carry << 7));
+    }
+    return p;
+}
+
+static void testFlags(void) {
+    static const uint8_t ops[] = { 0x69, 0xe9, 0x29, 0x09, 0x49, 0xa9, 0xc9, 0xe0, 0xc0, 0x24, 0x0a, 0x4a, 0x2a, 0x6a };
+    int wrong = 0;
+    for(int p = 0; p < 256; p++) {
+        setStatus(&cpu, p);
+        wrong += getStatus(&cpu) != p;
+    }
+    for(size_t i = 0; i < sizeof(ops); i++) {
+        for(int a = 0; a < 256; a++) {
+            for(int m = 0; m < 256; m++) {
+                for(int carry = 0; carry < 2; carry++) {
+                    uint8_t p = ((a * 31 + m * 7) & ~CARRY_MASK) | carry;     // the other flags should come through untouched
+                    uint8_t result;
+                    uint8_t expected = referenceFlags(ops[i], a, m, p, &result);
+                    writeRAM(0x0200, ops[i]);
+                    writeRAM(0x0201, ops[i] == 0x24 ? 0x10 : m);
+                    writeRAM(0x0010, m);
+                    cpu.pc = 0x0200;
+                    cpu.a = cpu.x = cpu.y = a;
+                    setStatus(&cpu, p);
+                    interpret(&cpu);
+                    uint8_t got = ops[i] == 0xe0 ? cpu.x : ops[i] == 0xc0 ? cpu.y : cpu.a;
+                    wrong += getStatus(&cpu) != expected || got != result;
+                }
+            }
+        }
+    }
+    CHECK(wrong == 0);
+
+    // B and U aren't real, pulling P drops B and U comes back set, like nestest.log has it
+    static const uint8_t pulls[][2] = { { 0xff, 0xef }, { 0x00, 0x20 } };
+    for(int i = 0; i < 2; i++) {
+        writeRAM(0x0200, 0x28);                 // PLP
+        cpu.pc = 0x0200;
+        cpu.sp = 0xfe;
+        writeRAM(0x01ff, pulls[i][0]);
+        interpret(&cpu);
+        CHECK(getStatus(&cpu) == pulls[i][1]);
+        writeRAM(0x0200, 0x40);                 // RTI
+        cpu.pc = 0x0200;
+        cpu.sp = 0xfc;
+        writeRAM(0x01fd, pulls[i][0]);
+        writeRAM(0x01fe, 0x00);
+        writeRAM(0x01ff, 0x03);
+        interpret(&cpu);
+        CHECK(getStatus(&cpu) == pulls[i][1] && cpu.pc == 0x0300);
+    }
+}
+
+// All eight branches against every combination of the four flags they test, both ways across a page
+static void testBranches(void) {
+    static const struct { uint8_t opcode; uint8_t mask; int when; } branches[] = {
+        { 0x10, NEGATIVE_MASK, 0 }, { 0x30, NEGATIVE_MASK, 1 }, { 0x50, OVERFLOW_MASK, 0 }, { 0x70, OVERFLOW_MASK, 1 },
+        { 0x90, CARRY_MASK, 0 }, { 0xb0, CARRY_MASK, 1 }, { 0xd0, ZERO_MASK, 0 }, { 0xf0, ZERO_MASK, 1 },
+    };
+    int wrong = 0;
+    for(size_t i = 0; i < sizeof(branches) / sizeof(branches[0]); i++) {
+        for(int p = 0; p < 256; p++) {
+            for(int offset = -128; offset < 128; offset += 5) {
+                uint16_t target = 0x0202 + offset;
+                writeRAM(0x0200, branches[i].opcode);
+                writeRAM(0x0201, offset);
+                cpu.pc = 0x0200;
+                setStatus(&cpu, p);
+                int taken = ((p & branches[i].mask) != 0) == branches[i].when;
+                int cycles = interpret(&cpu);
+                wrong += cpu.pc != (taken ? target : 0x0202);
+                wrong += cycles != 2 + taken + (taken && (target & 0xff00) != 0x0200);
+            }
+        }
+    }
+    CHECK(wrong == 0);
+}
+
+/*
+    Illegal opcodes
+    One instruction each from $0200 with ($40) pointing at $0510, registers and memory in, what should
+    come out and how long it takes: every unstable opcode, the stable illegal ones and a few unofficial
+    NOPs, then some legal ones with the same addressing modes to check the table against. Then every
+    opcode in the table has to take time and move pc on.
+*/
+struct vector {
+    uint8_t code[3];
+    uint8_t a, x, y, sp, p;
+    uint16_t address;               // memory the instruction reads, 0 for none
+    uint8_t value;
+    uint8_t out_a, out_x, out_y, out_sp, out_p;
+    uint16_t out_address;           // memory it writes, 0 for none
+    uint8_t out_value;
+    int cycles;
+};
+
+static const struct vector vectors[] = {
+    //  code                a     x     y     sp    p       in             a     x     y     sp    p       out            cycles
+    { { 0x0b, 0x80 },       0xff, 0x00, 0x00, 0xfd, 0x24,   0, 0,          0x80, 0x00, 0x00, 0xfd, 0xa5,   0, 0,          2 },  // ANC
+    { { 0x2b, 0x0f },       0xf0, 0x00, 0x00, 0xfd, 0x25,   0, 0,          0x00, 0x00, 0x00, 0xfd, 0x26,   0, 0,          2 },  // ANC
+    { { 0x4b, 0xff },       0x03, 0x00, 0x00, 0xfd, 0x24,   0, 0,          0x01, 0x00, 0x00, 0xfd, 0x25,   0, 0,          2 },  // ALR
+    { { 0x6b, 0xff },       0xc0, 0x00, 0x00, 0xfd, 0x25,   0, 0,          0xe0, 0x00, 0x00, 0xfd, 0xa5,   0, 0,          2 },  // ARR
+    { { 0x6b, 0xff },       0x40, 0x00, 0x00, 0xfd, 0x24,   0, 0,          0x20, 0x00, 0x00, 0xfd, 0x64,   0, 0,          2 },  // ARR
+    { { 0x8b, 0xff },       0x00, 0x55, 0x00, 0xfd, 0x24,   0, 0,          0x44, 0x55, 0x00, 0xfd, 0x24,   0, 0,          2 },  // ANE
+    { { 0xab, 0xf0 },       0x01, 0x00, 0x00, 0xfd, 0x24,   0, 0,          0xe0, 0xe0, 0x00, 0xfd, 0xa4,   0, 0,          2 },  // LXA
+    { { 0xcb, 0x05 },       0x0f, 0xf3, 0x00, 0xfd, 0x25,   0, 0,          0x0f, 0xfe, 0x00, 0xfd, 0xa4,   0, 0,          2 },  // SBX
+    { { 0xeb, 0x01 },       0x10, 0x00, 0x00, 0xfd, 0x25,   0, 0,          0x0f, 0x00, 0x00, 0xfd, 0x25,   0, 0,          2 },  // USBC
+    { { 0xbb, 0x10, 0x05 }, 0x00, 0x00, 0x10, 0xf0, 0x24,   0x0520, 0x3c,  0x30, 0x30, 0x10, 0x30, 0x24,   0, 0,          4 },  // LAS
+    { { 0x9e, 0x10, 0x05 }, 0x00, 0xff, 0x10, 0xfd, 0x24,   0, 0,          0x00, 0xff, 0x10, 0xfd, 0x24,   0x0520, 0x06,  5 },  // SHX
+    { { 0x9e, 0xf0, 0x04 }, 0x00, 0x03, 0x20, 0xfd, 0x24,   0, 0,          0x00, 0x03, 0x20, 0xfd, 0x24,   0x0110, 0x01,  5 },  // SHX across a page
+    { { 0x9c, 0x10, 0x05 }, 0x00, 0x10, 0xff, 0xfd, 0x24,   0, 0,          0x00, 0x10, 0xff, 0xfd, 0x24,   0x0520, 0x06,  5 },  // SHY
+    { { 0x9f, 0x10, 0x05 }, 0xff, 0x0f, 0x10, 0xfd, 0x24,   0, 0,          0xff, 0x0f, 0x10, 0xfd, 0x24,   0x0520, 0x06,  5 },  // SHA
+    { { 0x93, 0x40 },       0xf3, 0x3f, 0x10, 0xfd, 0x24,   0, 0,          0xf3, 0x3f, 0x10, 0xfd, 0x24,   0x0520, 0x02,  6 },  // SHA
+    { { 0x9b, 0x10, 0x05 }, 0xf7, 0x7f, 0x10, 0xfd, 0x24,   0, 0,          0xf7, 0x7f, 0x10, 0x77, 0x24,   0x0520, 0x06,  5 },  // TAS
+    { { 0x07, 0x41 },       0x01, 0x00, 0x00, 0xfd, 0x24,   0x0041, 0x85,  0x0b, 0x00, 0x00, 0xfd, 0x25,   0x0041, 0x0a,  5 },  // SLO
+    { { 0xc7, 0x41 },       0x04, 0x00, 0x00, 0xfd, 0x24,   0x0041, 0x05,  0x04, 0x00, 0x00, 0xfd, 0x27,   0x0041, 0x04,  5 },  // DCP
+    { { 0x27, 0x41 },       0xf0, 0x00, 0x00, 0xfd, 0x25,   0x0041, 0x85,  0x00, 0x00, 0x00, 0xfd, 0x27,   0x0041, 0x0b,  5 },  // RLA
+    { { 0x47, 0x41 },       0x81, 0x00, 0x00, 0xfd, 0x24,   0x0041, 0x03,  0x80, 0x00, 0x00, 0xfd, 0xa5,   0x0041, 0x01,  5 },  // SRE
+    { { 0x67, 0x41 },       0x10, 0x00, 0x00, 0xfd, 0x25,   0x0041, 0x02,  0x91, 0x00, 0x00, 0xfd, 0xa4,   0x0041, 0x81,  5 },  // RRA
+    { { 0xe7, 0x41 },       0x10, 0x00, 0x00, 0xfd, 0x25,   0x0041, 0x0f,  0x00, 0x00, 0x00, 0xfd, 0x27,   0x0041, 0x10,  5 },  // ISC
+    { { 0x87, 0x41 },       0xf0, 0x3c, 0x00, 0xfd, 0x24,   0, 0,          0xf0, 0x3c, 0x00, 0xfd, 0x24,   0x0041, 0x30,  3 },  // SAX
+    { { 0xa7, 0x41 },       0x00, 0x00, 0x00, 0xfd, 0x24,   0x0041, 0x80,  0x80, 0x80, 0x00, 0xfd, 0xa4,   0, 0,          3 },  // LAX
+    { { 0xbf, 0x10, 0x05 }, 0x55, 0x66, 0xf0, 0xfd, 0x24,   0x0600, 0x00,  0x00, 0x00, 0xf0, 0xfd, 0x26,   0, 0,          5 },  // LAX abs,Y across a page
+    { { 0x1a },             0x12, 0x34, 0x56, 0xfd, 0xe7,   0, 0,          0x12, 0x34, 0x56, 0xfd, 0xe7,   0, 0,          2 },  // NOP
+    { { 0x80, 0xff },       0x12, 0x34, 0x56, 0xfd, 0x24,   0, 0,          0x12, 0x34, 0x56, 0xfd, 0x24,   0, 0,          2 },  // NOP #imm
+    { { 0x04, 0x41 },       0x12, 0x34, 0x56, 0xfd, 0x24,   0, 0,          0x12, 0x34, 0x56, 0xfd, 0x24,   0, 0,          3 },  // NOP zp
+    { { 0x1c, 0xf0, 0x05 }, 0x12, 0x20, 0x56, 0xfd, 0x24,   0, 0,          0x12, 0x20, 0x56, 0xfd, 0x24,   0, 0,          5 },  // NOP abs,X across a page
+    { { 0xb1, 0x40 },       0x00, 0x00, 0xf0, 0xfd, 0x24,   0x0600, 0x80,  0x80, 0x00, 0xf0, 0xfd, 0xa4,   0, 0,          6 },  // LDA (zp),Y across a page
+    { { 0x69, 0x50 },       0x50, 0x00, 0x00, 0xfd, 0x24,   0, 0,          0xa0, 0x00, 0x00, 0xfd, 0xe4,   0, 0,          2 },  // ADC overflowing
+    { { 0x81, 0x40 },       0x5a, 0x00, 0x00, 0xfd, 0x24,   0, 0,          0x5a, 0x00, 0x00, 0xfd, 0x24,   0x0510, 0x5a,  6 },  // STA (zp,X)
+};
+
+static void testIllegal(void) {
+    for(size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        const struct vector * v = &vectors[i];
+        for(int j = 0; j < 3; j++) {
+            writeRAM(0x0200 + j, v->code[j]);
+        }
+        writeRAM(0x0040, 0x10);
+        writeRAM(0x0041, 0x05);
+        writeRAM(0x0520, 0);
+        writeRAM(0x0110, 0);
+        if(v->address) {
+            writeRAM(v->address, v->value);
+        }
+        cpu.pc = 0x0200;
+        cpu.a = v->a;
+        cpu.x = v->x;
+        cpu.y = v->y;
+        cpu.sp = v->sp;
+        setStatus(&cpu, v->p);
+        int cycles = interpret(&cpu);
+        if(cpu.a != v->out_a || cpu.x != v->out_x || cpu.y != v->out_y || cpu.sp != v->out_sp || getStatus(&cpu) != v->out_p
+           || cycles != v->cycles || (v->out_address && readRAM(v->out_address) != v->out_value)) {
+            printf("  %s (%02X): A:%02X X:%02X Y:%02X SP:%02X P:%02X in %d cycles\n", opcodes[v->code[0]].name, v->code[0],
+                   cpu.a, cpu.x, cpu.y, cpu.sp, getStatus(&cpu), cycles);
+            CHECK(!"illegal opcode vector");
+        }
+    }
+
+    // Every opcode takes time, and everything but the jumps and JAM carries on after itself
+    int wrong = 0;
+    for(int op = 0; op < 256; op++) {
+        writeRAM(0x0200, op);
+        writeRAM(0x0201, 0x00);
+        writeRAM(0x0202, 0x03);
+        cpu.pc = 0x0200;
+        cpu.sp = 0xfd;
+        setStatus(&cpu, 0x24);
+        uint64_t before = cpu.cycles;
+        int cycles = interpret(&cpu);
+        wrong += cycles < 2 || cycles != (int) (cpu.cycles - before) || cycles < opcodes[op].cycles;
+        int jumps = op == 0x00 || op == 0x20 || op == 0x40 || op == 0x4c || op == 0x60 || op == 0x6c
+                    || opcodes[op].mode == REL || strcmp(opcodes[op].name, "JAM") == 0;
+        wrong += !jumps && cpu.pc != 0x0200 + opcodes[op].length;
+    }
+    CHECK(wrong == 0);
+
+    // JAM stops there, burning the rest of the time with no NMIs, until a reset
+    initNES();
+    writeRAM(0x0200, 0x02);
+    writeRAM(0x2000, 0x80);
+    cpu.pc = 0x0200;
+    runCycles(60000);
+    CHECK(cpu.jammed && cpu.pc == 0x0200 && cpu.sp == 0xfd && cpu.cycles >= 60000);
+    writeRAM(0x2000, 0x00);
+    resetCPU(&cpu);
+    CHECK(!cpu.jammed);
+}
+
+/*
+    Mappers
+
+    The fake carts here have the number of every 8 KB PRG bank in its first byte and the number of
+    every 1 KB CHR bank in its first byte, so reading the start of a slot tells you what's mapped there.
+*/
+static uint8_t image[16 + 512 * 1024 + 256 * 1024];
+
+static void makeCart(int number, int prg_size, int chr_size, uint8_t flags6) {
+    memset(image, 0, sizeof(image));
+    memcpy(image, "NES\x1a", 4);
+    image[4] = prg_size / 0x4000;
+    image[5] = chr_size / 0x2000;
+    image[6] = flags6 | ((number & 0x0f) << 4);
+    image[7] = number & 0xf0;
+    for(int bank = 0; bank < prg_size / 0x2000; bank++) {
+        image[16 + bank * 0x2000] = bank;
+    }
+    for(int bank = 0; bank < chr_size / 0x400; bank++) {
+        image[16 + prg_size + bank * 0x400] = bank;
+    }
+    CHECK(parseROM(image, 16 + prg_size + chr_size, &cart) == ROM_OK);
+    CHECK(initMapper() == ROM_OK);
+}
+
+static uint8_t prgAt(uint16_t address) {
+    return readRAM(address);
+}
+
+static uint8_t chrAt(uint16_t address) {
+    return readVRAM(address);
+}
+
+static void testNROM(void) {
+    makeCart(0, 0x4000, 0x2000, 0x01);
+    CHECK(prgAt(0x8000) == 0);
+    CHECK(prgAt(0xa000) == 1);
+    CHECK(prgAt(0xc000) == 0);          // 16 KB mirrored
+    CHECK(prgAt(0xe000) == 1);
+    CHECK(chrAt(0x1c00) == 7);
+    writeRAM(0x8000, 0x55);             // ROM stays ROM
+    CHECK(prgAt(0x8000) == 0);
+    writeVRAM(0x2000, 0xaa);            // vertical: $2000 and $2800 are the same table
+    CHECK(readVRAM(0x2800) == 0xaa);
+    CHECK(readVRAM(0x2400) != 0xaa);
+}
+
+static void mmc1Load(uint16_t address, uint8_t value) {
+    for(int i = 0; i < 5; i++) {
+        writeRAM(address, value >> i);
+    }
+}
+
+static void testMMC1(void) {
+    makeCart(1, 0x40000, 0x20000, 0);
+    CHECK(prgAt(0x8000) == 0);          // powers up with the last 16 KB at $C000
+    CHECK(prgAt(0xc000) == 30);
+    CHECK(prgAt(0xe000) == 31);
+
+    mmc1Load(0xe000, 5);
+    CHECK(prgAt(0x8000) == 10);
+    CHECK(prgAt(0xa000) == 11);
+    CHECK(prgAt(0xc000) == 30);
+
+    mmc1Load(0x8000, 0x08 | 0x02);      // first bank fixed at $8000, vertical
+    CHECK(prgAt(0x8000) == 0);
+    CHECK(prgAt(0xc000) == 10);
+    writeVRAM(0x2400, 0x77);
+    CHECK(readVRAM(0x2c00) == 0x77);
+
+    mmc1Load(0x8000, 0x00);             // 32 KB mode drops the low bit, single screen
+    CHECK(prgAt(0x8000) == 8);
+    CHECK(prgAt(0xe000) == 11);
+    CHECK(readVRAM(0x2400) == readVRAM(0x2000));
+
+    mmc1Load(0xa000, 3);                // 8 KB CHR mode ignores the low bit
+    CHECK(chrAt(0x0000) == 8);
+    CHECK(chrAt(0x1c00) == 15);
+    mmc1Load(0x8000, 0x10);             // 4 KB CHR mode
+    mmc1Load(0xa000, 3);
+    mmc1Load(0xc000, 9);
+    CHECK(chrAt(0x0000) == 12);
+    CHECK(chrAt(0x1000) == 36);
+
+    writeRAM(0x8000, 1);                // partial load then reset, the next full load still lands
+    writeRAM(0x8000, 0x80);
+    CHECK(prgAt(0xc000) == 30);
+    mmc1Load(0xe000, 2);
+    CHECK(prgAt(0x8000) == 4);
+}
+
+static void testUxROM(void) {
+    makeCart(2, 0x20000, 0, 0);
+    CHECK(prgAt(0x8000) == 0);
+    CHECK(prgAt(0xc000) == 14);
+    writeRAM(0x8000, 3);
+    CHECK(prgAt(0x8000) == 6);
+    CHECK(prgAt(0xa000) == 7);
+    CHECK(prgAt(0xc000) == 14);
+    CHECK(prgAt(0xe000) == 15);
+    writeVRAM(0x0123, 0x42);            // CHR-RAM
+    CHECK(readVRAM(0x0123) == 0x42);
+}
+
+static void testCNROM(void) {
+    makeCart(3, 0x8000, 0x8000, 0);
+    CHECK(chrAt(0x0000) == 0);
+    writeRAM(0xffff, 2);
+    CHECK(chrAt(0x0000) == 16);
+    CHECK(chrAt(0x1c00) == 23);
+    CHECK(prgAt(0x8000) == 0);
+    CHECK(prgAt(0xe000) == 3);
+    writeVRAM(0x0000, 0x99);            // CHR-ROM
+    CHECK(chrAt(0x0000) == 16);
+}
+
+static void testMMC3(void) {
+    makeCart(4, 0x40000, 0x40000, 0);
+    CHECK(prgAt(0xc000) == 30);
+    CHECK(prgAt(0xe000) == 31);
+
+    uint8_t banks[8] = { 8, 10, 20, 21, 22, 23, 5, 9 };
+    for(int i = 0; i < 8; i++) {
+        writeRAM(0x8000, i);
+        writeRAM(0x8001, banks[i]);
+    }
+    CHECK(prgAt(0x8000) == 5);
+    CHECK(prgAt(0xa000) == 9);
+    CHECK(prgAt(0xc000) == 30);
+    CHECK(chrAt(0x0000) == 8);
+    CHECK(chrAt(0x0400) == 9);
+    CHECK(chrAt(0x0800) == 10);
+    CHECK(chrAt(0x1000) == 20);
+    CHECK(chrAt(0x1c00) == 23);
+
+    writeRAM(0x8000, 0xc0);             // swap both PRG and CHR layouts
+    CHECK(prgAt(0x8000) == 30);
+    CHECK(prgAt(0xc000) == 5);
+    CHECK(prgAt(0xe000) == 31);
+    CHECK(chrAt(0x0000) == 20);
+    CHECK(chrAt(0x1000) == 8);
+    CHECK(chrAt(0x1800) == 10);
+
+    writeRAM(0xa000, 1);                // horizontal
+    writeVRAM(0x2000, 0x31);
+    CHECK(readVRAM(0x2400) == 0x31);
+
+    writeRAM(0xc000, 2);                // IRQ after the counter runs down from 2
+    writeRAM(0xc001, 0);
+    writeRAM(0xe001, 0);
+    mapper->scanline();
+    mapper->scanline();
+    CHECK(!mapper_state.irq_pending);
+    mapper->scanline();
+    CHECK(mapper_state.irq_pending);
+    writeRAM(0xe000, 0);
+    CHECK(!mapper_state.irq_pending);
+}
+
+/*
+    Scheduler
+    The CPU spins on a JMP in RAM while events fire around it.
+*/
+static int fired;
+static uint64_t fired_at;
+
+static void countEvent(uint64_t when) {
+    fired++;
+    fired_at = cpu.cycles;
+    CHECK(when == 1000);
+}
+
+static void testScheduler(void) {
+    initNES();
+    cpu.pc = 0x0200;
+    writeRAM(0x0200, 0x4c);             // JMP $0200
+    writeRAM(0x0201, 0x00);
+    writeRAM(0x0202, 0x02);
+
+    fired = 0;
+    setEventHandler(EVENT_DMA, countEvent);
+    scheduleEvent(EVENT_DMA, 1000);
+    runCycles(2000);
+    CHECK(fired == 1);
+    CHECK(fired_at >= 1000 && fired_at < 1003);     // stops on the first instruction boundary past it
+    CHECK(cpu.cycles >= 2007 && cpu.cycles < 2010);
+
+    runFrame();                                     // first vblank is line 241 dot 1 after power on
+    CHECK(frameCount() == 1);
+    CHECK(cpu.cycles >= 27401 && cpu.cycles < 27404);
+    runFrame();
+    CHECK(frameCount() == 2);
+    CHECK(cpu.cycles >= 57182 && cpu.cycles < 57185);
+    setEventHandler(EVENT_DMA, NULL);
+}
+
+/*
+    Interrupts
+    Vectors point at $0300 for NMI and $0380 for IRQ/BRK, each handler counts itself into $10/$11.
+*/
+static void raiseFrameIRQ(uint64_t when) {
+    setIRQ(&cpu, IRQ_FRAME);
+}
+
+static void interruptCart(int number, int prg_size) {
+    makeCart(number, prg_size, 0, 0);
+    uint8_t * vectors = image + 16 + prg_size - 6;
+    memcpy(vectors, (uint8_t[]) { 0x00, 0x03, 0x00, 0x02, 0x80, 0x03 }, 6);   // NMI $0300, reset $0200, IRQ $0380
+    initNES();
+    static const uint8_t handlers[] = {
+        0xe6, 0x10,             // $0300  INC $10
+        0x40,                   //        RTI
+    };
+    static const uint8_t irq[] = {
+        0xe6, 0x11,             // $0380  INC $11
+        0x8d, 0x00, 0xe0,       //        STA $E000     MMC3 acknowledge
+        0x8d, 0x01, 0xe0,       //        STA $E001     and enable again
+        0x40,                   //        RTI
+    };
+    memcpy(&mmu.cpu_mem[0x300], handlers, sizeof(handlers));
+    memcpy(&mmu.cpu_mem[0x380], irq, sizeof(irq));
+    memcpy(&mmu.cpu_mem[0x200], (uint8_t[]) { 0x4c, 0x00, 0x02 }, 3);         // JMP $0200
+    mmu.cpu_mem[0x10] = 0;
+    mmu.cpu_mem[0x11] = 0;
+    flushBlocks();
+}
+
+static void testInterrupts(void) {
+    interruptCart(0, 0x8000);
+    CHECK(cpu.pc == 0x0200);                        // from $FFFC
+
+    // NMI latches on the edge, turning it off and on in vblank gives another, reading $2002 first doesn't
+    writeRAM(0x2000, 0x80);
+    runFrame();
+    runCycles(100);
+    CHECK(readRAM(0x10) == 1);
+    writeRAM(0x2000, 0x00);
+    writeRAM(0x2000, 0x80);
+    runCycles(100);
+    CHECK(readRAM(0x10) == 2);
+    writeRAM(0x2000, 0x81);                         // still high, so no edge
+    runCycles(100);
+    CHECK(readRAM(0x10) == 2);
+    writeRAM(0x2000, 0x00);
+    readRAM(0x2002);
+    writeRAM(0x2000, 0x80);
+    runCycles(100);
+    CHECK(readRAM(0x10) == 2);
+    writeRAM(0x2000, 0x00);
+
+    // The IRQ waits one more instruction after CLI
+    static const uint8_t cli[] = { 0x58, 0xe8, 0xe8, 0xe8 };                    // CLI, INX, INX, INX
+    memcpy(&mmu.cpu_mem[0x200], cli, sizeof(cli));
+    flushBlocks();
+    cpu.pc = 0x0200;
+    cpu.x = 0;
+    cpu.flags |= IRQ_MASK;
+    setIRQ(&cpu, IRQ_FRAME);
+    runCycles(2);
+    CHECK(cpu.pc == 0x0201);
+    runCycles(1);
+    CHECK(cpu.x == 1 && cpu.pc == 0x0380);
+    clearIRQ(&cpu, IRQ_FRAME);
+
+    // and still gets in straight after SEI, with I set in the pushed P
+    static const uint8_t sei[] = { 0x78, 0xe8 };                                // SEI, INX
+    memcpy(&mmu.cpu_mem[0x200], sei, sizeof(sei));
+    flushBlocks();
+    cpu.pc = 0x0200;
+    cpu.x = 0;
+    cpu.flags &= ~IRQ_MASK;
+    setEventHandler(EVENT_DMA, raiseFrameIRQ);
+    scheduleEvent(EVENT_DMA, cpu.cycles + 1);
+    runCycles(2);
+    CHECK(cpu.x == 0 && cpu.pc == 0x0380);
+    CHECK(mmu.cpu_mem[0x100 + (uint8_t) (cpu.sp + 1)] & IRQ_MASK);
+    clearIRQ(&cpu, IRQ_FRAME);
+    setEventHandler(EVENT_DMA, NULL);
+
+    // MMC3 every 21st scanline, 11 times down the visible lines, each on time without anything reading the PPU
+    interruptCart(4, 0x8000);
+    writeRAM(0x2001, 0x18);
+    writeRAM(0xc000, 20);
+    writeRAM(0xc001, 0);
+    writeRAM(0xe001, 0);
+    cpu.flags &= ~IRQ_MASK;
+    uint64_t first = (ppu.clock + 20 * DOTS_PER_LINE + 260 + 2) / 3;
+    while(readRAM(0x11) == 0) {
+        runCycles(1);
+    }
+    CHECK(cpu.cycles > first && cpu.cycles < first + 7 + 5 + 3);    // the last JMP, the IRQ itself and INC $11
+    runFrame();
+    CHECK(readRAM(0x11) == 11);
+    writeRAM(0xe000, 0);
+}
+
+/*
+    Block cache
+    Code that rewrites itself, and the same address in two banks, both have to run what's there now.
+*/
+static void testBlockCache(void) {
+    static const uint8_t code[] = {
+        0xee, 0x06, 0x03,       // $0300  INC $0306
+        0xa9, 0xaa,             //        LDA #$AA
+        0x85, 0x10,             //        STA $10       the INC just moved this along, in the same block
+        0x4c, 0x00, 0x03,       //        JMP $0300
+    };
+    initNES();
+    for(size_t i = 0; i < sizeof(code); i++) {
+        writeRAM(0x0300 + i, code[i]);
+    }
+    for(int i = 0x10; i < 0x20; i++) {
+        writeRAM(i, 0);
+    }
+    cpu.pc = 0x0300;
+    runCPU(&cpu, 14);
+    CHECK(readRAM(0x10) == 0 && readRAM(0x11) == 0xaa);
+    runCPU(&cpu, 14 * 3);
+    CHECK(readRAM(0x14) == 0xaa && readRAM(0x15) == 0);
+
+    // A write between two runs, then another block on the same page traps it again before the first one comes round
+    writeRAM(0x0400, 0xa5);     // $0400  LDA $20
+    writeRAM(0x0401, 0x20);
+    writeRAM(0x0410, 0xea);     // $0410  NOP
+    writeRAM(0x20, 0x11);
+    writeRAM(0x21, 0x22);
+    cpu.pc = 0x0400;
+    runCPU(&cpu, 3);
+    CHECK(cpu.a == 0x11);
+    writeRAM(0x0401, 0x21);     //        LDA $21
+    cpu.pc = 0x0410;
+    runCPU(&cpu, 2);
+    cpu.pc = 0x0400;
+    runCPU(&cpu, 3);
+    CHECK(cpu.a == 0x22);
+
+    // Same address, different code in each bank
+    makeCart(2, 0x20000, 0, 0);
+    uint8_t * prg = image + 16;
+    memcpy(prg, (uint8_t[]) { 0xa9, 0xa0, 0x60 }, 3);                                          // $8000  LDA #$A0, RTS
+    memcpy(prg + 0x4000, (uint8_t[]) { 0xea, 0xa9, 0xa1, 0x60 }, 4);                           // $8000  NOP, LDA #$A1, RTS
+    memcpy(prg + 7 * 0x4000, (uint8_t[]) { 0x20, 0x00, 0x80, 0x85, 0x10, 0x4c, 0x00, 0xc0 }, 8);  // $C000  JSR $8000, STA $10, JMP $C000
+    cpu.pc = 0xc000;
+    writeRAM(0x8000, 0);
+    runCPU(&cpu, 20);
+    CHECK(readRAM(0x10) == 0xa0);
+    writeRAM(0x8000, 1);
+    runCPU(&cpu, 22);
+    CHECK(readRAM(0x10) == 0xa1);
+}
+
+/*
+    Idle loops
+    Each program runs with skipping on and off, which has to end with the same registers at the same cycle.
+*/
+static void runIdle(const uint8_t * code, size_t size, uint8_t mask, int skipping, void (* setup)(void), struct nesCPU * out) {
+    initNES();
+    for(size_t i = 0; i < size; i++) {
+        writeRAM(0x0300 + i, code[i]);
+    }
+    writeRAM(0x0010, 0);
+    writeRAM(0x2003, 0);
+    for(int i = 0; i < 256; i++) {
+        writeRAM(0x2004, 0);            // every sprite on lines 1-8, so sprite overflow goes up there
+    }
+    if(setup) {
+        setup();
+    }
+    writeRAM(0x2001, mask);
+    cpu.pc = 0x0300;
+    idle_skipping = skipping;
+    idle_cycles = 0;
+    runCycles(100000);
+    *out = cpu;
+    idle_skipping = 1;
+}
+
+// Nametable rows 12 and 13, lines 96-111, where sprite 0 goes below
+static void fillRows(uint8_t tile) {
+    writeRAM(0x2006, 0x21);
+    writeRAM(0x2006, 0x80);
+    for(int i = 0; i < 64; i++) {
+        writeRAM(0x2007, tile);
+    }
+}
+
+/*
+    A solid background under sprite 0 on lines 101-108 at x 50, with nothing in its top 6 rows,
+    so the hit comes 6 lines below the first line it covers. The rest of OAM is left on lines 1-8 so
+    overflow is already up by then, or moved off the screen.
+*/
+static void sprite0Scene(void) {
+    writeRAM(0x2006, 0x00);
+    writeRAM(0x2006, 0x10);
+    for(int i = 0; i < 8; i++) {
+        writeRAM(0x2007, 0xff);         // tile 1 solid
+    }
+    for(int i = 0; i < 8; i++) {
+        writeRAM(0x2007, 0x00);
+    }
+    for(int i = 0; i < 8; i++) {
+        writeRAM(0x2007, i >= 6 ? 0xff : 0x00);     // tile 2 only its bottom two rows
+    }
+    fillRows(0x01);
+    writeRAM(0x2000, 0x00);
+    writeRAM(0x2006, 0x00);
+    writeRAM(0x2006, 0x00);
+    writeRAM(0x2003, 0);
+    writeRAM(0x2004, 100);
+    writeRAM(0x2004, 2);
+    writeRAM(0x2004, 0);
+    writeRAM(0x2004, 50);
+}
+
+static void sprite0Alone(void) {
+    sprite0Scene();
+    for(int i = 4; i < 256; i += 4) {
+        writeRAM(0x2003, i);
+        writeRAM(0x2004, 0xff);
+    }
+}
+
+static void testIdleLoops(void) {
+    static const uint8_t poll[] = {
+        0xa5, 0x10,             // $0300  LDA $10
+        0xf0, 0xfc,             //        BEQ $0300
+    };
+    static const uint8_t vblank[] = {
+        0x2c, 0x02, 0x20,       // $0300  BIT $2002
+        0x10, 0xfb,             //        BPL $0300
+        0xe8,                   //        INX
+        0x4c, 0x00, 0x03,       //        JMP $0300
+    };
+    static const uint8_t overflow[] = {
+        0xad, 0x02, 0x20,       // $0300  LDA $2002
+        0x29, 0x20,             //        AND #$20
+        0xf0, 0xf9,             //        BEQ $0300
+        0xe8,                   //        INX
+        0x4c, 0x00, 0x03,       //        JMP $0300
+    };
+    static const uint8_t sprite0[] = {
+        0x2c, 0x02, 0x20,       // $0300  BIT $2002
+        0x50, 0xfb,             //        BVC $0300
+        0xe8,                   //        INX
+        0xc8,                   // $0306  INY           how long from the hit to vblank
+        0x2c, 0x02, 0x20,       //        BIT $2002
+        0x10, 0xfa,             //        BPL $0306
+        0x2c, 0x02, 0x20,       // $030c  BIT $2002     and wait for pre-render to clear it
+        0x70, 0xfb,             //        BVS $030c
+        0x4c, 0x00, 0x03,       //        JMP $0300
+    };
+    struct nesCPU skipped, ran;
+    runIdle(poll, sizeof(poll), 0, 1, NULL, &skipped);
+    CHECK(idle_cycles > 90000 || !NYMPH_BLOCK_CACHE);
+    runIdle(poll, sizeof(poll), 0, 0, NULL, &ran);
+    CHECK(idle_cycles == 0);
+    CHECK(skipped.cycles == ran.cycles && skipped.pc == ran.pc);
+
+    for(int mask = 0; mask <= 0x1e; mask += 0x1e) {     // rendering off then on
+        runIdle(vblank, sizeof(vblank), mask, 1, NULL, &skipped);
+        CHECK(idle_cycles > 0 || !NYMPH_BLOCK_CACHE);
+        runIdle(vblank, sizeof(vblank), mask, 0, NULL, &ran);
+        CHECK(skipped.x == 3 && ran.x == 3);
+        CHECK(skipped.cycles == ran.cycles && skipped.pc == ran.pc && getStatus(&skipped) == getStatus(&ran));
+    }
+
+    // Overflow goes up partway down the frame and nothing schedules an event for it
+    runIdle(overflow, sizeof(overflow), 0x1e, 1, NULL, &skipped);
+    CHECK(idle_cycles > 0 || !NYMPH_BLOCK_CACHE);
+    runIdle(overflow, sizeof(overflow), 0x1e, 0, NULL, &ran);
+    CHECK(skipped.x == ran.x && skipped.cycles == ran.cycles && skipped.pc == ran.pc);
+
+    // Sprite 0 hitting lower down than its first line, on its own and with overflow already up
+    void (* scenes[])(void) = { sprite0Alone, sprite0Scene };
+    for(int i = 0; i < 2; i++) {
+        runIdle(sprite0, sizeof(sprite0), 0x1e, 1, scenes[i], &skipped);
+        CHECK(idle_cycles > 0 || !NYMPH_BLOCK_CACHE);
+        runIdle(sprite0, sizeof(sprite0), 0x1e, 0, scenes[i], &ran);
+        CHECK(ran.x == 3);
+        CHECK(skipped.x == ran.x && skipped.y == ran.y && skipped.cycles == ran.cycles && skipped.pc == ran.pc && getStatus(&skipped) == getStatus(&ran));
+    }
+    fillRows(0x00);
+}
+
+/*
+    Pixel kernels
+    Whatever vector paths this build has against the scalar ones, at every count so each block size and
+    the leftovers get a go.
+*/
+static void testPixels(void) {
+    uint8_t planes[80];
+    uint8_t scalar[40 * 8];
+    uint8_t vector[40 * 8];
+    uint32_t table[32];
+    uint32_t scalar_argb[40];
+    uint32_t vector_argb[40];
+    for(int i = 0; i < 80; i++) {
+        planes[i] = i * 73 + 11;
+    }
+    for(int i = 0; i < 32; i++) {
+        table[i] = 0xff000000 | (i * 0x9e3779u >> 3);
+    }
+    int wrong = 0;
+    for(int count = 0; count <= 40; count++) {
+        memset(vector, 0xee, sizeof(vector));
+        memset(scalar, 0xee, sizeof(scalar));
+        decodeRowsScalar(planes, planes + 40, scalar, count);
+        decodeRows(planes, planes + 40, vector, count);
+        wrong += memcmp(scalar, vector, sizeof(scalar)) != 0;
+        memset(vector_argb, 0xee, sizeof(vector_argb));
+        memset(scalar_argb, 0xee, sizeof(scalar_argb));
+        lookupColoursScalar(planes, table, scalar_argb, count);         // bits 5-7 of the indexes are set too and have to be ignored
+        lookupColours(planes, table, vector_argb, count);
+        wrong += memcmp(scalar_argb, vector_argb, sizeof(scalar_argb)) != 0;
+    }
+    CHECK(wrong == 0);
+}
+
+/*
+    PPU
+    One solid tile in the top left corner with sprite 0 over it, NMIs counted in $10 by INC $10 / RTI at $0300.
+*/
+static void testPPU(void) {
+    makeCart(2, 0x8000, 0, 0x01);
+    image[16 + 0x8000 - 6] = 0x00;                  // NMI vector
+    image[16 + 0x8000 - 5] = 0x03;
+    initNES();
+    cpu.pc = 0x0200;
+    writeRAM(0x0200, 0x4c);                         // JMP $0200
+    writeRAM(0x0201, 0x00);
+    writeRAM(0x0202, 0x02);
+    writeRAM(0x0300, 0xe6);                         // INC $10
+    writeRAM(0x0301, 0x10);
+    writeRAM(0x0302, 0x40);                         // RTI
+    writeRAM(0x0010, 0);
+
+    writeRAM(0x2006, 0x00);                         // tile 1 is all colour 3
+    writeRAM(0x2006, 0x10);
+    for(int i = 0; i < 16; i++) {
+        writeRAM(0x2007, 0xff);
+    }
+    writeRAM(0x2006, 0x20);
+    writeRAM(0x2006, 0x00);
+    writeRAM(0x2007, 0x01);
+    writeRAM(0x2006, 0x3f);
+    writeRAM(0x2006, 0x00);
+    writeRAM(0x2007, 0x0f);
+    writeRAM(0x2007, 0x00);
+    writeRAM(0x2007, 0x00);
+    writeRAM(0x2007, 0x30);
+    writeRAM(0x2006, 0x20);                         // reading back goes through the buffer
+    writeRAM(0x2006, 0x00);
+    readRAM(0x2007);
+    CHECK(readRAM(0x2007) == 0x01);
+
+    writeRAM(0x2003, 0);                            // sprite 0 on lines 1-8 at x 4
+    writeRAM(0x2004, 0);
+    writeRAM(0x2004, 1);
+    writeRAM(0x2004, 0);
+    writeRAM(0x2004, 4);
+    writeRAM(0x2005, 0);
+    writeRAM(0x2005, 0);
+    writeRAM(0x2001, 0x1e);
+    writeRAM(0x2000, 0x80);
+
+    runFrame();
+    runFrame();
+    runFrame();
+    CHECK(ppu.framebuffer[0] == 0xfffffeff);
+    CHECK(ppu.framebuffer[4] == 0xfffffeff);
+    CHECK(ppu.framebuffer[SCREEN_WIDTH + 4] == 0xff666666);    // sprite palette left at $00
+    CHECK(ppu.framebuffer[8] == 0xff000000);
+    CHECK(ppu.framebuffer[8 * SCREEN_WIDTH] == 0xff000000);
+    CHECK((readRAM(0x2002) & 0xc0) == 0xc0);
+    CHECK((readRAM(0x2002) & 0x80) == 0);           // reading clears vblank
+    CHECK(readRAM(0x0010) == 2);                    // the third NMI hasn't run its INC yet
+    runFrame();
+    CHECK(readRAM(0x0010) == 3);
+
+    writeRAM(0x2006, 0x00);                         // redraw tile 1 as colour 1, the cached copy has to go
+    writeRAM(0x2006, 0x18);
+    for(int i = 0; i < 8; i++) {
+        writeRAM(0x2007, 0x00);
+    }
+    writeRAM(0x2005, 0);                            // and put the scroll back like a game would
+    writeRAM(0x2005, 0);
+    writeRAM(0x2000, 0x80);
+    runFrame();
+    CHECK(ppu.framebuffer[0] == 0xff666666);
+
+    // The sprite 0 wake up follows rendering coming on and sprite 0 moving partway down a frame
+    writeRAM(0x2001, 0x00);
+    runCycles(3000);                                // a few lines into the next frame
+    CHECK(eventTime(EVENT_SPRITE0) == EVENT_NEVER);
+    writeRAM(0x2003, 0);
+    writeRAM(0x2004, 100);                          // down to lines 101-108
+    writeRAM(0x2001, 0x1e);
+    uint64_t lower = eventTime(EVENT_SPRITE0);
+    CHECK(lower != EVENT_NEVER && lower > cpu.cycles);
+    memcpy(&mmu.cpu_mem[0x700], (uint8_t[]) { 20, 1, 0, 4 }, 4);
+    writeRAM(0x4014, 0x07);                         // and back up to lines 21-28 by DMA
+    uint64_t when = eventTime(EVENT_SPRITE0);
+    CHECK(when < lower && when > cpu.cycles);
+    runCycles(when - cpu.cycles);
+    catchUpPPU(cpu.cycles);
+    CHECK(ppu.line == 21);
+    CHECK(eventTime(EVENT_SPRITE0) > when && eventTime(EVENT_SPRITE0) != EVENT_NEVER);   // nothing under it there, so on to the next line
+    runFrame();
+}
+
+/*
+    APU
+    What the CPU can see from $4015 and the IRQs, then a 440 Hz square wave has to come out at 440 Hz.
+*/
+static void testAPU(void) {
+    interruptCart(0, 0x8000);                       // JMP $0200 with I set, so the IRQs just sit on the line
+    static int16_t samples[4096];
+
+    // Frame counter, four step mode sets the IRQ at the end unless it's inhibited
+    writeRAM(0x4017, 0x00);
+    uint64_t start = apu.frame_start;
+    runCycles(start + 29829 - 10 - cpu.cycles);
+    CHECK(!(cpu.irq_lines & IRQ_FRAME));
+    runCycles(20);
+    CHECK(cpu.irq_lines & IRQ_FRAME);
+    CHECK(readRAM(0x4015) & 0x40);
+    CHECK(!(cpu.irq_lines & IRQ_FRAME) && !(readRAM(0x4015) & 0x40));     // reading acknowledges it
+    writeRAM(0x4017, 0x40);
+    runCycles(40000);
+    CHECK(!(cpu.irq_lines & IRQ_FRAME));
+
+    // Length counters go down on half frames, only load while enabled, and five step mode clocks straight away
+    writeRAM(0x4015, 0x01);
+    writeRAM(0x4000, 0x00);
+    writeRAM(0x4003, 0x18);                         // length 2
+    writeRAM(0x4007, 0x18);
+    CHECK((readRAM(0x4015) & 0x0f) == 0x01);
+    start = apu.frame_start;
+    runCycles(start + 14913 + 10 - cpu.cycles);
+    CHECK(readRAM(0x4015) & 0x01);
+    runCycles(15000);
+    CHECK(!(readRAM(0x4015) & 0x01));
+    writeRAM(0x4003, 0x18);
+    writeRAM(0x4017, 0xc0);
+    CHECK(readRAM(0x4015) & 0x01);
+    writeRAM(0x4017, 0xc0);
+    CHECK(!(readRAM(0x4015) & 0x01));
+
+    // DMC, a one byte sample is fetched straight away, stalls the CPU and raises its IRQ at the end
+    image[16 + 0x4000] = 0x55;                      // $C000
+    writeRAM(0x4010, 0x8f);
+    writeRAM(0x4012, 0x00);
+    writeRAM(0x4013, 0x00);
+    uint64_t before = cpu.cycles;
+    writeRAM(0x4015, 0x10);
+    CHECK(cpu.cycles == before + 4);
+    CHECK((readRAM(0x4015) & 0x90) == 0x80 && (cpu.irq_lines & IRQ_DMC));
+    writeRAM(0x4015, 0x00);
+    CHECK(!(readRAM(0x4015) & 0x80) && !(cpu.irq_lines & IRQ_DMC));
+    writeRAM(0x4010, 0x4f);                         // looping never ends or interrupts
+    writeRAM(0x4013, 0x01);
+    writeRAM(0x4015, 0x10);
+    runCycles(20000);                               // 17 bytes at 54 cycles a bit goes round a few times
+    CHECK((readRAM(0x4015) & 0x90) == 0x10 && !(cpu.irq_lines & IRQ_DMC));
+    writeRAM(0x4015, 0x00);
+    CHECK(!(readRAM(0x4015) & 0x10));
+
+    // Sound, two frames of 440 Hz at 48 kHz
+    interruptCart(0, 0x8000);
+    writeRAM(0x4017, 0x40);
+    writeRAM(0x4015, 0x01);
+    writeRAM(0x4000, 0xbf);                         // 50% duty, constant volume 15
+    writeRAM(0x4002, 0xfd);                         // 1789773 / (16 * 254)
+    writeRAM(0x4003, 0x00);
+    start = cpu.cycles;
+    runFrame();
+    runFrame();
+    int count = readSamples(samples, 4096);
+    int expected = (cpu.cycles - start) * (double) APU_SAMPLE_RATE / APU_CLOCK_RATE;
+    CHECK(count >= expected - 2 && count <= expected + 2);
+    int crossings = 0;
+    int peak = 0;
+    for(int i = APU_SAMPLE_RATE / 100; i < count; i++) {
+        crossings += samples[i - 1] < 0 && samples[i] >= 0;
+        peak = samples[i] > peak ? samples[i] : peak;
+    }
+    double seconds = (count - APU_SAMPLE_RATE / 100) / (double) APU_SAMPLE_RATE;
+    CHECK(crossings >= 440 * seconds - 2 && crossings <= 440 * seconds + 2);
+    CHECK(peak > 1000);
+    CHECK(samplesAvailable() == 0);
+}
+
+/*
+    Sound off and mutes
+    The same APU workout three times, with sound, without, and with it flipped about and channels muted
+    along the way. Everything the CPU can see has to come out the same every time.
+*/
+#define WORKOUT_STEPS 64
+
+static void apuWorkout(int mode, uint64_t * seen) {
+    interruptCart(0, 0x8000);
+    image[16 + 0x4000] = 0xa5;
+    setAudioEnabled(mode != 1);
+    setChannelMutes(0);
+    static const uint8_t writes[][2] = {
+        { 0x15, 0x1f }, { 0x00, 0x3f }, { 0x03, 0x20 }, { 0x04, 0x9f }, { 0x07, 0x48 }, { 0x08, 0x20 },
+        { 0x0b, 0x10 }, { 0x0c, 0x1c }, { 0x0f, 0x30 }, { 0x10, 0x8e }, { 0x12, 0x00 }, { 0x13, 0x02 },
+        { 0x15, 0x1f }, { 0x17, 0x00 }, { 0x11, 0x40 }, { 0x17, 0x80 }, { 0x03, 0x08 }, { 0x15, 0x0b },
+    };
+    for(int step = 0; step < WORKOUT_STEPS; step++) {
+        const uint8_t * w = writes[step % (sizeof(writes) / sizeof(writes[0]))];
+        writeRAM(0x4000 + w[0], w[1]);
+        if(mode == 2 && step % 8 == 3) {
+            setAudioEnabled(step % 16 != 3);
+            setChannelMutes(step * 5);
+        }
+        runCycles(1000 + step * 997);
+        seen[step] = cpu.cycles << 16 | cpu.irq_lines << 8 | readRAM(0x4015);
+        if(step % 8 == 0) {
+            runFrame();
+        }
+    }
+    setAudioEnabled(1);
+}
+
+static void testAudioOff(void) {
+    static uint64_t seen[3][WORKOUT_STEPS];
+    for(int mode = 0; mode < 3; mode++) {
+        apuWorkout(mode, seen[mode]);
+    }
+    CHECK(memcmp(seen[0], seen[1], sizeof(seen[0])) == 0);
+    CHECK(memcmp(seen[0], seen[2], sizeof(seen[0])) == 0);
+
+    // Nothing comes out with it off, and muting the only channel playing is as good as silence
+    interruptCart(0, 0x8000);
+    setAudioEnabled(0);
+    writeRAM(0x4015, 0x01);
+    writeRAM(0x4000, 0xbf);
+    writeRAM(0x4002, 0xfd);
+    writeRAM(0x4003, 0x00);
+    runFrame();
+    CHECK(samplesAvailable() == 0);
+
+    static int16_t samples[2048];
+    int peaks[3];
+    for(int pass = 0; pass < 3; pass++) {
+        setAudioEnabled(1);                         // picks the tone up from the registers
+        setChannelMutes(pass == 1 ? MUTE_PULSE_1 : pass == 2 ? MUTE_PULSE_2 : 0);
+        runFrame();
+        runFrame();
+        int count = readSamples(samples, 2048);
+        peaks[pass] = 0;
+        for(int i = count / 2; i < count; i++) {    // after the high-pass has settled
+            int level = samples[i] < 0 ? -samples[i] : samples[i];
+            peaks[pass] = level > peaks[pass] ? level : peaks[pass];
+        }
+    }
+    CHECK(peaks[0] > 1000 && peaks[2] > 1000);
+    CHECK(peaks[1] < 50);
+    setChannelMutes(0);
+}
+
+/*
+    Save states
+    An MMC3 cart with CHR-RAM running code out of RAM with NMIs, mapper IRQs, rendering and sound all
+    going. Loading a state and running on has to end up exactly where running on from the save did,
+    even after the code in RAM was changed in between.
+*/
+struct snapshot {
+    struct nesCPU cpu;
+    uint8_t ram[CPU_MEM_SIZE];
+    struct nymphAPU apu;
+    uint64_t frame;
+    uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+};
+
+static void takeSnapshot(struct snapshot * s) {
+    s->cpu = cpu;
+    memcpy(s->ram, mmu.cpu_mem, CPU_MEM_SIZE);
+    s->apu = apu;
+    s->frame = ppu.frame;
+    memcpy(s->pixels, ppu.framebuffer, sizeof(s->pixels));
+}
+
+static int sameSnapshot(const struct snapshot * a, const struct snapshot * b) {
+    return a->cpu.pc == b->cpu.pc && a->cpu.cycles == b->cpu.cycles && a->cpu.a == b->cpu.a
+        && getStatus(&a->cpu) == getStatus(&b->cpu) && a->cpu.irq_lines == b->cpu.irq_lines
+        && memcmp(a->ram, b->ram, CPU_MEM_SIZE) == 0 && memcmp(&a->apu, &b->apu, sizeof(a->apu)) == 0
+        && a->frame == b->frame && memcmp(a->pixels, b->pixels, sizeof(a->pixels)) == 0;
+}
+
+// Everything going at once, two frames in and partway through the third
+static void busyMachine(void) {
+    interruptCart(4, 0x8000);
+    static const uint8_t loop[] = {
+        0xe6, 0x20,             // $0200  INC $20
+        0xa5, 0x20,             //        LDA $20
+        0x8d, 0x02, 0x40,       //        STA $4002
+        0x8d, 0x07, 0x20,       //        STA $2007     CHR-RAM, through the tile cache
+        0xad, 0x02, 0x20,       //        LDA $2002
+        0x4c, 0x00, 0x02,       //        JMP $0200
+    };
+    memcpy(&mmu.cpu_mem[0x200], loop, sizeof(loop));
+    flushBlocks();
+    writeRAM(0x4017, 0x40);                         // the handler doesn't acknowledge frame IRQs
+    writeRAM(0x4015, 0x01);
+    writeRAM(0x4000, 0xbf);
+    writeRAM(0x4003, 0x00);
+    writeRAM(0xc000, 20);                           // MMC3 IRQ every 21 lines
+    writeRAM(0xc001, 0);
+    writeRAM(0xe001, 0);
+    writeRAM(0x2000, 0x80);                         // NMI on
+    writeRAM(0x2001, 0x18);                         // rendering on
+    cpu.flags &= ~IRQ_MASK;
+    runFrame();
+    runFrame();
+    runCycles(1234);                                // somewhere in the middle of a frame
+}
+
+static void testSaveState(void) {
+    static uint8_t state[32768];
+    static struct snapshot after;
+    static struct snapshot again;
+    busyMachine();
+
+    size_t size = saveState(state, sizeof(state));
+    CHECK(size > 0 && size <= stateSize());
+    static uint8_t twice[32768];
+    CHECK(saveState(twice, sizeof(twice)) == size && memcmp(state, twice, size) == 0);     // nothing left over in the padding
+    for(int i = 0; i < 5; i++) {
+        runFrame();
+    }
+    takeSnapshot(&after);
+    CHECK(mmu.cpu_mem[0x10] > 0 && mmu.cpu_mem[0x11] > 0);     // NMIs and IRQs both happened
+
+    writeRAM(0x0201, 0x21);                         // INC $21 now, and run it so it's what's decoded
+    writeRAM(0x8000, 0x06);                         // and another bank at $8000
+    writeRAM(0x8001, 0x02);
+    runFrame();
+    CHECK(prgAt(0x8000) == 2);
+    CHECK(loadState(state, size) == STATE_OK);
+    CHECK(mmu.cpu_mem[0x201] == 0x20 && prgAt(0x8000) == 0);
+    for(int i = 0; i < 5; i++) {
+        runFrame();
+    }
+    takeSnapshot(&again);
+    CHECK(sameSnapshot(&after, &again));
+
+    // The same state loads as many times as you like
+    CHECK(loadState(state, size) == STATE_OK);
+    for(int i = 0; i < 5; i++) {
+        runFrame();
+    }
+    takeSnapshot(&again);
+    CHECK(sameSnapshot(&after, &again));
+
+    // PRG-RAM only goes in once something's been written there
+    mmu.prg_ram[0x123] = 0x45;
+    size_t bigger = saveState(state, sizeof(state));
+    CHECK(bigger == size + PRG_RAM_SIZE);
+    mmu.prg_ram[0x123] = 0;
+    CHECK(loadState(state, bigger) == STATE_OK && readRAM(0x6123) == 0x45);
+    CHECK(saveState(state, bigger - 1) == 0);
+
+    // Broken ones get turned away and leave everything alone
+    saveState(state, sizeof(state));
+    uint64_t cycles = cpu.cycles;
+    CHECK(loadState(state, 10) == STATE_TOO_SMALL);
+    CHECK(loadState(state, bigger - 1) == STATE_BAD_SIZE);
+    state[4] ^= 0xff;
+    CHECK(loadState(state, bigger) == STATE_BAD_VERSION);
+    state[4] ^= 0xff;
+    state[0] = 'X';
+    CHECK(loadState(state, bigger) == STATE_BAD_MAGIC);
+    state[0] = 'N';
+    CHECK(cpu.cycles == cycles);
+
+    // A CHR-ROM NROM cart, which is most of what's needed for the small ones
+    makeCart(0, 0x8000, 0x2000, 0);
+    initNES();
+    memset(mmu.prg_ram, 0, PRG_RAM_SIZE);
+    CHECK(loadState(state, bigger) == STATE_WRONG_CART);
+    size = saveState(state, sizeof(state));
+    CHECK(size > 4000 && size < 5000);
+    CHECK(loadState(state, size) == STATE_OK);
+}
+
+/*
+    Rewind
+    Each frame of the same busy machine gets pushed and its RAM kept on the side. Going back has to land
+    on exactly the frame asked for, and running on from there has to come out the same as it did the
+    first time. A buffer too small for the run has to drop the oldest frames and still get the rest
+    right while PRG-RAM comes and goes from the state.
+*/
+#define REWIND_RUN 200
+
+// A hash of the whole state rather than the whole state, there are a lot of them
+struct rewind_check {
+    size_t size;
+    uint64_t hash;
+};
+
+static struct rewind_check checks[REWIND_RUN];
+
+static struct rewind_check stateCheck(void) {
+    static uint8_t state[32768];
+    struct rewind_check c = { saveState(state, sizeof(state)), 0xcbf29ce484222325 };
+    for(size_t i = 0; i < c.size; i++) {
+        c.hash = (c.hash ^ state[i]) * 0x100000001b3;
+    }
+    return c;
+}
+
+static int matchesCheck(const struct rewind_check * c) {
+    struct rewind_check now = stateCheck();
+    return now.size == c->size && now.hash == c->hash;
+}
+
+static void testRewind(void) {
+    struct rewind_buffer r;
+    busyMachine();
+    CHECK(rewindInit(&r, (size_t) REWIND_MAX_BYTES + 1) == -1);     // offsets past 4 GB won't fit an entry
+    CHECK(rewindInit(&r, 1 << 20) == 0);
+    CHECK(rewindSeek(&r, 1) == -1);
+    for(int i = 0; i < 120; i++) {
+        CHECK(rewindPush(&r) == 0);
+        checks[i] = stateCheck();
+        runFrame();
+    }
+    CHECK(rewindFrames(&r) == 119);
+    CHECK(rewindUsed(&r) < stateSize() + 119 * 1000);     // nowhere near a whole state a frame
+    CHECK(rewindSeek(&r, 30) == 30 && matchesCheck(&checks[89]));
+    runFrame();
+    CHECK(matchesCheck(&checks[90]));
+    CHECK(rewindSeek(&r, 0) == 0 && matchesCheck(&checks[89]));
+    CHECK(rewindSeek(&r, -5) == 0 && matchesCheck(&checks[89]));
+    CHECK(rewindFrames(&r) == 89);
+    for(int i = 89; i < 120; i++) {             // and on again from there the same as before
+        CHECK(matchesCheck(&checks[i]));
+        if(i > 89) {
+            CHECK(rewindPush(&r) == 0);
+        }
+        runFrame();
+    }
+    CHECK(rewindFrames(&r) == 119);
+    CHECK(rewindSeek(&r, 1000) == 119 && matchesCheck(&checks[0]));
+    rewindFree(&r);
+
+    // Small enough to go round a few times
+    busyMachine();
+    CHECK(rewindInit(&r, 16384) == 0);
+    for(int i = 0; i < REWIND_RUN; i++) {
+        mmu.prg_ram[5] = i >= 50 && i < 60 ? i : 0;   // in the state for those frames only
+        CHECK(rewindPush(&r) == 0);
+        checks[i] = stateCheck();
+        runFrame();
+    }
+    int frames = rewindFrames(&r);
+    CHECK(frames > 5 && frames < REWIND_RUN - 1);
+    CHECK(rewindUsed(&r) <= 16384 + stateSize());
+    for(int back = 1; back <= frames; back++) {
+        CHECK(rewindSeek(&r, 1) == 1 && matchesCheck(&checks[REWIND_RUN - 1 - back]));
+    }
+    rewindFree(&r);
+
+    // Over PRG-RAM turning up and going again
+    busyMachine();
+    CHECK(rewindInit(&r, 1 << 16) == 0);
+    for(int i = 0; i < 80; i++) {
+        mmu.prg_ram[5] = i >= 50 && i < 60 ? i : 0;   // in the state for those frames only
+        CHECK(rewindPush(&r) == 0);
+        checks[i] = stateCheck();
+        runFrame();
+    }
+    CHECK(rewindFrames(&r) == 79);
+    for(int i = 78; i >= 0; i--) {
+        CHECK(rewindSeek(&r, 1) == 1 && matchesCheck(&checks[i]));
+    }
+    rewindFree(&r);
+}
+
+/*
+    Audio ring
+    A counting sequence through the ring from another thread has to come out whole and in order, then
+    the rate control has to push the output rate the right way when the ring runs low or fills up.
+*/
+#define RING_SAMPLES 2000000
+
+static struct audio_ring ring;
+
+static void * produceCount(void * unused) {
+    int16_t chunk[700];
+    for(int sent = 0; sent < RING_SAMPLES; ) {
+        int n = 1 + (sent * 7919u) % 700;                   // odd sizes so the wrap lands everywhere
+        n = n < RING_SAMPLES - sent ? n : RING_SAMPLES - sent;
+        for(int i = 0; i < n; i++) {
+            chunk[i] = sent + i;
+        }
+        int done = 0;
+        while(done < n) {
+            done += ringWrite(&ring, chunk + done, n - done);
+        }
+        sent += n;
+    }
+    return NULL;
+}
+
+static int pushFrame(void) {
+    runFrame();
+    return pushAudio(&ring);
+}
+
+static void testAudioRing(void) {
+    ringInit(&ring, APU_SAMPLE_RATE, 0);
+    pthread_t producer;
+    pthread_create(&producer, NULL, produceCount, NULL);
+    int16_t chunk[512];
+    int wrong = 0;
+    for(int got = 0; got < RING_SAMPLES; ) {
+        int n = ringRead(&ring, chunk, 1 + got % 511);
+        for(int i = 0; i < n; i++) {
+            wrong += chunk[i] != (int16_t) (got + i);
+        }
+        got += n;
+    }
+    pthread_join(producer, NULL);
+    CHECK(wrong == 0);
+    CHECK(ringFill(&ring) == 0 && atomic_load(&ring.overruns) > 0 && atomic_load(&ring.underruns) == 0);
+
+    // Underruns repeat the last sample and get counted
+    int16_t one = 1234;
+    ringWrite(&ring, &one, 1);
+    ringPlay(&ring, chunk, 4);
+    CHECK(chunk[0] == 1234 && chunk[3] == 1234 && atomic_load(&ring.underruns) == 3);
+
+    // A frame is 29780.5 cycles, 798.7 samples at 48 kHz. Emptied every frame the rate goes up...
+    interruptCart(0, 0x8000);
+    ringInit(&ring, APU_SAMPLE_RATE, 4000);
+    int samples = 0;
+    for(int frame = 0; frame < 200; frame++) {
+        samples = pushFrame();
+        while(ringRead(&ring, chunk, 512));
+    }
+    CHECK(samples >= 801);
+    CHECK(atomic_load(&ring.overruns) == 0);
+
+    // ...and never emptied it goes down, until the ring's full and drops them
+    ringInit(&ring, APU_SAMPLE_RATE, 4000);
+    for(int frame = 0; frame < 100; frame++) {
+        samples = pushFrame();
+    }
+    CHECK(samples == 0 && atomic_load(&ring.overruns) > 0);
+    CHECK(ringFill(&ring) == AUDIO_RING_SIZE);
+    uint64_t dropped = atomic_load(&ring.overruns);
+    while(ringRead(&ring, chunk, 512));
+    samples = pushFrame();
+    CHECK(samples > 0 && samples <= 796 && atomic_load(&ring.overruns) == dropped);
+    setSampleRate(APU_SAMPLE_RATE);
+}
+
+static void testTraceFormat(void) {
+    char line[128];
+    struct trace_record jmp = { .cycles = 7, .pc = 0xc000, .bytes = { 0x4c, 0xf5, 0xc5 }, .p = 0x24, .sp = 0xfd };
+    formatRecord(&jmp, line, sizeof(line));
+    CHECK(strcmp(line, "C000  4C F5 C5  JMP  $C5F5        A:00 X:00 Y:00 P:24 SP:FD CYC:7") == 0);
+    struct trace_record bne = { .cycles = 100, .pc = 0xc72a, .bytes = { 0xd0, 0xfe }, .a = 1, .x = 2, .y = 3, .p = 0xa4, .sp = 0xfb };
+    formatRecord(&bne, line, sizeof(line));
+    CHECK(strcmp(line, "C72A  D0 FE     BNE  $C72A        A:01 X:02 Y:03 P:A4 SP:FB CYC:100") == 0);
+
+    // nestest.log's own first line, and its names and stars for the unofficial ones
+    formatNestest(&jmp, line, sizeof(line));
+    CHECK(strcmp(line, "C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7") == 0);
+    struct trace_record isb = { .cycles = 29780, .pc = 0xe5a1, .bytes = { 0xe3, 0x45 }, .p = 0x24, .sp = 0xfd };
+    formatNestest(&isb, line, sizeof(line));
+    CHECK(strcmp(line, "E5A1  E3 45    *ISB ($45,X)                     A:00 X:00 Y:00 P:24 SP:FD PPU:261,339 CYC:29780") == 0);
+}
+
+int main(int argc, char * argv[]) {
+    init_mmu();
+
+    testOpcodes();
+    testFlags();
+    testBranches();
+    testIllegal();
+    testNROM();
+    testMMC1();
+    testUxROM();
+    testCNROM();
+    testMMC3();
+    testScheduler();
+    testInterrupts();
+    testBlockCache();
+    testIdleLoops();
+    testPixels();
+    testPPU();
+    testAPU();
+    testAudioOff();
+    testAudioRing();
+    testSaveState();
+    testRewind();
+    testTraceFormat();
+
     clean_mem();
+    if(failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include "trace.h"
+#include "mmu.h"
+#include "ppu.h"
+
+#define RING_SIZE (1 << 16)         // records, has to be a power of two
+#define RING_MASK (RING_SIZE - 1)
+
+int trace_enabled;
+
+static struct trace_record * ring;
+static _Atomic uint32_t head;       // next slot the CPU fills, only the CPU writes it
+static _Atomic uint32_t tail;       // next slot the writer drains, only the writer writes it
+static uint32_t cached_tail;        // the CPU's last look at tail, so it only touches the writer's side when it looks full
+static atomic_int running;
+static pthread_t writer;
+static FILE * file;
+
+// Instruction bytes without side effects, anything in I/O space reads as 0 instead of poking a register
+static uint8_t peek(uint16_t address) {
+    uint8_t * page = mmu.read_page[address >> 8];
+    return page ? page[address & 0xff] : 0;
+}
+
+void traceRecord(const struct nesCPU * cpu) {
+    uint32_t h = atomic_load_explicit(&head, memory_order_relaxed);
+    if(h - cached_tail == RING_SIZE) {
+        // Full, wait for the writer rather than drop anything, a log with holes in it can't be diffed
+        while(h - (cached_tail = atomic_load_explicit(&tail, memory_order_acquire)) == RING_SIZE) {
+            sched_yield();
+        }
+    }
+    struct trace_record * record = &ring[h & RING_MASK];
+    uint8_t opcode = peek(cpu->pc);
+    int length = opcodes[opcode].length;
+    record->cycles = cpu->cycles;
+    record->pc = cpu->pc;
+    record->bytes[0] = opcode;
+    record->bytes[1] = length > 1 ? peek(cpu->pc + 1) : 0;
+    record->bytes[2] = length > 2 ? peek(cpu->pc + 2) : 0;
+    record->a = cpu->a;
+    record->x = cpu->x;
+    record->y = cpu->y;
+    record->p = getStatus(cpu);
+    record->sp = cpu->sp;
+    memset(record->pad, 0, sizeof(record->pad));
+    atomic_store_explicit(&head, h + 1, memory_order_release);
+}
+
+static void * writeTrace(void * unused) {
+    const struct timespec nap = { 0, 200000 };
+    for(;;) {
+        uint32_t t = atomic_load_explicit(&tail, memory_order_relaxed);
+        uint32_t h = atomic_load_explicit(&head, memory_order_acquire);
+        if(h == t) {
+            // Only stop once the CPU has stopped and everything it wrote before that is out
+            if(!atomic_load(&running) && atomic_load(&head) == t) {
+                break;
+            }
+            nanosleep(&nap, NULL);
+            continue;
+        }
+        // Up to the end of the ring in one go, the wrapped part comes round next time
+        uint32_t start = t & RING_MASK;
+        uint32_t count = h - t;
+        if(count > RING_SIZE - start) {
+            count = RING_SIZE - start;
+        }
+        fwrite(&ring[start], sizeof(struct trace_record), count, file);
+        atomic_store_explicit(&tail, t + count, memory_order_release);
+    }
+    return NULL;
+}
+
+// Returns 0 once tracing is running, -1 if the file can't be made or the hook isn't built in
+int traceStart(const char * filename) {
+    if(!NYMPH_TRACE || trace_enabled) {
+        return -1;
+    }
+    file = fopen(filename, "wb");
+    if(file == NULL) {
+        return -1;
+    }
+    ring = malloc(RING_SIZE * sizeof(struct trace_record));
+    struct trace_header header = { TRACE_MAGIC, TRACE_VERSION, sizeof(struct trace_record) };
+    if(ring == NULL || fwrite(&header, sizeof(header), 1, file) != 1) {
+        free(ring);
+        fclose(file);
+        return -1;
+    }
+    atomic_store(&head, 0);
+    atomic_store(&tail, 0);
+    cached_tail = 0;
+    atomic_store(&running, 1);
+    if(pthread_create(&writer, NULL, writeTrace, NULL) != 0) {
+        free(ring);
+        fclose(file);
+        return -1;
+    }
+    trace_enabled = 1;
+    return 0;
+}
+
+// Flushes everything still in the ring and returns how many records the file ended up with
+uint64_t traceStop(void) {
+    if(!trace_enabled) {
+        return 0;
+    }
+    trace_enabled = 0;
+    atomic_store(&running, 0);
+    pthread_join(writer, NULL);
+    uint64_t records = (ftell(file) - sizeof(struct trace_header)) / sizeof(struct trace_record);
+    fclose(file);
+    free(ring);
+    ring = NULL;
+    return records;
+}
+
+static void formatOperand(const struct trace_record * record, char * out, size_t size) {
+    uint8_t low = record->bytes[1];
+    uint16_t word = record->bytes[1] | (record->bytes[2] << 8);
+    switch(opcodes[record->bytes[0]].mode) {
+        case IMPL:  out[0] = 0; break;
+        case ACC:   snprintf(out, size, "A"); break;
+        case IMM:   snprintf(out, size, "#$%02X", low); break;
+        case ZPG:   snprintf(out, size, "$%02X", low); break;
+        case ZPG_X: snprintf(out, size, "$%02X,X", low); break;
+        case ZPG_Y: snprintf(out, size, "$%02X,Y", low); break;
+        case ABS:   snprintf(out, size, "$%04X", word); break;
+        case ABS_X: snprintf(out, size, "$%04X,X", word); break;
+        case ABS_Y: snprintf(out, size, "$%04X,Y", word); break;
+        case IND:   snprintf(out, size, "($%04X)", word); break;
+        case IND_X: snprintf(out, size, "($%02X,X)", low); break;
+        case IND_Y: snprintf(out, size, "($%02X),Y", low); break;
+        case REL:   snprintf(out, size, "$%04X", (uint16_t) (record->pc + 2 + (int8_t) low)); break;
+    }
+}
+
+// C000  4C F5 C5  JMP $C5F5     A:00 X:00 Y:00 P:24 SP:FD CYC:7
+void formatRecord(const struct trace_record * record, char * out, size_t size) {
+    const struct opcode * op = &opcodes[record->bytes[0]];
+    char bytes[9];
+    char operand[16];
+    switch(op->length) {
+        case 1:  snprintf(bytes, sizeof(bytes), "%02X", record->bytes[0]); break;
+        case 2:  snprintf(bytes, sizeof(bytes), "%02X %02X", record->bytes[0], record->bytes[1]); break;
+        default: snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record->bytes[0], record->bytes[1], record->bytes[2]); break;
+    }
+    formatOperand(record, operand, sizeof(operand));
+    snprintf(out, size, "%04X  %-8s  %-4s %-12s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%" PRIu64,
+             record->pc, bytes, op->name, operand, record->a, record->x, record->y, record->p, record->sp, record->cycles);
+}
+
+/*
+    nestest.log format
+    Same columns as the golden log from Nintendulator, minus the memory values it prints after some
+    operands ("= 00", "@ 0300") which the records don't carry. The PPU position is worked out from the
+    cycle count the way it runs in nestest, three dots a cycle from the top of the frame with rendering off.
+*/
+static int unofficial(uint8_t opcode) {
+    static const char * const names[] = { "SLO", "RLA", "SRE", "RRA", "SAX", "LAX", "DCP", "ISC", "ANC", "ALR",
+                                          "ARR", "ANE", "SHA", "TAS", "SHY", "SHX", "LXA", "SBX", "USBC", "JAM" };
+    if(strcmp(opcodes[opcode].name, "NOP") == 0) {
+        return opcode != 0xea;
+    }
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if(strcmp(opcodes[opcode].name, names[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+void formatNestest(const struct trace_record * record, char * out, size_t size) {
+    const struct opcode * op = &opcodes[record->bytes[0]];
+    const char * name = op->name;
+    if(strcmp(name, "ISC") == 0) {
+        name = "ISB";
+    } else if(strcmp(name, "USBC") == 0) {
+        name = "SBC";
+    }
+    char bytes[9];
+    char operand[16];
+    char text[32];
+    switch(op->length) {
+        case 1:  snprintf(bytes, sizeof(bytes), "%02X", record->bytes[0]); break;
+        case 2:  snprintf(bytes, sizeof(bytes), "%02X %02X", record->bytes[0], record->bytes[1]); break;
+        default: snprintf(bytes, sizeof(bytes), "%02X %02X %02X", record->bytes[0], record->bytes[1], record->bytes[2]); break;
+    }
+    formatOperand(record, operand, sizeof(operand));
+    snprintf(text, sizeof(text), "%s%s%s", name, operand[0] ? " " : "", operand);
+    uint64_t dots = record->cycles * 3;
+    snprintf(out, size, "%04X  %-8s %c%-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3d,%3d CYC:%" PRIu64,
+             record->pc, bytes, unofficial(record->bytes[0]) ? '*' : ' ', text, record->a, record->x, record->y,
+             record->p, record->sp, (int) (dots / DOTS_PER_LINE % LINES_PER_FRAME), (int) (dots % DOTS_PER_LINE), record->cycles);
+}
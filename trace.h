@@ -0,0 +1,59 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include "cpu.h"
+
+/*
+    Instruction tracing
+
+    Build with -DNYMPH_TRACE=1 to get the hook in the CPU at all, without it TRACE_INSTRUCTION() is
+    nothing and release builds pay nothing. With it built in, tracing still only happens between
+    traceStart() and traceStop(), otherwise it's one flag test per instruction.
+
+    While tracing, every instruction drops a fixed size record into a single producer single consumer
+    ring, and a writer thread drains the ring into a file in big chunks. No formatting or stdio
+    happens on the emulator's side, the records get turned into text afterwards by tracetool.
+*/
+#ifndef NYMPH_TRACE
+#define NYMPH_TRACE 0
+#endif
+
+#define TRACE_MAGIC "NYTR"
+#define TRACE_VERSION 1
+
+// Registers as they were before the instruction ran, and its bytes so it can be disassembled later
+struct trace_record {
+    uint64_t cycles;
+    uint16_t pc;
+    uint8_t bytes[3];
+    uint8_t a;
+    uint8_t x;
+    uint8_t y;
+    uint8_t p;
+    uint8_t sp;
+    uint8_t pad[6];
+};
+
+struct trace_header {
+    char magic[4];
+    uint16_t version;
+    uint16_t record_size;
+};
+
+extern int trace_enabled;
+
+void traceRecord(const struct nesCPU * cpu);
+int traceStart(const char * filename);
+uint64_t traceStop(void);
+void formatRecord(const struct trace_record * record, char * out, size_t size);
+void formatNestest(const struct trace_record * record, char * out, size_t size);
+
+#if NYMPH_TRACE
+#define TRACE_INSTRUCTION(cpu) do { if(trace_enabled) { traceRecord(cpu); } } while(0)
+#else
+#define TRACE_INSTRUCTION(cpu) do { } while(0)
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+/*
+    tracetool
+
+    Turns the binary logs from the trace ring (see trace.h) into text, and checks them against golden
+    logs. Everything streams a buffer of records or a line at a time, so logs of any length go through
+    in constant memory.
+
+    tracetool print trace.bin               one disassembled line per instruction
+    tracetool nestest trace.bin             the same in nestest.log's layout
+    tracetool diff expected actual          stop at the first line where the two logs disagree
+
+    diff takes either binary traces or nestest style text logs on both sides and compares the fields,
+    PC, instruction bytes, A X Y P SP and the PPU position and cycle count when both logs have them. The
+    disassembly column is ignored since emulators all print memory operands a little differently. The
+    actual log running on past the end of the expected one is fine, headless runs whole frames.
+
+    For nestest itself, run it from $C000 with no PPU and compare with the log that comes with it:
+        nymph-headless -n 1 -p 0xc000 -t nestest.bin nestest.nes
+        tracetool diff nestest.log nestest.bin
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+#define CHUNK 4096
+#define CONTEXT 8       // lines of agreement shown before a difference
+#define LINE 256
+
+static FILE * openTrace(const char * filename) {
+    FILE * file = fopen(filename, "rb");
+    if(file == NULL) {
+        perror(filename);
+        return NULL;
+    }
+    struct trace_header header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, TRACE_MAGIC, 4) != 0
+       || header.version != TRACE_VERSION || header.record_size != sizeof(struct trace_record)) {
+        fprintf(stderr, "%s: not a trace from this build\n", filename);
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+static int printTrace(const char * filename, void (* format)(const struct trace_record *, char *, size_t)) {
+    FILE * file = openTrace(filename);
+    if(file == NULL) {
+        return 1;
+    }
+    static struct trace_record records[CHUNK];
+    char line[LINE];
+    size_t count;
+    while((count = fread(records, sizeof(struct trace_record), CHUNK, file)) > 0) {
+        for(size_t i = 0; i < count; i++) {
+            format(&records[i], line, sizeof(line));
+            puts(line);
+        }
+    }
+    fclose(file);
+    return 0;
+}
+
+/*
+    Logs
+    One side of a diff, read a line at a time. Binary traces get formatted as nestest lines on the way
+    so both kinds go through the same parser.
+*/
+struct log {
+    const char * name;
+    FILE * file;
+    int binary;
+    struct trace_record records[CHUNK];
+    size_t count;
+    size_t next;
+};
+
+static int openLog(struct log * log, const char * filename) {
+    log->name = filename;
+    log->file = fopen(filename, "rb");
+    if(log->file == NULL) {
+        perror(filename);
+        return -1;
+    }
+    char magic[4];
+    log->binary = fread(magic, 1, 4, log->file) == 4 && memcmp(magic, TRACE_MAGIC, 4) == 0;
+    fclose(log->file);
+    log->file = log->binary ? openTrace(filename) : fopen(filename, "r");
+    log->count = 0;
+    log->next = 0;
+    return log->file ? 0 : -1;
+}
+
+// 1 with the next line in line, 0 at the end
+static int readLog(struct log * log, char * line, size_t size) {
+    if(log->binary) {
+        if(log->next == log->count) {
+            log->count = fread(log->records, sizeof(struct trace_record), CHUNK, log->file);
+            log->next = 0;
+            if(log->count == 0) {
+                return 0;
+            }
+        }
+        formatNestest(&log->records[log->next++], line, size);
+        return 1;
+    }
+    if(fgets(line, size, log->file) == NULL) {
+        return 0;
+    }
+    line[strcspn(line, "\r\n")] = 0;
+    return 1;
+}
+
+struct fields {
+    unsigned pc;
+    unsigned bytes[3];
+    int length;
+    unsigned a, x, y, p, sp;
+    int has_ppu;
+    int line, dot;
+    int has_cycles;
+    unsigned long long cycles;
+};
+
+// C000  4C F5 C5  JMP $C5F5    A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7, -1 if it isn't a trace line at all
+static int parseLine(const char * line, struct fields * f) {
+    memset(f, 0, sizeof(*f));
+    if(strlen(line) < 16 || sscanf(line, "%4x", &f->pc) != 1) {
+        return -1;
+    }
+    char bytes[9];
+    memcpy(bytes, line + 6, 8);
+    bytes[8] = 0;
+    f->length = sscanf(bytes, "%2x %2x %2x", &f->bytes[0], &f->bytes[1], &f->bytes[2]);
+    const char * registers = strstr(line, " A:");
+    if(f->length < 1 || registers == NULL
+       || sscanf(registers, " A:%2x X:%2x Y:%2x P:%2x SP:%2x", &f->a, &f->x, &f->y, &f->p, &f->sp) != 5) {
+        return -1;
+    }
+    const char * ppu = strstr(registers, "PPU:");
+    f->has_ppu = ppu && sscanf(ppu, "PPU:%d,%d", &f->line, &f->dot) == 2;
+    const char * cycles = strstr(registers, "CYC:");
+    f->has_cycles = cycles && sscanf(cycles, "CYC:%llu", &f->cycles) == 1;
+    return 0;
+}
+
+// Names the fields that differ into out, empty if they all match
+static void compareFields(const struct fields * a, const struct fields * b, char * out, size_t size) {
+    out[0] = 0;
+    size_t used = 0;
+#define DIFFERS(name, cond) if(cond) { used += snprintf(out + used, used < size ? size - used : 0, "%s%s", used ? " " : "", name); }
+    DIFFERS("PC", a->pc != b->pc)
+    DIFFERS("bytes", a->length != b->length || memcmp(a->bytes, b->bytes, sizeof(a->bytes)) != 0)
+    DIFFERS("A", a->a != b->a)
+    DIFFERS("X", a->x != b->x)
+    DIFFERS("Y", a->y != b->y)
+    DIFFERS("P", a->p != b->p)
+    DIFFERS("SP", a->sp != b->sp)
+    DIFFERS("PPU", a->has_ppu && b->has_ppu && (a->line != b->line || a->dot != b->dot))
+    DIFFERS("CYC", a->has_cycles && b->has_cycles && a->cycles != b->cycles)
+#undef DIFFERS
+}
+
+static int diffLogs(const char * expected_name, const char * actual_name) {
+    static struct log expected, actual;
+    if(openLog(&expected, expected_name) != 0) {
+        return 2;
+    }
+    if(openLog(&actual, actual_name) != 0) {
+        fclose(expected.file);
+        return 2;
+    }
+    static char context[CONTEXT][LINE];
+    char want[LINE];
+    char got[LINE];
+    char differs[64];
+    unsigned long long n = 0;
+    int result = 0;
+    while(readLog(&expected, want, sizeof(want))) {
+        n++;
+        struct fields w, g;
+        if(parseLine(want, &w) != 0) {
+            context[n % CONTEXT][0] = 0;
+            continue;       // headers or blank lines in hand made logs
+        }
+        if(!readLog(&actual, got, sizeof(got))) {
+            printf("%s ends at line %llu, %s goes on:\n< %s\n", actual_name, n, expected_name, want);
+            result = 1;
+            break;
+        }
+        if(parseLine(got, &g) != 0) {
+            snprintf(differs, sizeof(differs), "unreadable line");
+        } else {
+            compareFields(&w, &g, differs, sizeof(differs));
+        }
+        if(differs[0]) {
+            printf("first difference at line %llu (%s)\n", n, differs);
+            unsigned long long first = n > CONTEXT ? n - CONTEXT : 1;
+            for(unsigned long long i = first; i < n; i++) {
+                if(context[i % CONTEXT][0]) {
+                    printf("  %s\n", context[i % CONTEXT]);
+                }
+            }
+            printf("< %s\n> %s\n", want, got);
+            result = 1;
+            break;
+        }
+        snprintf(context[n % CONTEXT], LINE, "%s", want);
+    }
+    if(result == 0) {
+        printf("%llu lines match\n", n);
+    }
+    fclose(expected.file);
+    fclose(actual.file);
+    return result;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: tracetool print trace.bin\n"
+                    "       tracetool nestest trace.bin\n"
+                    "       tracetool diff expected actual\n");
+}
+
+int main(int argc, char * argv[]) {
+    if(argc == 3 && strcmp(argv[1], "print") == 0) {
+        return printTrace(argv[2], formatRecord);
+    }
+    if(argc == 3 && strcmp(argv[1], "nestest") == 0) {
+        return printTrace(argv[2], formatNestest);
+    }
+    if(argc == 4 && strcmp(argv[1], "diff") == 0) {
+        return diffLogs(argv[2], argv[3]);
+    }
+    usage();
+    return 2;
+}